@@ -4,6 +4,12 @@
 
 #include <math.h>
 
+/**
+ * Tolerance below which floating point values (e.g. utility changes and
+ * probability sums) are considered equal or zero.
+ */
+#define ZERO_EPSILON 1e-07
+
 
 /**
  * According to http://www.cygnus-software.com/papers/comparingfloats/comparingfloats.htm
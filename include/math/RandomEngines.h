@@ -0,0 +1,273 @@
+#ifndef MATH_RANDOMENGINES_H
+#define MATH_RANDOMENGINES_H
+// Copyright Jennifer Buehler
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * \brief SplitMix64 generator, used to expand a single 64 bit seed into
+ * the state of the other engines.
+ * See http://prng.di.unimi.it/splitmix64.c
+ */
+class SplitMix64
+{
+public:
+    explicit SplitMix64(uint64_t _x): x(_x) {}
+    uint64_t next()
+    {
+        uint64_t z = (x += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    }
+private:
+    uint64_t x;
+};
+
+/**
+ * \brief The xoshiro256** generator by Blackman and Vigna, with 256 bits of state,
+ * a period of 2^256-1 and 64 bit output.
+ *
+ * jump() advances the state by 2^128 steps, so that successive jumps split the period
+ * into 2^128 non-overlapping streams, e.g. one for each thread.
+ * Satisfies the requirements of a C++11 uniform random bit generator, so it can be
+ * used with the distributions of <random>.
+ * See http://prng.di.unimi.it/xoshiro256starstar.c
+ */
+class Xoshiro256StarStar
+{
+public:
+    typedef uint64_t result_type;
+
+    explicit Xoshiro256StarStar(uint64_t _seed = 0)
+    {
+        seed(_seed);
+    }
+
+    /**
+     * Sets the state from the seed with SplitMix64, as recommended by the authors
+     */
+    void seed(uint64_t _seed)
+    {
+        SplitMix64 sm(_seed);
+        for (int i = 0; i < 4; ++i) s[i] = sm.next();
+    }
+
+    static constexpr result_type min()
+    {
+        return 0;
+    }
+    static constexpr result_type max()
+    {
+        return ~static_cast<result_type>(0);
+    }
+    result_type operator()()
+    {
+        return next();
+    }
+
+    uint64_t next()
+    {
+        const uint64_t result = rotl(s[1] * 5, 7) * 9;
+        const uint64_t t = s[1] << 17;
+        s[2] ^= s[0];
+        s[3] ^= s[1];
+        s[1] ^= s[2];
+        s[0] ^= s[3];
+        s[2] ^= t;
+        s[3] = rotl(s[3], 45);
+        return result;
+    }
+
+    /**
+     * Uniform float in [0..1), from the upper 24 bits
+     */
+    float uniform()
+    {
+        return static_cast<float>(next() >> 40) * (1.0f / 16777216.0f);
+    }
+
+    /**
+     * Uniform integer in [0..n-1], by multiplication instead of modulo (Lemire).
+     * The bias is below n/2^32.
+     */
+    uint32_t below(uint32_t n)
+    {
+        return static_cast<uint32_t>(((next() >> 32) * n) >> 32);
+    }
+
+    /**
+     * Fills buf with n uniform floats in [0..1). Two floats are taken from each
+     * 64 bit output, which makes this about twice as fast as n calls of uniform().
+     */
+    void fill(float * buf, size_t n)
+    {
+        const float scale = 1.0f / 16777216.0f;
+        size_t i = 0;
+        for (; i + 1 < n; i += 2)
+        {
+            uint64_t r = next();
+            buf[i] = static_cast<float>(r >> 40) * scale;
+            buf[i + 1] = static_cast<float>((r >> 8) & 0xffffff) * scale;
+        }
+        if (i < n) buf[i] = uniform();
+    }
+
+    /**
+     * Advances the state by 2^128 steps
+     */
+    void jump()
+    {
+        static const uint64_t JUMP[] = {0x180ec6d33cfd0abaULL, 0xd5a61266f0c9392cULL,
+                                        0xa9582618e03fc9aaULL, 0x39abdc4529b1661cULL};
+        jump(JUMP);
+    }
+
+    /**
+     * Advances the state by 2^192 steps, e.g. to give each process 2^64
+     * streams of its own, which can then be split further with jump().
+     */
+    void longJump()
+    {
+        static const uint64_t LONG_JUMP[] = {0x76e15d3efefdcbbfULL, 0xc5004e441c522fb3ULL,
+                                             0x77710069854ee241ULL, 0x39109bb02acbe635ULL};
+        jump(LONG_JUMP);
+    }
+
+private:
+    static uint64_t rotl(const uint64_t x, int k)
+    {
+        return (x << k) | (x >> (64 - k));
+    }
+
+    void jump(const uint64_t * poly)
+    {
+        uint64_t s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+        for (int i = 0; i < 4; ++i)
+        {
+            for (int b = 0; b < 64; ++b)
+            {
+                if (poly[i] & (static_cast<uint64_t>(1) << b))
+                {
+                    s0 ^= s[0];
+                    s1 ^= s[1];
+                    s2 ^= s[2];
+                    s3 ^= s[3];
+                }
+                next();
+            }
+        }
+        s[0] = s0;
+        s[1] = s1;
+        s[2] = s2;
+        s[3] = s3;
+    }
+
+    uint64_t s[4];
+};
+
+/**
+ * \brief The PCG32 generator by O'Neill (pcg32_random_r), with 64 bits of state
+ * and 32 bit output.
+ *
+ * Generators with different stream ids produce independent sequences, and
+ * advance() jumps ahead by any number of steps in logarithmic time.
+ * Satisfies the requirements of a C++11 uniform random bit generator.
+ * See http://www.pcg-random.org
+ */
+class Pcg32
+{
+public:
+    typedef uint32_t result_type;
+
+    explicit Pcg32(uint64_t _seed = 0, uint64_t _stream = 0)
+    {
+        seed(_seed, _stream);
+    }
+
+    void seed(uint64_t _seed, uint64_t _stream = 0)
+    {
+        state = 0;
+        inc = (_stream << 1) | 1;
+        next();
+        state += _seed;
+        next();
+    }
+
+    static constexpr result_type min()
+    {
+        return 0;
+    }
+    static constexpr result_type max()
+    {
+        return ~static_cast<result_type>(0);
+    }
+    result_type operator()()
+    {
+        return next();
+    }
+
+    uint32_t next()
+    {
+        uint64_t old = state;
+        state = old * Multiplier + inc;
+        uint32_t xorshifted = static_cast<uint32_t>(((old >> 18) ^ old) >> 27);
+        uint32_t rot = static_cast<uint32_t>(old >> 59);
+        return (xorshifted >> rot) | (xorshifted << ((-rot) & 31));
+    }
+
+    /**
+     * Uniform float in [0..1), from the upper 24 bits
+     */
+    float uniform()
+    {
+        return static_cast<float>(next() >> 8) * (1.0f / 16777216.0f);
+    }
+
+    /**
+     * Uniform integer in [0..n-1], by multiplication instead of modulo (Lemire).
+     * The bias is below n/2^32.
+     */
+    uint32_t below(uint32_t n)
+    {
+        return static_cast<uint32_t>((static_cast<uint64_t>(next()) * n) >> 32);
+    }
+
+    /**
+     * Fills buf with n uniform floats in [0..1)
+     */
+    void fill(float * buf, size_t n)
+    {
+        for (size_t i = 0; i < n; ++i) buf[i] = uniform();
+    }
+
+    /**
+     * Advances the state by delta steps, in O(log delta)
+     */
+    void advance(uint64_t delta)
+    {
+        uint64_t curMult = Multiplier, curPlus = inc;
+        uint64_t accMult = 1, accPlus = 0;
+        while (delta > 0)
+        {
+            if (delta & 1)
+            {
+                accMult *= curMult;
+                accPlus = accPlus * curMult + curPlus;
+            }
+            curPlus = (curMult + 1) * curPlus;
+            curMult *= curMult;
+            delta /= 2;
+        }
+        state = accMult * state + accPlus;
+    }
+
+private:
+    static const uint64_t Multiplier = 6364136223846793005ULL;
+
+    uint64_t state;
+    uint64_t inc;  // odd, selects the stream
+};
+
+#endif  // MATH_RANDOMENGINES_H
@@ -2,27 +2,132 @@
 #define MATH_RANDOMNUMBER_H
 // Copyright Jennifer Buehler
 
+#include <math/RandomEngines.h>
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
 
+#include <memory>
+#include <mutex>
+
 /**
- * Interface to random number generator, as defined
- * by srand() and rand() functions.
- * srand(time(NULL)) is called in constructor, and function
- * rand() behaves as the c rand() function.
+ * Interface to the random number generation.
+ *
+ * Each thread draws its random numbers from its own stream of a xoshiro256** generator,
+ * so that threads do not contend for a lock as they would with rand(). The streams are
+ * handed out in the order in which the threads first use them: the first one is the seeded
+ * generator itself, and each further one starts 2^128 numbers later (see
+ * Xoshiro256StarStar::jump()), so that the streams never overlap. seed(time(NULL)) is
+ * called in the constructor.
+ *
+ * Classes which draw random numbers can also be given an engine of their own (EnginePtrT),
+ * e.g. to make them reproducible independent of the threads. engine() returns the given
+ * engine, or the stream of the calling thread if there is none.
  */
 class RandomNumberGenerator
 {
 public:
+    typedef Xoshiro256StarStar EngineT;
+    typedef std::shared_ptr<EngineT> EnginePtrT;
+
     RandomNumberGenerator()
     {
-        srand(time(NULL));
+        seed(time(NULL));
     }
     ~RandomNumberGenerator() {}
+
+    /**
+     * Random number in [0..RAND_MAX], like the c rand() function
+     */
     static int random()
     {
-        return rand();
+        return static_cast<int>(threadEngine().next() % (static_cast<uint64_t>(RAND_MAX) + 1));
+    }
+
+    /**
+     * Uniform random float in [0..1)
+     */
+    static float uniform()
+    {
+        return threadEngine().uniform();
+    }
+
+    /**
+     * Seeds the generator: the calling thread gets the first stream, and the
+     * threads which draw their first random number after this call get the next
+     * ones. Threads which already have a stream keep it.
+     */
+    static void seed(uint64_t s)
+    {
+        {
+            std::lock_guard<std::mutex> lock(streamMutex());
+            streamSource().seed(s);
+        }
+        // set the stream directly, threadEngine() would first take one for an uninitialised thread
+        ThreadStream& t = threadStream();
+        t.engine = newStream();
+        t.initialised = true;
+    }
+
+    /**
+     * Returns a new stream, which does not overlap with any other stream handed out
+     * since the last seed(). Can be used to give an engine of its own to a worker.
+     */
+    static EngineT newStream()
+    {
+        std::lock_guard<std::mutex> lock(streamMutex());
+        EngineT stream = streamSource();
+        streamSource().jump();
+        return stream;
+    }
+
+    /**
+     * The stream of the calling thread
+     */
+    static EngineT& threadEngine()
+    {
+        ThreadStream& t = threadStream();
+        if (!t.initialised)
+        {
+            t.engine = newStream();
+            t.initialised = true;
+        }
+        return t.engine;
+    }
+
+    /**
+     * Returns e, or the stream of the calling thread if e is NULL
+     */
+    static EngineT& engine(const EnginePtrT& e)
+    {
+        return e.get() ? *e : threadEngine();
+    }
+
+private:
+    // the stream of a thread, which is handed out when the thread first uses it or calls seed()
+    struct ThreadStream
+    {
+        ThreadStream(): initialised(false) {}
+        EngineT engine;
+        bool initialised;
+    };
+    static ThreadStream& threadStream()
+    {
+        static thread_local ThreadStream t;
+        return t;
+    }
+
+    // the state from which the next stream is handed out
+    static EngineT& streamSource()
+    {
+        static EngineT source;
+        return source;
+    }
+    static std::mutex& streamMutex()
+    {
+        static std::mutex m;
+        return m;
     }
 };
 
@@ -36,4 +141,3 @@ public:
 extern RandomNumberGenerator _randomNumber;
 
 #endif  // MATH_RANDOMNUMBER_H
-
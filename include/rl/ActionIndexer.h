@@ -0,0 +1,53 @@
+#ifndef RL_ACTIONINDEXER_H
+#define RL_ACTIONINDEXER_H
+// Copyright Jennifer Buehler
+
+#include <memory>
+
+namespace rl
+{
+
+/**
+ * \brief Maps the actions of a domain with a small, fixed set of actions to
+ * dense integer ids in the range [0..size()-1], and back.
+ *
+ * A Domain can optionally provide such an indexer (see Domain::getActionIndexer()),
+ * in which case each action generated by the domain's ActionGenerator must have
+ * a unique id, and each id must belong to a generated action. Tables with one
+ * value per action (see QTable) then find the value of an action with a single
+ * array access. The ids should follow the order of the < operator of the actions,
+ * so that ties between actions are broken the same way as in ordered containers.
+ *
+ * \param Action the action type
+ */
+template<class Action>
+class ActionIndexer
+{
+public:
+    typedef Action ActionT;
+    typedef unsigned int IndexT;
+    typedef ActionIndexer<ActionT> ActionIndexerT;
+    typedef std::shared_ptr<ActionIndexerT> ActionIndexerPtrT;
+    typedef std::shared_ptr<const ActionIndexerT> ActionIndexerConstPtrT;
+
+    ActionIndexer() {}
+    virtual ~ActionIndexer() {}
+
+    /**
+     * Returns the id of the action a
+     */
+    virtual IndexT toIndex(const ActionT& a) const = 0;
+
+    /**
+     * Returns the action with id i
+     */
+    virtual ActionT fromIndex(IndexT i) const = 0;
+
+    /**
+     * Returns the number of ids, i.e. all ids are smaller than this value.
+     */
+    virtual IndexT size() const = 0;
+};
+
+}  // namespace rl
+#endif  // RL_ACTIONINDEXER_H
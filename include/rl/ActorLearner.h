@@ -0,0 +1,439 @@
+#ifndef RL_ACTORLEARNER_H
+#define RL_ACTORLEARNER_H
+// Copyright Jennifer Buehler
+
+#include <rl/LogBinding.h>
+
+#include <math/RandomNumber.h>
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <stddef.h>
+
+namespace rl
+{
+
+/**
+ * \brief Bounded lock-free queue for several producer threads and one consumer thread.
+ *
+ * The elements are kept in a ring buffer whose capacity is a power of two. Each cell
+ * has a sequence number which tells whether it is free for the producer of a given
+ * position or filled for the consumer (D. Vyukov's bounded queue). Producers reserve
+ * a position with a compare-and-swap on the tail, the single consumer advances the
+ * head without atomic read-modify-write operations. Neither push nor pop ever blocks:
+ * tryPush() fails if the queue is full and tryPop() fails if it is empty, so the
+ * caller decides how to wait (back-pressure).
+ *
+ * \param T the element type, has to be default constructible and assignable
+ */
+template<typename T>
+class MPSCQueue
+{
+public:
+    /**
+     * \param _capacity maximum number of elements, rounded up to a power of two
+     */
+    explicit MPSCQueue(size_t _capacity): head(0), tail(0)
+    {
+        size_t capacity = 2;
+        while (capacity < _capacity) capacity *= 2;
+        cells = std::vector<Cell>(capacity);
+        mask = capacity - 1;
+        for (size_t i = 0; i < capacity; ++i) cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    size_t capacity() const
+    {
+        return mask + 1;
+    }
+
+    /**
+     * Adds an element, may be called by several threads at once.
+     * \return false if the queue is full
+     */
+    bool tryPush(const T& v)
+    {
+        size_t pos = tail.load(std::memory_order_relaxed);
+        while (true)
+        {
+            Cell& cell = cells[pos & mask];
+            size_t seq = cell.sequence.load(std::memory_order_acquire);
+            if (seq == pos)
+            {
+                // the cell is free for this position, try to reserve it
+                if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            }
+            else if (seq < pos)
+            {
+                return false;  // the cell still holds the element of the previous round: full
+            }
+            else
+            {
+                pos = tail.load(std::memory_order_relaxed);  // another producer was faster
+            }
+        }
+        Cell& cell = cells[pos & mask];
+        cell.data = v;
+        cell.sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * Removes the oldest element. Must only be called by one thread (the consumer).
+     * \return false if the queue is empty
+     */
+    bool tryPop(T& v)
+    {
+        size_t pos = head;
+        Cell& cell = cells[pos & mask];
+        if (cell.sequence.load(std::memory_order_acquire) != pos + 1) return false;
+        v = cell.data;
+        cell.sequence.store(pos + mask + 1, std::memory_order_release);  // free for the next round
+        head = pos + 1;
+        return true;
+    }
+
+private:
+    MPSCQueue(const MPSCQueue& o);
+
+    struct Cell
+    {
+        Cell(): sequence(0) {}
+        Cell(const Cell& o): sequence(o.sequence.load()), data(o.data) {}
+        Cell& operator=(const Cell& o)
+        {
+            sequence.store(o.sequence.load());
+            data = o.data;
+            return *this;
+        }
+        std::atomic<size_t> sequence;
+        T data;
+    };
+
+    enum {CacheLineSize = 64};
+
+    std::vector<Cell> cells;
+    size_t mask;
+    // The head is only written by the consumer and the tail by the producers, so each
+    // is kept on a cache line of its own. The queue itself is not necessarily aligned
+    // to a cache line (new does not honour alignas() before C++17), so each is
+    // surrounded by a whole line of padding instead, which keeps it off the lines of
+    // the other members at any alignment.
+    char headPadding[CacheLineSize];
+    size_t head;  // next position to pop
+    char tailPadding[CacheLineSize];
+    std::atomic<size_t> tail;  // next position to push
+    char endPadding[CacheLineSize];
+};
+
+
+/**
+ * \brief Counters of an ActorLearner::run(), per stage of the pipeline.
+ */
+struct ActorLearnerStatistics
+{
+    ActorLearnerStatistics(): numActors(0), actorSteps(0), episodes(0), fullWaits(0),
+        updates(0), batches(0), emptyPolls(0), snapshots(0), seconds(0), learnerSeconds(0) {}
+
+    /**
+     * Steps simulated by all actors per second of wall time
+     */
+    double actorStepsPerSecond() const
+    {
+        return (seconds > 0) ? actorSteps / seconds : 0;
+    }
+    /**
+     * Updates done by the learner per second of wall time
+     */
+    double updatesPerSecond() const
+    {
+        return (seconds > 0) ? updates / seconds : 0;
+    }
+    /**
+     * Updates per second of the time the learner spent in updates, i.e. the
+     * throughput the learner could reach if it never had to wait for the actors.
+     */
+    double learnerCapacity() const
+    {
+        return (learnerSeconds > 0) ? updates / learnerSeconds : 0;
+    }
+
+    unsigned int numActors;
+    unsigned long actorSteps;  // transitions pushed by all actors
+    unsigned long episodes;  // terminal states reached by all actors
+    unsigned long fullWaits;  // number of times an actor found the queue full and had to wait
+    unsigned long updates;  // transitions learned
+    unsigned long batches;  // batches drained from the queue by the learner
+    unsigned long emptyPolls;  // number of times the learner found the queue empty and had to wait
+    unsigned long snapshots;  // policy snapshots published for the actors
+    double seconds;  // wall time
+    double learnerSeconds;  // time the learner spent updating (without waiting and snapshots)
+};
+
+
+/**
+ * \brief Q-learning split into a pipeline of actor threads, which simulate the domain,
+ * and one learner thread, which updates the q-table.
+ *
+ * Each actor runs its own episodes with Domain::transferState(), starting in the start
+ * state and in a random state after each terminal state. It picks its actions
+ * epsilon-greedy from a read-only snapshot of the greedy policy, and pushes each experienced
+ * transition (s, a, r, s') into a bounded MPSCQueue. If the queue is full, the
+ * actor waits until the learner has caught up (back-pressure).
+ *
+ * The learner (the thread calling run()) drains the queue in batches and passes each
+ * transition to QLearningController::updateFromTransition(). Every snapshotInterval
+ * updates, it publishes a new snapshot of the greedy policy for the actors. Only the
+ * learner thread accesses the controller during run().
+ *
+ * This separates the cost of simulating the environment from the cost of learning, which
+ * pays off for domains with expensive transitions. Unlike in QLearningController, the
+ * actors do not use the exploration function, as the visit counts live in the learner.
+ *
+ * The domain has to provide a StateIndexer and an ActionIndexer (for the snapshot),
+ * and its transferState(), reward function and state generator have to be safe to call
+ * from several threads at once (which is the case for GridDomain).
+ *
+ * \param Controller the QLearningController type used by the learner
+ */
+template<class Controller>
+class ActorLearner
+{
+public:
+    typedef Controller ControllerT;
+    typedef std::shared_ptr<ControllerT> ControllerPtrT;
+    typedef typename ControllerT::DomainT DomainT;
+    typedef typename DomainT::StateT StateT;
+    typedef typename DomainT::ActionT ActionT;
+    typedef typename DomainT::DomainPtrT DomainPtrT;
+    typedef typename DomainT::RewardConstPtrT RewardConstPtrT;
+    typedef typename DomainT::StateGeneratorConstPtrT StateGeneratorConstPtrT;
+    typedef typename DomainT::StateIndexerConstPtrT StateIndexerConstPtrT;
+    typedef typename DomainT::ActionIndexerConstPtrT ActionIndexerConstPtrT;
+    typedef typename ControllerT::RewardValueTypeT RewardValueTypeT;
+    typedef unsigned int IndexT;
+
+    /**
+     * \brief One experienced transition
+     */
+    struct Experience
+    {
+        StateT s;
+        ActionT a;
+        RewardValueTypeT r;  // reward received in next
+        StateT next;
+    };
+
+    /**
+     * \param _domain the domain to be simulated by the actors
+     * \param _controller the controller which learns from the transitions
+     * \param _epsilonGreedy probability that an actor takes a random action instead of the greedy one
+     * \param queueCapacity maximum number of transitions waiting for the learner
+     * \param _batchSize maximum number of transitions the learner takes from the queue at once
+     * \param _snapshotInterval number of updates after which a new policy snapshot is published
+     */
+    ActorLearner(DomainPtrT _domain, ControllerPtrT _controller, float _epsilonGreedy,
+                 size_t queueCapacity = 4096, unsigned int _batchSize = 256,
+                 unsigned long _snapshotInterval = 10000):
+        domain(_domain), controller(_controller), epsilonGreedy(_epsilonGreedy),
+        batchSize(_batchSize > 0 ? _batchSize : 1), snapshotInterval(_snapshotInterval),
+        reward(_domain->getReward()), stateGenerator(_domain->getStateGenerator()),
+        stateIndexer(_domain->getStateIndexer()), actionIndexer(_domain->getActionIndexer()),
+        queue(queueCapacity), activeActors(0), snapshotVersion(0) {}
+
+    /**
+     * Runs numActors actor threads, each of which simulates stepsPerActor transitions,
+     * and learns from all of them in the calling thread.
+     * \return false if the domain does not provide the required indexers or reward function
+     */
+    bool run(unsigned int numActors, unsigned long stepsPerActor)
+    {
+        if (!stateIndexer.get() || !actionIndexer.get() || (actionIndexer->size() == 0))
+        {
+            PRINTERROR("The actor-learner needs a state and an action indexer for the domain");
+            return false;
+        }
+        if (!reward.get() || !stateGenerator.get())
+        {
+            PRINTERROR("The actor-learner needs a reward function and a state generator");
+            return false;
+        }
+        if (numActors == 0) numActors = 1;
+
+        statistics = ActorLearnerStatistics();
+        statistics.numActors = numActors;
+        publishSnapshot();
+
+        std::vector<ActorCounters> counters(numActors);
+        std::vector<std::thread> actors;
+        activeActors.store(numActors);
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (unsigned int i = 0; i < numActors; ++i)
+        {
+            actors.push_back(std::thread(&ActorLearner::act, this, RandomNumberGenerator::newStream(),
+                                         stepsPerActor, &counters[i]));
+        }
+        learn();
+        for (size_t i = 0; i < actors.size(); ++i)
+        {
+            actors[i].join();
+        }
+        statistics.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        for (unsigned int i = 0; i < numActors; ++i)
+        {
+            statistics.actorSteps += counters[i].steps;
+            statistics.episodes += counters[i].episodes;
+            statistics.fullWaits += counters[i].fullWaits;
+        }
+        return true;
+    }
+
+    /**
+     * Counters of the last call of run()
+     */
+    const ActorLearnerStatistics& getLastStatistics() const
+    {
+        return statistics;
+    }
+
+private:
+    ActorLearner(const ActorLearner& o);
+
+    enum {NoAction = 0xffffffff};
+    // greedy action id for each state id, or NoAction
+    typedef std::vector<IndexT> SnapshotT;
+    typedef std::shared_ptr<const SnapshotT> SnapshotConstPtrT;
+
+    // the counters of each actor, which it stores once when it has finished
+    struct ActorCounters
+    {
+        ActorCounters(): steps(0), episodes(0), fullWaits(0) {}
+        unsigned long steps;
+        unsigned long episodes;
+        unsigned long fullWaits;
+    };
+
+    /**
+     * Creates a snapshot of the greedy policy of the controller and makes it visible to the actors.
+     */
+    void publishSnapshot()
+    {
+        std::shared_ptr<SnapshotT> snapshot(new SnapshotT(stateIndexer->size(), static_cast<IndexT>(NoAction)));
+        ActionT a;
+        for (IndexT i = 0; i < snapshot->size(); ++i)
+        {
+            if (controller->getGreedyAction(stateIndexer->fromIndex(i), a)) (*snapshot)[i] = actionIndexer->toIndex(a);
+        }
+        std::atomic_store(&policySnapshot, SnapshotConstPtrT(snapshot));
+        snapshotVersion.fetch_add(1, std::memory_order_release);
+        ++statistics.snapshots;
+    }
+
+    void learn()
+    {
+        std::vector<Experience> batch(batchSize);
+        unsigned long sinceSnapshot = 0;
+        while (true)
+        {
+            unsigned int n = 0;
+            while ((n < batchSize) && queue.tryPop(batch[n])) ++n;
+            if (n == 0)
+            {
+                if (activeActors.load(std::memory_order_acquire) > 0)
+                {
+                    ++statistics.emptyPolls;
+                    std::this_thread::yield();
+                    continue;
+                }
+                // the actors finish after their last push, so the queue is complete now
+                while ((n < batchSize) && queue.tryPop(batch[n])) ++n;
+                if (n == 0) break;
+            }
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            for (unsigned int i = 0; i < n; ++i)
+            {
+                controller->updateFromTransition(batch[i].s, batch[i].a, batch[i].r, batch[i].next);
+            }
+            statistics.learnerSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            statistics.updates += n;
+            ++statistics.batches;
+            sinceSnapshot += n;
+            if ((snapshotInterval > 0) && (sinceSnapshot >= snapshotInterval))
+            {
+                publishSnapshot();
+                sinceSnapshot = 0;
+            }
+        }
+    }
+
+    void act(RandomNumberGenerator::EngineT rng, unsigned long steps, ActorCounters * counters)
+    {
+
+        SnapshotConstPtrT snapshot = std::atomic_load(&policySnapshot);
+        unsigned long seenVersion = snapshotVersion.load(std::memory_order_acquire);
+
+        Experience e;
+        e.s = domain->getStartState();
+        unsigned long step = 0;
+        // counted locally, as the counters of the actors may share cache lines
+        unsigned long episodes = 0;
+        unsigned long fullWaits = 0;
+        while (step < steps)
+        {
+            if (domain->isTerminalState(e.s))
+            {
+                ++episodes;
+                while (domain->isTerminalState(e.s)) e.s = stateGenerator->randomState();
+            }
+            // only load the snapshot pointer if a new one has been published
+            unsigned long version = snapshotVersion.load(std::memory_order_acquire);
+            if (version != seenVersion)
+            {
+                snapshot = std::atomic_load(&policySnapshot);
+                seenVersion = version;
+            }
+
+            IndexT a = static_cast<IndexT>(NoAction);
+            if (rng.uniform() >= epsilonGreedy) a = (*snapshot)[stateIndexer->toIndex(e.s)];
+            if (a == static_cast<IndexT>(NoAction)) a = rng.below(actionIndexer->size());
+            e.a = actionIndexer->fromIndex(a);
+            e.next = domain->transferState(e.s, e.a);
+            e.r = reward->getReward(e.next);
+
+            if (!queue.tryPush(e))
+            {
+                ++fullWaits;
+                while (!queue.tryPush(e)) std::this_thread::yield();
+            }
+            ++step;
+            e.s = e.next;
+        }
+        counters->steps = step;
+        counters->episodes = episodes;
+        counters->fullWaits = fullWaits;
+        activeActors.fetch_sub(1, std::memory_order_release);
+    }
+
+    DomainPtrT domain;
+    ControllerPtrT controller;
+    float epsilonGreedy;
+    unsigned int batchSize;
+    unsigned long snapshotInterval;
+
+    RewardConstPtrT reward;
+    StateGeneratorConstPtrT stateGenerator;
+    StateIndexerConstPtrT stateIndexer;
+    ActionIndexerConstPtrT actionIndexer;
+
+    MPSCQueue<Experience> queue;
+    std::atomic<unsigned int> activeActors;
+    SnapshotConstPtrT policySnapshot;  // accessed with std::atomic_load / std::atomic_store
+    std::atomic<unsigned long> snapshotVersion;
+    ActorLearnerStatistics statistics;
+};
+
+}  // namespace rl
+#endif  // RL_ACTORLEARNER_H
@@ -0,0 +1,136 @@
+#ifndef RL_BELLMANKERNEL_H
+#define RL_BELLMANKERNEL_H
+// Copyright Jennifer Buehler
+
+// The vectorized kernels are only compiled for x86 with GCC or clang, and
+// they can be disabled altogether by defining RL_DISABLE_SIMD.
+#if !defined(RL_DISABLE_SIMD) && (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define RL_SIMD_X86
+#include <immintrin.h>
+#endif
+
+namespace rl
+{
+
+/**
+ * \brief Kernels for the inner loop of a Bellman backup on a sparse transition row:
+ * the dot product sum_i[p[i]*u[succ[i]]] of the transition probabilities with the
+ * utilities of the successor states, gathered by index.
+ *
+ * On x86, AVX-512 or AVX2 versions are chosen at runtime depending on the CPU,
+ * with a portable scalar version as fallback. The vectorized versions add up the
+ * products in a different order, which can change the last bits of the result.
+ * They are therefore only used for rows of at least MinSimdRowLength entries, so
+ * results for short rows (e.g. the grid world, with up to 4 successors) are the same
+ * as the ones of MaxUtilityActionAlgorithm. All algorithms on a FlatModel use the same
+ * kernel, so they are always consistent with each other.
+ */
+class BellmanKernel
+{
+public:
+    typedef unsigned int IndexT;
+    typedef float (*GatherDotFunctionT)(const IndexT * succ, const float * p, IndexT n, const float * u);
+
+    enum {MinSimdRowLength = 8};
+
+    /**
+     * Computes sum_i[p[i]*u[succ[i]]] for i=0..n-1 with the fastest kernel available.
+     */
+    static float gatherDot(const IndexT * succ, const float * p, IndexT n, const float * u)
+    {
+        if (n < MinSimdRowLength) return gatherDotScalar(succ, p, n, u);
+        static const GatherDotFunctionT f = selectGatherDot();
+        return f(succ, p, n, u);
+    }
+
+    static float gatherDotScalar(const IndexT * succ, const float * p, IndexT n, const float * u)
+    {
+        float ut = 0;
+        for (IndexT i = 0; i < n; ++i)
+        {
+            ut += p[i] * u[succ[i]];
+        }
+        return ut;
+    }
+
+#ifdef RL_SIMD_X86
+    __attribute__((target("avx2")))
+    static float gatherDotAVX2(const IndexT * succ, const float * p, IndexT n, const float * u)
+    {
+        __m256 sum = _mm256_setzero_ps();
+        IndexT i = 0;
+        for (; i + 8 <= n; i += 8)
+        {
+            __m256i idx = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(succ + i));
+            __m256 vals = _mm256_i32gather_ps(u, idx, 4);
+            sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_loadu_ps(p + i), vals));
+        }
+        __m128 half = _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1));
+        half = _mm_add_ps(half, _mm_movehl_ps(half, half));
+        half = _mm_add_ss(half, _mm_shuffle_ps(half, half, 1));
+        float ut = _mm_cvtss_f32(half);
+        for (; i < n; ++i)
+        {
+            ut += p[i] * u[succ[i]];
+        }
+        return ut;
+    }
+
+    __attribute__((target("avx512f")))
+    static float gatherDotAVX512(const IndexT * succ, const float * p, IndexT n, const float * u)
+    {
+        __m512 sum = _mm512_setzero_ps();
+        IndexT i = 0;
+        for (; i + 16 <= n; i += 16)
+        {
+            __m512i idx = _mm512_loadu_si512(succ + i);
+            // the gather with a zero source and a full mask does not read an undefined source register
+            __m512 vals = _mm512_mask_i32gather_ps(_mm512_setzero_ps(), 0xffff, idx, u, 4);
+            sum = _mm512_add_ps(sum, _mm512_mul_ps(_mm512_loadu_ps(p + i), vals));
+        }
+        if (i < n)
+        {
+            // remaining entries with a masked load and gather
+            __mmask16 mask = static_cast<__mmask16>((1u << (n - i)) - 1);
+            __m512i idx = _mm512_maskz_loadu_epi32(mask, succ + i);
+            __m512 vals = _mm512_mask_i32gather_ps(_mm512_setzero_ps(), mask, idx, u, 4);
+            sum = _mm512_add_ps(sum, _mm512_mul_ps(_mm512_maskz_loadu_ps(mask, p + i), vals));
+        }
+        // pairwise horizontal sum through memory, _mm512_reduce_add_ps() uses undefined registers
+        float lanes[16];
+        _mm512_storeu_ps(lanes, sum);
+        for (int k = 8; k > 0; k /= 2)
+        {
+            for (int j = 0; j < k; ++j) lanes[j] += lanes[j + k];
+        }
+        return lanes[0];
+    }
+#endif
+
+    /**
+     * Returns the name of the kernel used for rows of at least MinSimdRowLength entries
+     */
+    static const char * name()
+    {
+#ifdef RL_SIMD_X86
+        GatherDotFunctionT f = selectGatherDot();
+        if (f == &gatherDotAVX512) return "avx512";
+        if (f == &gatherDotAVX2) return "avx2";
+#endif
+        return "scalar";
+    }
+
+private:
+    static GatherDotFunctionT selectGatherDot()
+    {
+#ifdef RL_SIMD_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f")) return &gatherDotAVX512;
+        if (__builtin_cpu_supports("avx2")) return &gatherDotAVX2;
+#endif
+        return &gatherDotScalar;
+    }
+};
+
+}  // namespace rl
+#endif  // RL_BELLMANKERNEL_H
@@ -0,0 +1,298 @@
+#ifndef RL_CHANGESTATISTICS_H
+#define RL_CHANGESTATISTICS_H
+// Copyright Jennifer Buehler
+
+#include <iostream>
+#include <vector>
+#include <math.h>
+
+namespace rl
+{
+
+/**
+ * \brief Running statistics of the changes done to values during learning, e.g. the
+ * changes of the q-values in QLearningController.
+ *
+ * Which statistics are kept is chosen at runtime with a combination of the
+ * Kind flags. Adding a change and reading any of the statistics takes constant time:
+ * - Window: the average of the last windowSize changes, kept in a ring buffer with
+ *   a running sum. The sum is re-computed once each time the ring buffer wraps around,
+ *   so rounding errors do not accumulate, which keeps it amortised constant.
+ * - MovingAverage: exponential moving average of |change|
+ * - MeanVariance: mean and variance of |change| over all changes (Welford's algorithm)
+ * - Histogram: number of changes with |change| in each power-of-two interval
+ *
+ * The window keeps the signed changes, the other statistics the magnitude of the changes.
+ */
+class ChangeStatistics
+{
+public:
+    enum Kind
+    {
+        None = 0,
+        Window = 1,
+        MovingAverage = 2,
+        MeanVariance = 4,
+        Histogram = 8,
+        All = Window | MovingAverage | MeanVariance | Histogram
+    };
+
+    /**
+     * The histogram has NumBuckets buckets: bucket 0 counts the changes with
+     * |change| < 2^MinExponent, bucket i > 0 the ones with 2^(MinExponent+i-1) <= |change| < 2^(MinExponent+i),
+     * and the last bucket all bigger changes too.
+     */
+    enum {NumBuckets = 32, MinExponent = -24};
+
+    /**
+     * \param _kinds combination of Kind flags of the statistics to keep
+     * \param _windowSize number of last changes to average for Window
+     * \param _alpha weight of a new change in the exponential moving average
+     */
+    explicit ChangeStatistics(unsigned int _kinds = Window, unsigned int _windowSize = 10000, double _alpha = 0.001):
+        kinds(_kinds), windowSize(_windowSize), alpha(_alpha)
+    {
+        if (windowSize == 0) windowSize = 1;
+        if (kinds & Window) window.resize(windowSize);
+        reset();
+    }
+
+    /**
+     * Forgets all changes added so far
+     */
+    void reset()
+    {
+        windowFill = 0;
+        windowPos = 0;
+        windowSum = 0;
+        ema = 0;
+        n = 0;
+        mean = 0;
+        m2 = 0;
+        for (unsigned int i = 0; i < NumBuckets; ++i) buckets[i] = 0;
+    }
+
+    unsigned int getKinds() const
+    {
+        return kinds;
+    }
+    bool keeps(Kind k) const
+    {
+        return (kinds & k) != 0;
+    }
+    unsigned int getWindowSize() const
+    {
+        return windowSize;
+    }
+
+    void add(float change)
+    {
+        ++n;
+        if (kinds == None) return;
+        if (kinds & Window) addToWindow(change);
+        double absChange = fabs(change);
+        if (kinds & MovingAverage)
+        {
+            ema = (n == 1) ? absChange : ema + alpha * (absChange - ema);
+        }
+        if (kinds & MeanVariance)
+        {
+            double delta = absChange - mean;
+            mean += delta / n;
+            m2 += delta * (absChange - mean);
+        }
+        if (kinds & Histogram)
+        {
+            ++buckets[getBucket(absChange)];
+        }
+    }
+
+    /**
+     * Number of changes added since construction or the last reset()
+     */
+    unsigned long getCount() const
+    {
+        return n;
+    }
+
+    /**
+     * Average of the last getWindowSize() changes (or less, if there were not as many yet).
+     * 0 if Window is not kept.
+     */
+    double getWindowAverage() const
+    {
+        if (windowFill == 0) return 0;
+        return windowSum / windowFill;
+    }
+
+    /**
+     * Exponential moving average of |change|. 0 if MovingAverage is not kept.
+     */
+    double getMovingAverage() const
+    {
+        return ema;
+    }
+
+    /**
+     * Mean of |change| over all changes. 0 if MeanVariance is not kept.
+     */
+    double getMean() const
+    {
+        return mean;
+    }
+
+    /**
+     * Sample variance of |change| over all changes. 0 if MeanVariance is not kept.
+     */
+    double getVariance() const
+    {
+        if (n < 2) return 0;
+        return m2 / (n - 1);
+    }
+
+    /**
+     * Number of changes in bucket i of the histogram. 0 if Histogram is not kept.
+     */
+    unsigned long getBucketCount(unsigned int i) const
+    {
+        return buckets[i];
+    }
+
+    /**
+     * The upper bound of |change| for bucket i of the histogram (infinity for the last bucket)
+     */
+    static double getBucketUpperBound(unsigned int i)
+    {
+        if (i + 1 >= NumBuckets) return HUGE_VAL;
+        return ldexp(1.0, static_cast<int>(MinExponent) + static_cast<int>(i));
+    }
+
+    /**
+     * The bucket of the histogram into which a change of magnitude absChange falls
+     */
+    static unsigned int getBucket(double absChange)
+    {
+        int exp = 0;
+        frexp(absChange, &exp);  // absChange = m * 2^exp with 0.5 <= m < 1
+        int b = exp - static_cast<int>(MinExponent);
+        if ((absChange == 0) || (b < 0)) return 0;
+        if (b >= NumBuckets) return NumBuckets - 1;
+        return b;
+    }
+
+    /**
+     * Prints all statistics which are kept
+     */
+    void print(std::ostream& o) const
+    {
+        if (kinds & Window) o << " average q-change in the last " << windowSize << " updates: " << getWindowAverage();
+        if (kinds & MovingAverage) o << " moving average of |q-change|: " << getMovingAverage();
+        if (kinds & MeanVariance)
+            o << " mean of |q-change|: " << getMean() << ", variance: " << getVariance() << " (" << n << " updates)";
+        if (kinds & Histogram)
+        {
+            o << " histogram of |q-change|:";
+            for (unsigned int i = 0; i < NumBuckets; ++i)
+            {
+                if (buckets[i] == 0) continue;
+                o << " <" << getBucketUpperBound(i) << ":" << buckets[i];
+            }
+        }
+    }
+
+private:
+    void addToWindow(float change)
+    {
+        if (windowFill < windowSize)
+        {
+            window[windowFill++] = change;
+            windowSum += change;
+            return;
+        }
+        windowSum += static_cast<double>(change) - window[windowPos];
+        window[windowPos] = change;
+        if (++windowPos == windowSize)
+        {
+            windowPos = 0;
+            windowSum = 0;
+            for (unsigned int i = 0; i < windowSize; ++i) windowSum += window[i];
+        }
+    }
+
+    unsigned int kinds;
+    unsigned int windowSize;
+    double alpha;
+
+    std::vector<float> window;  // ring buffer of the last changes
+    unsigned int windowFill;  // number of changes in window
+    unsigned int windowPos;  // position of the oldest change in window, once it is full
+    double windowSum;  // sum of the changes in window
+
+    double ema;
+
+    unsigned long n;  // number of changes added
+    double mean;  // Welford's running mean and sum of squared differences from it
+    double m2;
+
+    unsigned long buckets[NumBuckets];
+};
+
+
+/**
+ * \brief Statistics policy which keeps no statistics at all.
+ *
+ * Has the interface of ChangeStatistics, but all functions are empty and all
+ * statistics are 0, so a learner which is instantiated with it carries no overhead
+ * for the statistics. The Kind flags passed to the constructor are ignored.
+ */
+class NoChangeStatistics
+{
+public:
+    typedef ChangeStatistics::Kind Kind;
+
+    explicit NoChangeStatistics(unsigned int = ChangeStatistics::None,
+                                unsigned int = 10000, double = 0.001) {}
+
+    void reset() {}
+    unsigned int getKinds() const
+    {
+        return ChangeStatistics::None;
+    }
+    bool keeps(Kind) const
+    {
+        return false;
+    }
+    unsigned int getWindowSize() const
+    {
+        return 0;
+    }
+    void add(float) {}
+    unsigned long getCount() const
+    {
+        return 0;
+    }
+    double getWindowAverage() const
+    {
+        return 0;
+    }
+    double getMovingAverage() const
+    {
+        return 0;
+    }
+    double getMean() const
+    {
+        return 0;
+    }
+    double getVariance() const
+    {
+        return 0;
+    }
+    unsigned long getBucketCount(unsigned int) const
+    {
+        return 0;
+    }
+    void print(std::ostream&) const {}
+};
+
+}  // namespace rl
+#endif  // RL_CHANGESTATISTICS_H
@@ -0,0 +1,843 @@
+#ifndef RL_CHECKPOINT_H
+#define RL_CHECKPOINT_H
+// Copyright Jennifer Buehler
+
+#include <rl/Utility.h>
+#include <rl/Policy.h>
+#include <rl/StateIndexer.h>
+#include <rl/ActionIndexer.h>
+#include <rl/LogBinding.h>
+
+#include <general/Exception.h>
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace rl
+{
+
+/**
+ * \brief Header of a binary checkpoint of q-values (QLearningController) or
+ * utilities (ValueIterationController).
+ *
+ * A checkpoint holds rows of numColumns values: one row per state, with one column per
+ * action slot for q-values, and one column for utilities. The file consists of this header
+ * and two sides, each with the following arrays, each starting at a multiple of Alignment bytes:
+ * - rowIds: the state id (of the StateIndexer of the domain) of each row, uint32
+ * - index: the row of each state id, or NoRow, uint32, idSpace entries
+ * - values: capacity * numColumns values of valueSize bytes
+ * - counts: capacity * numColumns visit counts of countSize bytes (q-values only)
+ * - flags: capacity * numColumns bytes, 1 if the value has been assigned
+ *
+ * The offsets are the ones of side 0, and side 1 follows sideSize bytes later.
+ * The arrays have room for capacity rows, of which the first numRows are in use, so that
+ * rows can be added and changed without moving the arrays. The side of the last
+ * commit is generation & 1, and the other side is the one which is being changed
+ * (see CheckpointWriter). All numbers are stored in the byte order of the machine
+ * which wrote the file, indicated by endianTag.
+ */
+struct CheckpointHeader
+{
+    enum Kind {QValues = 1, Utilities = 2};
+    // order of the q-value columns: by the < operator of the actions, or by the ActionIndexer
+    enum ColumnOrder {SortedActions = 0, ActionIndexerIds = 1};
+    enum {Version = 2, EndianTag = 0x01020304, Alignment = 64, NoRow = 0xffffffff};
+
+    /**
+     * Creates the header of a checkpoint with the given layout and no rows in use
+     */
+    static CheckpointHeader make(Kind kind, uint32_t valueSize, uint32_t countSize,
+                                 uint32_t numColumns, uint32_t idSpace, uint64_t capacity,
+                                 double defaultValue, ColumnOrder columnOrder = SortedActions)
+    {
+        CheckpointHeader h;
+        memset(&h, 0, sizeof(h));
+        memcpy(h.magic, "RLCHKPT", 8);
+        h.version = Version;
+        h.endianTag = EndianTag;
+        h.kind = kind;
+        h.valueSize = valueSize;
+        h.countSize = countSize;
+        h.numColumns = numColumns;
+        h.idSpace = idSpace;
+        h.columnOrder = columnOrder;
+        h.generation = 0;
+        h.numRows[0] = h.numRows[1] = 0;
+        h.capacity = capacity;
+        uint64_t cells = capacity * numColumns;
+        h.rowIdsOffset = align(sizeof(CheckpointHeader));
+        h.indexOffset = align(h.rowIdsOffset + capacity * sizeof(uint32_t));
+        h.valuesOffset = align(h.indexOffset + static_cast<uint64_t>(idSpace) * sizeof(uint32_t));
+        h.countsOffset = align(h.valuesOffset + cells * valueSize);
+        h.flagsOffset = align(h.countsOffset + cells * countSize);
+        h.sideSize = align(h.flagsOffset + cells) - h.rowIdsOffset;
+        h.fileSize = h.rowIdsOffset + 2 * h.sideSize;
+        h.defaultValue = defaultValue;
+        return h;
+    }
+
+    static uint64_t align(uint64_t offset)
+    {
+        return (offset + Alignment - 1) / Alignment * Alignment;
+    }
+
+    char magic[8];
+    uint32_t version;
+    uint32_t endianTag;
+    uint32_t kind;
+    uint32_t valueSize;
+    uint32_t countSize;
+    uint32_t numColumns;
+    uint32_t idSpace;
+    uint32_t columnOrder;
+    uint64_t generation;  // number of commits after the first one
+    uint64_t numRows[2];  // rows in use on each side
+    uint64_t capacity;
+    uint64_t rowIdsOffset;
+    uint64_t indexOffset;
+    uint64_t valuesOffset;
+    uint64_t countsOffset;
+    uint64_t flagsOffset;
+    uint64_t sideSize;
+    uint64_t fileSize;
+    double defaultValue;
+};
+
+
+/**
+ * \brief Read-only view of a checkpoint file, which is memory-mapped.
+ *
+ * Opening the file only checks the header, nothing is parsed or copied: the pages are
+ * read in by the operating system when they are first accessed, so a checkpoint of
+ * any size can be used right away.
+ *
+ * A CheckpointWriter may change the same file while it is mapped (incremental saves).
+ * It only writes the side which is not in use and then switches the generation,
+ * so the data of a generation is complete. Readers take the generation with
+ * getGeneration(), read the arrays of it, and read again if isCurrent() tells
+ * that the generation has changed in the meantime:
+ * \code
+ * uint64_t g;
+ * do
+ * {
+ *     g = file.getGeneration();
+ *     r = file.getRow(id, g);
+ *     ...
+ * }
+ * while (!file.isCurrent(g));
+ * \endcode
+ * Full saves replace the file, so an open CheckpointFile keeps seeing the old version.
+ */
+class CheckpointFile
+{
+public:
+    typedef std::shared_ptr<CheckpointFile> CheckpointFilePtrT;
+    typedef std::shared_ptr<const CheckpointFile> CheckpointFileConstPtrT;
+
+    CheckpointFile(): data(NULL), size(0) {}
+    ~CheckpointFile()
+    {
+        close();
+    }
+
+    /**
+     * Maps the checkpoint file at path into memory and checks its header: all
+     * offsets have to be the ones of the layout which the header describes.
+     * \return false if the file can't be mapped or is not a valid checkpoint
+     */
+    bool open(const std::string& path)
+    {
+        close();
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            PRINTERROR("Could not open checkpoint " << path << ": " << strerror(errno));
+            return false;
+        }
+        struct stat st;
+        if ((fstat(fd, &st) != 0) || (static_cast<size_t>(st.st_size) < sizeof(CheckpointHeader)))
+        {
+            PRINTERROR("Checkpoint " << path << " is too small to be a checkpoint");
+            ::close(fd);
+            return false;
+        }
+        void * p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);  // the mapping stays valid
+        if (p == MAP_FAILED)
+        {
+            PRINTERROR("Could not map checkpoint " << path << ": " << strerror(errno));
+            return false;
+        }
+        data = static_cast<const char*>(p);
+        size = st.st_size;
+
+        const CheckpointHeader& h = getHeader();
+        if (memcmp(h.magic, "RLCHKPT", 8) != 0)
+        {
+            PRINTERROR(path << " is not a checkpoint");
+        }
+        else if (h.endianTag != static_cast<uint32_t>(CheckpointHeader::EndianTag))
+        {
+            PRINTERROR("Checkpoint " << path << " was written on a machine with a different byte order");
+        }
+        else if (h.version != static_cast<uint32_t>(CheckpointHeader::Version))
+        {
+            PRINTERROR("Checkpoint " << path << " has version " << h.version << ", expected "
+                       << CheckpointHeader::Version);
+        }
+        else if (!checkLayout(h))
+        {
+            PRINTERROR("Checkpoint " << path << " is truncated or corrupt");
+        }
+        else
+        {
+            return true;
+        }
+        close();
+        return false;
+    }
+
+    void close()
+    {
+        if (data) munmap(const_cast<char*>(data), size);
+        data = NULL;
+        size = 0;
+    }
+
+    bool isOpen() const
+    {
+        return data != NULL;
+    }
+
+    /**
+     * Checks that the checkpoint has the given kind and layout
+     * \return false (and prints the reason) if it doesn't
+     */
+    bool check(CheckpointHeader::Kind kind, uint32_t valueSize, uint32_t countSize,
+               uint32_t numColumns, uint32_t idSpace) const
+    {
+        const CheckpointHeader& h = getHeader();
+        if (h.kind != static_cast<uint32_t>(kind))
+        {
+            PRINTERROR("The checkpoint holds " << (h.kind == CheckpointHeader::QValues ? "q-values" : "utilities")
+                       << ", not " << (kind == CheckpointHeader::QValues ? "q-values" : "utilities"));
+            return false;
+        }
+        if ((h.valueSize != valueSize) || (h.countSize != countSize))
+        {
+            PRINTERROR("The checkpoint has values of " << h.valueSize << " and counts of " << h.countSize
+                       << " bytes, expected " << valueSize << " and " << countSize);
+            return false;
+        }
+        if ((h.numColumns != numColumns) || (h.idSpace != idSpace))
+        {
+            PRINTERROR("The checkpoint has " << h.numColumns << " columns and " << h.idSpace << " state ids, expected "
+                       << numColumns << " and " << idSpace);
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * The header. Its generation and numRows may be changed by a writer, use
+     * getGeneration() and numRows() for them.
+     */
+    const CheckpointHeader& getHeader() const
+    {
+        return *reinterpret_cast<const CheckpointHeader*>(data);
+    }
+
+    /**
+     * The generation of the last commit, whose data the reads with it return
+     */
+    uint64_t getGeneration() const
+    {
+        uint64_t g = *reinterpret_cast<const volatile uint64_t*>(&getHeader().generation);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return g;
+    }
+
+    /**
+     * \return true if the generation is still the one of the last commit, so that the
+     *      data which has been read with it is complete
+     */
+    bool isCurrent(uint64_t generation) const
+    {
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return *reinterpret_cast<const volatile uint64_t*>(&getHeader().generation) == generation;
+    }
+
+    uint64_t numRows(uint64_t generation) const
+    {
+        return getHeader().numRows[generation & 1];
+    }
+
+    /**
+     * The row of the state with the given id, or CheckpointHeader::NoRow
+     */
+    uint32_t getRow(uint32_t id, uint64_t generation) const
+    {
+        const CheckpointHeader& h = getHeader();
+        if (id >= h.idSpace) return static_cast<uint32_t>(CheckpointHeader::NoRow);
+        uint32_t r = reinterpret_cast<const uint32_t*>(side(h.indexOffset, generation))[id];
+        if (r >= numRows(generation)) return static_cast<uint32_t>(CheckpointHeader::NoRow);
+        return r;
+    }
+
+    /**
+     * The state id of each row
+     */
+    const uint32_t * getRowIds(uint64_t generation) const
+    {
+        return reinterpret_cast<const uint32_t*>(side(getHeader().rowIdsOffset, generation));
+    }
+
+    /**
+     * The values, numColumns per row. ValueT has to have the valueSize of the header.
+     */
+    template<typename ValueT>
+    const ValueT * getValues(uint64_t generation) const
+    {
+        return reinterpret_cast<const ValueT*>(side(getHeader().valuesOffset, generation));
+    }
+
+    /**
+     * The visit counts, numColumns per row. CountT has to have the countSize of the header.
+     */
+    template<typename CountT>
+    const CountT * getCounts(uint64_t generation) const
+    {
+        return reinterpret_cast<const CountT*>(side(getHeader().countsOffset, generation));
+    }
+
+    /**
+     * For each value, 1 if it has been assigned
+     */
+    const uint8_t * getFlags(uint64_t generation) const
+    {
+        return reinterpret_cast<const uint8_t*>(side(getHeader().flagsOffset, generation));
+    }
+
+private:
+    CheckpointFile(const CheckpointFile&);
+    CheckpointFile& operator=(const CheckpointFile&);
+
+    /**
+     * The array at the offset of side 0 on the side of the generation
+     */
+    const char * side(uint64_t offset, uint64_t generation) const
+    {
+        return data + offset + (generation & 1) * getHeader().sideSize;
+    }
+
+    /**
+     * Checks that the offsets are the ones of the layout, and that the file holds it.
+     * The sizes are bounded by the file size first, so that the layout can't overflow.
+     */
+    bool checkLayout(const CheckpointHeader& h) const
+    {
+        if (((h.kind != CheckpointHeader::QValues) && (h.kind != CheckpointHeader::Utilities))
+                || (h.columnOrder > CheckpointHeader::ActionIndexerIds)
+                || (h.valueSize == 0) || (h.valueSize > 8) || (h.countSize > 8)
+                || (h.numColumns == 0) || (h.capacity > size / h.numColumns) || (h.idSpace > size))
+        {
+            return false;
+        }
+        CheckpointHeader l = CheckpointHeader::make(static_cast<CheckpointHeader::Kind>(h.kind), h.valueSize,
+                             h.countSize, h.numColumns, h.idSpace, h.capacity, h.defaultValue,
+                             static_cast<CheckpointHeader::ColumnOrder>(h.columnOrder));
+        return (h.rowIdsOffset == l.rowIdsOffset) && (h.indexOffset == l.indexOffset)
+               && (h.valuesOffset == l.valuesOffset) && (h.countsOffset == l.countsOffset)
+               && (h.flagsOffset == l.flagsOffset) && (h.sideSize == l.sideSize)
+               && (h.fileSize == l.fileSize) && (h.fileSize <= size)
+               && (h.numRows[0] <= h.capacity) && (h.numRows[1] <= h.capacity);
+    }
+
+    const char * data;
+    size_t size;
+};
+
+
+/**
+ * \brief Writes a checkpoint file with pwrite().
+ *
+ * create() writes a new checkpoint into a temporary file next to the target path, which
+ * replaces the target in commit(), so readers never see a half-written file. Until then,
+ * both sides of the file (see CheckpointHeader) are written. After that, the writer keeps
+ * the file open, and rows can be changed and added (up to the capacity), so that a
+ * following save only writes the rows which have changed.
+ *
+ * These writes go to the side which is not in use. Before the first of them, the side
+ * is brought up to date by copying the parts which the last commit has written from
+ * the other side. commit() then flushes the file and switches the generation in the
+ * header with a single aligned write of 8 bytes, which makes the side the one in use,
+ * and flushes again. If the process or the machine fails before, the file still
+ * holds the data of the last commit.
+ */
+class CheckpointWriter
+{
+public:
+    typedef std::shared_ptr<CheckpointWriter> CheckpointWriterPtrT;
+
+    CheckpointWriter(): fd(-1), pending(false), changing(false) {}
+    ~CheckpointWriter()
+    {
+        close();
+    }
+
+    /**
+     * Starts a new checkpoint at path with the layout of header, with no rows in use
+     */
+    bool create(const std::string& _path, const CheckpointHeader& _header)
+    {
+        close();
+        path = _path;
+        tmpPath = path + ".tmp";
+        header = _header;
+        written.clear();
+        fd = ::open(tmpPath.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+        {
+            PRINTERROR("Could not create checkpoint " << tmpPath << ": " << strerror(errno));
+            return false;
+        }
+        pending = true;
+        if (ftruncate(fd, header.fileSize) != 0)
+        {
+            PRINTERROR("Could not allocate " << header.fileSize << " bytes for checkpoint " << tmpPath
+                       << ": " << strerror(errno));
+            close();
+            return false;
+        }
+        // no state has a row yet
+        std::vector<uint32_t> index(header.idSpace, static_cast<uint32_t>(CheckpointHeader::NoRow));
+        return index.empty() || writeSide(header.indexOffset, &index[0], index.size() * sizeof(uint32_t));
+    }
+
+    bool isOpen() const
+    {
+        return fd >= 0;
+    }
+    const std::string& getPath() const
+    {
+        return path;
+    }
+    const CheckpointHeader& getHeader() const
+    {
+        return header;
+    }
+
+    /**
+     * Writes the n rows starting at first: their state ids, values, counts (NULL if the
+     * checkpoint has no counts) and flags, each n * numColumns elements long.
+     * Does not change the index, see writeIndex().
+     */
+    bool writeRows(uint64_t first, uint64_t n, const uint32_t * ids, const void * values,
+                   const void * counts, const uint8_t * flags)
+    {
+        if (first + n > header.capacity)
+        {
+            PRINTERROR("Rows " << first << ".." << (first + n) << " exceed the capacity " << header.capacity
+                       << " of the checkpoint");
+            return false;
+        }
+        uint64_t cell = first * header.numColumns;
+        uint64_t cells = n * header.numColumns;
+        if (!writeSide(header.rowIdsOffset + first * sizeof(uint32_t), ids, n * sizeof(uint32_t))) return false;
+        if (!writeSide(header.valuesOffset + cell * header.valueSize, values, cells * header.valueSize)) return false;
+        if (counts && !writeSide(header.countsOffset + cell * header.countSize, counts, cells * header.countSize))
+            return false;
+        return writeSide(header.flagsOffset + cell, flags, cells);
+    }
+
+    /**
+     * Sets the row of the state with the given id
+     */
+    bool writeIndex(uint32_t id, uint32_t row)
+    {
+        return writeSide(header.indexOffset + static_cast<uint64_t>(id) * sizeof(uint32_t), &row, sizeof(row));
+    }
+
+    /**
+     * Writes the rows of all idSpace state ids at once
+     */
+    bool writeIndex(const uint32_t * index)
+    {
+        if (header.idSpace == 0) return true;
+        return writeSide(header.indexOffset, index, static_cast<uint64_t>(header.idSpace) * sizeof(uint32_t));
+    }
+
+    /**
+     * Makes the rows written since the last commit, with numRows rows in use, the
+     * data of the checkpoint, and flushes the file. The first commit() after create()
+     * replaces the checkpoint at the target path.
+     */
+    bool commit(uint64_t numRows)
+    {
+        if (pending)
+        {
+            header.numRows[0] = header.numRows[1] = numRows;
+            if (!write(0, &header, sizeof(header)) || !flush()) return false;
+            if (rename(tmpPath.c_str(), path.c_str()) != 0)
+            {
+                PRINTERROR("Could not rename " << tmpPath << " to " << path << ": " << strerror(errno));
+                return false;
+            }
+            pending = false;
+            return true;
+        }
+        if (!changing && !beginChange()) return false;
+        unsigned int s = (header.generation + 1) & 1;
+        header.numRows[s] = numRows;
+        if (!write(offsetof(CheckpointHeader, numRows) + s * sizeof(uint64_t), &header.numRows[s], sizeof(uint64_t))
+                || !flush())
+        {
+            return false;
+        }
+        uint64_t generation = header.generation + 1;
+        if (!write(offsetof(CheckpointHeader, generation), &generation, sizeof(generation)) || !flush()) return false;
+        header.generation = generation;
+        changing = false;
+        return true;
+    }
+
+    void close()
+    {
+        if (fd >= 0) ::close(fd);
+        if (pending) unlink(tmpPath.c_str());  // never committed
+        fd = -1;
+        pending = false;
+        changing = false;
+    }
+
+private:
+    CheckpointWriter(const CheckpointWriter&);
+    CheckpointWriter& operator=(const CheckpointWriter&);
+
+    // a part of a side which has been written, by its offset on side 0
+    typedef std::pair<uint64_t, uint64_t> RangeT;
+
+    enum {CopyBufferSize = 1 << 20};
+
+    /**
+     * Writes n bytes at the offset of side 0 to the side which is being changed, or to
+     * both sides before the first commit
+     */
+    bool writeSide(uint64_t offset, const void * buf, uint64_t n)
+    {
+        if (pending) return write(offset, buf, n) && write(offset + header.sideSize, buf, n);
+        if (!changing && !beginChange()) return false;
+        written.push_back(RangeT(offset, n));
+        return write(offset + ((header.generation + 1) & 1) * header.sideSize, buf, n);
+    }
+
+    /**
+     * Copies the parts written by the last commit from the side in use to the other side
+     */
+    bool beginChange()
+    {
+        uint64_t from = (header.generation & 1) * header.sideSize;
+        uint64_t to = ((header.generation + 1) & 1) * header.sideSize;
+        std::vector<char> buf;
+        for (size_t i = 0; i < written.size(); ++i)
+        {
+            for (uint64_t done = 0; done < written[i].second; )
+            {
+                uint64_t n = std::min(written[i].second - done, static_cast<uint64_t>(CopyBufferSize));
+                buf.resize(n);
+                if (!read(written[i].first + done + from, &buf[0], n)) return false;
+                if (!write(written[i].first + done + to, &buf[0], n)) return false;
+                done += n;
+            }
+        }
+        written.clear();
+        changing = true;
+        return true;
+    }
+
+    bool flush()
+    {
+        if (fdatasync(fd) != 0)
+        {
+            PRINTERROR("Could not flush checkpoint " << path << ": " << strerror(errno));
+            return false;
+        }
+        return true;
+    }
+
+    bool read(uint64_t offset, void * buf, uint64_t n)
+    {
+        char * p = static_cast<char*>(buf);
+        while (n > 0)
+        {
+            ssize_t r = pread(fd, p, n, offset);
+            if (r <= 0)
+            {
+                if ((r < 0) && (errno == EINTR)) continue;
+                PRINTERROR("Could not read checkpoint " << path << ": " << (r < 0 ? strerror(errno) : "end of file"));
+                return false;
+            }
+            p += r;
+            offset += r;
+            n -= r;
+        }
+        return true;
+    }
+
+    bool write(uint64_t offset, const void * buf, uint64_t n)
+    {
+        const char * p = static_cast<const char*>(buf);
+        while (n > 0)
+        {
+            ssize_t w = pwrite(fd, p, n, offset);
+            if (w < 0)
+            {
+                if (errno == EINTR) continue;
+                PRINTERROR("Could not write checkpoint " << path << ": " << strerror(errno));
+                return false;
+            }
+            p += w;
+            offset += w;
+            n -= w;
+        }
+        return true;
+    }
+
+    int fd;
+    bool pending;  // created, but not committed yet
+    bool changing;  // the side which is not in use is up to date, and is being changed
+    std::string path;
+    std::string tmpPath;
+    CheckpointHeader header;
+    // the parts written since the last commit, and until beginChange() the ones of the last commit
+    std::vector<RangeT> written;
+};
+
+
+/**
+ * \brief Utility function which reads the values directly from a mapped checkpoint.
+ *
+ * For a checkpoint of utilities, the utility of a state is the value of its row, and
+ * for a checkpoint of q-values it is the maximum q-value of the row, where q-values which have
+ * not been assigned count with the default value (as QTable::getMaxValue()). States without
+ * a row have the default value of the checkpoint. The values can't be changed.
+ */
+template<class State, typename Value = float>
+class CheckpointUtility: public Utility<State, Value>
+{
+public:
+    typedef Value ValueT;
+    typedef State StateT;
+    typedef Utility<StateT, ValueT> UtilityT;
+    typedef typename UtilityT::UtilityPtrT UtilityPtrT;
+    typedef StateIndexer<StateT> StateIndexerT;
+    typedef typename StateIndexerT::StateIndexerConstPtrT StateIndexerConstPtrT;
+    typedef CheckpointUtility<StateT, ValueT> CheckpointUtilityT;
+
+    /**
+     * \param _file the opened checkpoint
+     * \param _indexer the state indexer of the domain the checkpoint was written for
+     */
+    CheckpointUtility(const CheckpointFile::CheckpointFileConstPtrT& _file, const StateIndexerConstPtrT& _indexer):
+        UtilityT(), file(_file), indexer(_indexer)
+    {
+        if (!file.get() || !file->isOpen() || !indexer.get())
+        {
+            throw Exception("CheckpointUtility needs an open checkpoint and a state indexer", __FILE__, __LINE__);
+        }
+        if (file->getHeader().valueSize != sizeof(ValueT))
+        {
+            throw Exception("The values of the checkpoint have a different size than the utility type", __FILE__, __LINE__);
+        }
+    }
+    virtual ~CheckpointUtility() {}
+
+    virtual ValueT getUtility(const StateT& s, float&, float&)const
+    {
+        uint32_t id = indexer->toIndex(s);
+        ValueT u;
+        uint64_t g;
+        do
+        {
+            g = file->getGeneration();
+            u = getStateUtility(id, g);
+        }
+        while (!file->isCurrent(g));
+        return u;
+    }
+
+    virtual void experienceUtility(const StateT&, const ValueT&)
+    {
+        PRINTERROR("The utility of a checkpoint can't be changed");
+    }
+
+    virtual void print(std::stringstream& strng)const
+    {
+        float mean, variance;
+        uint64_t g = file->getGeneration();
+        const uint32_t * ids = file->getRowIds(g);
+        for (uint64_t r = 0; r < file->numRows(g); ++r)
+        {
+            StateT s = indexer->fromIndex(ids[r]);
+            strng << s << " -> " << getUtility(s, mean, variance) << std::endl;
+        }
+    }
+    virtual UtilityPtrT clone()const
+    {
+        return UtilityPtrT(new CheckpointUtilityT(file, indexer));
+    }
+
+private:
+    /**
+     * The utility of the state with the given id in the data of the generation
+     */
+    ValueT getStateUtility(uint32_t id, uint64_t generation) const
+    {
+        const CheckpointHeader& h = file->getHeader();
+        ValueT defaultValue = static_cast<ValueT>(h.defaultValue);
+        uint32_t r = file->getRow(id, generation);
+        if (r == static_cast<uint32_t>(CheckpointHeader::NoRow)) return defaultValue;
+        uint64_t cell = static_cast<uint64_t>(r) * h.numColumns;
+        const ValueT * v = file->getValues<ValueT>(generation) + cell;
+        if (h.kind == CheckpointHeader::Utilities) return v[0];
+        const uint8_t * assigned = file->getFlags(generation) + cell;
+        bool any = false, all = true;
+        ValueT best = defaultValue;
+        for (uint32_t c = 0; c < h.numColumns; ++c)
+        {
+            if (!assigned[c])
+            {
+                all = false;
+                continue;
+            }
+            if (!any || (v[c] > best)) best = v[c];
+            any = true;
+        }
+        if (!all && (defaultValue > best)) return defaultValue;
+        return best;
+    }
+
+    CheckpointFile::CheckpointFileConstPtrT file;
+    StateIndexerConstPtrT indexer;
+};
+
+
+/**
+ * \brief Greedy policy which reads the q-values directly from a mapped checkpoint.
+ *
+ * The action of a state is the one with the maximum assigned q-value (the lowest column
+ * among equal values), as in QTable::getBestSlot(). The columns have to be the ids of the
+ * ActionIndexer, which is the case for checkpoints of a QLearningController whose
+ * domain provides an ActionIndexer. The policy can't be changed.
+ */
+template<class State, class Action, typename Value = float>
+class CheckpointPolicy: public Policy<State, Action>
+{
+public:
+    typedef State StateT;
+    typedef Action ActionT;
+    typedef Value ValueT;
+    typedef Policy<StateT, ActionT> PolicyT;
+    typedef typename PolicyT::PolicyPtrT PolicyPtrT;
+    typedef StateIndexer<StateT> StateIndexerT;
+    typedef typename StateIndexerT::StateIndexerConstPtrT StateIndexerConstPtrT;
+    typedef ActionIndexer<ActionT> ActionIndexerT;
+    typedef typename ActionIndexerT::ActionIndexerConstPtrT ActionIndexerConstPtrT;
+    typedef CheckpointPolicy<StateT, ActionT, ValueT> CheckpointPolicyT;
+
+    CheckpointPolicy(const CheckpointFile::CheckpointFileConstPtrT& _file,
+                     const StateIndexerConstPtrT& _stateIndexer, const ActionIndexerConstPtrT& _actionIndexer):
+        PolicyT(), file(_file), stateIndexer(_stateIndexer), actionIndexer(_actionIndexer)
+    {
+        if (!file.get() || !file->isOpen() || !stateIndexer.get() || !actionIndexer.get())
+        {
+            throw Exception("CheckpointPolicy needs an open checkpoint, a state and an action indexer", __FILE__, __LINE__);
+        }
+        const CheckpointHeader& h = file->getHeader();
+        if ((h.kind != CheckpointHeader::QValues) || (h.columnOrder != CheckpointHeader::ActionIndexerIds)
+                || (h.valueSize != sizeof(ValueT)))
+        {
+            throw Exception("CheckpointPolicy needs a checkpoint of q-values with one column per action id",
+                            __FILE__, __LINE__);
+        }
+    }
+    virtual ~CheckpointPolicy() {}
+
+    virtual bool getAction(const State& s, Action& targetAction) const
+    {
+        uint32_t id = stateIndexer->toIndex(s);
+        uint32_t best;
+        uint64_t g;
+        do
+        {
+            g = file->getGeneration();
+            best = getBestColumn(id, g);
+        }
+        while (!file->isCurrent(g));
+        if (best == file->getHeader().numColumns) return false;
+        targetAction = actionIndexer->fromIndex(best);
+        return true;
+    }
+    virtual void bestAction(const State&, const Action&, float = 1.0, float = 1.0)
+    {
+        PRINTERROR("The policy of a checkpoint can't be changed");
+    }
+    virtual PolicyPtrT clone() const
+    {
+        return PolicyPtrT(new CheckpointPolicyT(file, stateIndexer, actionIndexer));
+    }
+
+    virtual void print(std::ostream& o) const
+    {
+        uint64_t g = file->getGeneration();
+        const uint32_t * ids = file->getRowIds(g);
+        for (uint64_t r = 0; r < file->numRows(g); ++r)
+        {
+            StateT s = stateIndexer->fromIndex(ids[r]);
+            ActionT a;
+            if (getAction(s, a)) o << s << " -> " << a << std::endl;
+        }
+    }
+
+private:
+    /**
+     * The column with the maximum assigned q-value of the state with the given id in the
+     * data of the generation, or numColumns if it has none
+     */
+    uint32_t getBestColumn(uint32_t id, uint64_t generation) const
+    {
+        const CheckpointHeader& h = file->getHeader();
+        uint32_t r = file->getRow(id, generation);
+        if (r == static_cast<uint32_t>(CheckpointHeader::NoRow)) return h.numColumns;
+        uint64_t cell = static_cast<uint64_t>(r) * h.numColumns;
+        const ValueT * v = file->getValues<ValueT>(generation) + cell;
+        const uint8_t * assigned = file->getFlags(generation) + cell;
+        uint32_t best = h.numColumns;
+        for (uint32_t c = 0; c < h.numColumns; ++c)
+        {
+            if (!assigned[c]) continue;
+            if ((best == h.numColumns) || (v[c] > v[best])) best = c;
+        }
+        return best;
+    }
+
+    CheckpointFile::CheckpointFileConstPtrT file;
+    StateIndexerConstPtrT stateIndexer;
+    ActionIndexerConstPtrT actionIndexer;
+};
+
+}  // namespace rl
+#endif  // RL_CHECKPOINT_H
@@ -5,6 +5,8 @@
 #include <rl/Transition.h>
 #include <rl/Reward.h>
 #include <rl/StateAlgorithms.h>
+#include <rl/StateIndexer.h>
+#include <rl/ActionIndexer.h>
 
 namespace rl
 {
@@ -37,11 +39,15 @@ public:
     typedef Reward<StateT, RewardValueTypeT> RewardT;
     typedef StateGenerator<StateT> StateGeneratorT;
     typedef ActionGenerator<ActionT> ActionGeneratorT;
+    typedef StateIndexer<StateT> StateIndexerT;
+    typedef ActionIndexer<ActionT> ActionIndexerT;
 
     typedef typename TransitionT::TransitionConstPtrT TransitionConstPtrT;
     typedef typename RewardT::RewardConstPtrT RewardConstPtrT;
     typedef typename ActionGeneratorT::ActionGeneratorConstPtrT ActionGeneratorConstPtrT;
     typedef typename StateGeneratorT::StateGeneratorConstPtrT StateGeneratorConstPtrT;
+    typedef typename StateIndexerT::StateIndexerConstPtrT StateIndexerConstPtrT;
+    typedef typename ActionIndexerT::ActionIndexerConstPtrT ActionIndexerConstPtrT;
 
     Domain() {}
     virtual ~Domain() {}
@@ -61,6 +67,24 @@ public:
     virtual StateGeneratorConstPtrT getStateGenerator()const = 0;
     virtual ActionGeneratorConstPtrT getActionGenerator()const = 0;
 
+    /**
+     * Optional: returns a mapping of all states to dense integer ids,
+     * or NULL if the domain does not provide such a mapping (the default).
+     */
+    virtual StateIndexerConstPtrT getStateIndexer()const
+    {
+        return StateIndexerConstPtrT();
+    }
+
+    /**
+     * Optional: returns a mapping of all actions to dense integer ids,
+     * or NULL if the domain does not provide such a mapping (the default).
+     */
+    virtual ActionIndexerConstPtrT getActionIndexer()const
+    {
+        return ActionIndexerConstPtrT();
+    }
+
     /**
      * returns a default start state for the world, or the
      * start state which was explicitly set in the domain
@@ -0,0 +1,134 @@
+#ifndef RL_ELIGIBILITYTRACES_H
+#define RL_ELIGIBILITYTRACES_H
+// Copyright Jennifer Buehler
+
+#include <vector>
+
+namespace rl
+{
+
+/**
+ * \brief Sparse storage of the eligibility traces of the state-action pairs of a QTable.
+ *
+ * Only the pairs with a non-negligible trace are kept, in a list which can be iterated
+ * in time proportional to its length. The position of each pair in the list is indexed by
+ * its q-table entry and slot, so that the trace of a pair can be set in constant time.
+ * decay() multiplies all traces by a factor and removes the ones which fall below the
+ * cutoff, which keeps the list short.
+ *
+ * \param EntryT type of the q-table entry indices
+ * \param SlotT type of the q-table slot indices
+ * \param ValueT type of the trace values
+ */
+template<typename EntryT, typename SlotT, typename ValueT = float>
+class EligibilityTraces
+{
+public:
+    struct Trace
+    {
+        Trace(EntryT e, SlotT s, ValueT v): entry(e), slot(s), value(v) {}
+        EntryT entry;
+        SlotT slot;
+        ValueT value;
+    };
+
+    /**
+     * \param _numSlots the number of slots (actions) of each q-table entry
+     */
+    explicit EligibilityTraces(unsigned int _numSlots): numSlots(_numSlots) {}
+
+    /**
+     * Sets the trace of the pair in slot s of entry e to v (replacing trace)
+     */
+    void set(EntryT e, SlotT s, ValueT v)
+    {
+        size_t i = static_cast<size_t>(e) * numSlots + s;
+        if (i >= position.size()) position.resize(i + 1, static_cast<unsigned int>(NoTrace));
+        if (position[i] != static_cast<unsigned int>(NoTrace))
+        {
+            traces[position[i]].value = v;
+            return;
+        }
+        position[i] = traces.size();
+        traces.push_back(Trace(e, s, v));
+    }
+
+    /**
+     * Adds v to the trace of the pair in slot s of entry e (accumulating trace)
+     */
+    void add(EntryT e, SlotT s, ValueT v)
+    {
+        size_t i = static_cast<size_t>(e) * numSlots + s;
+        if ((i < position.size()) && (position[i] != static_cast<unsigned int>(NoTrace)))
+        {
+            traces[position[i]].value += v;
+            return;
+        }
+        set(e, s, v);
+    }
+
+    /**
+     * Multiplies all traces by factor and removes the ones which then are below cutoff
+     */
+    void decay(ValueT factor, ValueT cutoff)
+    {
+        size_t i = 0;
+        while (i < traces.size())
+        {
+            traces[i].value *= factor;
+            if (traces[i].value >= cutoff)
+            {
+                ++i;
+                continue;
+            }
+            // remove by moving the last trace into its place
+            position[index(traces[i])] = static_cast<unsigned int>(NoTrace);
+            if (i + 1 < traces.size())
+            {
+                traces[i] = traces.back();
+                position[index(traces[i])] = i;
+            }
+            traces.pop_back();
+        }
+    }
+
+    /**
+     * Removes all traces, in time proportional to their number
+     */
+    void clear()
+    {
+        for (size_t i = 0; i < traces.size(); ++i)
+        {
+            position[index(traces[i])] = static_cast<unsigned int>(NoTrace);
+        }
+        traces.clear();
+    }
+
+    size_t size() const
+    {
+        return traces.size();
+    }
+    bool empty() const
+    {
+        return traces.empty();
+    }
+    const Trace& operator[](size_t i) const
+    {
+        return traces[i];
+    }
+
+private:
+    enum {NoTrace = -1};
+
+    size_t index(const Trace& t) const
+    {
+        return static_cast<size_t>(t.entry) * numSlots + t.slot;
+    }
+
+    unsigned int numSlots;
+    std::vector<Trace> traces;  // the active traces
+    std::vector<unsigned int> position;  // position in traces by entry*numSlots+slot, or NoTrace
+};
+
+}  // namespace rl
+#endif  // RL_ELIGIBILITYTRACES_H
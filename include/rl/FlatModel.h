@@ -0,0 +1,528 @@
+#ifndef RL_FLATMODEL_H
+#define RL_FLATMODEL_H
+// Copyright Jennifer Buehler
+
+#include <rl/StateAlgorithms.h>
+#include <rl/Transition.h>
+#include <rl/Reward.h>
+#include <rl/Utility.h>
+#include <rl/StateIndexer.h>
+#include <rl/BellmanKernel.h>
+#include <rl/StoppingCriterion.h>
+#include <rl/LogBinding.h>
+
+#include <math/FloatComparison.h>
+#include <general/Exception.h>
+
+#include <algorithm>
+#include <map>
+#include <vector>
+#include <memory>
+#include <stdint.h>
+#include <math.h>
+
+namespace rl
+{
+
+/**
+ * \brief A compiled, flat representation of a (finite) MDP.
+ *
+ * All states generated by a StateGenerator and all actions generated by an
+ * ActionGenerator are enumerated once and assigned dense integer indices
+ * (in the order of generation). The transition function is then stored
+ * in compressed sparse row (CSR) format: there is one row for each
+ * state-action pair (row index = stateIndex * numActions() + actionIndex), and
+ * the successors of row r are the entries rowOffsets[r] .. rowOffsets[r+1]-1
+ * of the arrays successors and probabilities. The rewards are stored in a
+ * dense vector, and terminal states in a bitset.
+ *
+ * If the domain provides a StateIndexer, it is used to look up the index of
+ * a state, otherwise a std::map is used (only when compiling and in getStateIndex()).
+ *
+ * A row without entries means that no transition states are available for
+ * this state-action pair (Transition::getTransitionStates() returned false).
+ *
+ * Algorithms working on this model only deal with integer indices and contiguous
+ * arrays, no virtual calls, map lookups or allocations are needed for a Bellman backup.
+ *
+ * \param State the state type. Must support the < operator.
+ * \param Action the action type. Must support the < operator.
+ */
+template<class State, class Action>
+class FlatModel
+{
+public:
+    typedef State StateT;
+    typedef Action ActionT;
+    typedef unsigned int IndexT;
+    typedef float ValueT;
+
+    typedef FlatModel<StateT, ActionT> FlatModelT;
+    typedef std::shared_ptr<FlatModelT> FlatModelPtrT;
+    typedef std::shared_ptr<const FlatModelT> FlatModelConstPtrT;
+
+    typedef Transition<StateT, ActionT> TransitionT;
+    typedef Reward<StateT, ValueT> RewardT;
+    typedef Utility<StateT, ValueT> UtilityT;
+    typedef StateGenerator<StateT> StateGeneratorT;
+    typedef ActionGenerator<ActionT> ActionGeneratorT;
+    typedef StateIndexer<StateT> StateIndexerT;
+
+    typedef typename TransitionT::TransitionConstPtrT TransitionConstPtrT;
+    typedef typename TransitionT::StateTransitionListT StateTransitionListT;
+    typedef typename TransitionT::StateTransitionListPtrT StateTransitionListPtrT;
+    typedef typename RewardT::RewardConstPtrT RewardConstPtrT;
+    typedef typename UtilityT::UtilityPtrT UtilityPtrT;
+    typedef typename StateGeneratorT::StateGeneratorConstPtrT StateGeneratorConstPtrT;
+    typedef typename ActionGeneratorT::ActionGeneratorConstPtrT ActionGeneratorConstPtrT;
+    typedef typename StateIndexerT::StateIndexerConstPtrT StateIndexerConstPtrT;
+
+    FlatModel() {}
+    virtual ~FlatModel() {}
+
+    /**
+     * Compiles the model from the transition and reward function, enumerating all
+     * states with the state generator and all actions with the action generator.
+     * No state is marked as terminal.
+     * \param indexer optional state indexer, may be NULL.
+     * \return NULL if the model could not be compiled.
+     */
+    static FlatModelPtrT compile(const TransitionConstPtrT& t, const RewardConstPtrT& r,
+                                 const StateGeneratorConstPtrT& sg, const ActionGeneratorConstPtrT& ag,
+                                 const StateIndexerConstPtrT& indexer = StateIndexerConstPtrT())
+    {
+        if (!t.get() || !r.get() || !sg.get() || !ag.get())
+        {
+            PRINTERROR("Can't compile flat model because one of the required objects is NULL");
+            return FlatModelPtrT();
+        }
+        FlatModelPtrT model(new FlatModelT());
+        model->indexer = indexer;
+        if (indexer.get()) model->indexerToState.assign(indexer->size(), InvalidIndex);
+
+        StateCollector stateCollector(*model);
+        if (!sg->foreachState(stateCollector))
+        {
+            PRINTERROR("Could not enumerate all states");
+            return FlatModelPtrT();
+        }
+        ActionCollector actionCollector(*model);
+        if (!ag->foreachAction(actionCollector))
+        {
+            PRINTERROR("Could not enumerate all actions");
+            return FlatModelPtrT();
+        }
+
+        IndexT nStates = model->numStates();
+        IndexT nActions = model->numActions();
+        model->rewards.resize(nStates);
+        model->terminal.assign((nStates + 63) / 64, 0);
+        model->rowOffsets.reserve(static_cast<size_t>(nStates) * nActions + 1);
+        model->rowOffsets.push_back(0);
+        for (IndexT s = 0; s < nStates; ++s)
+        {
+            const StateT& state = model->states[s];
+            model->rewards[s] = r->getReward(state);
+            for (IndexT a = 0; a < nActions; ++a)
+            {
+                if (!model->compileRow(*t, state, model->actions[a]))
+                {
+                    return FlatModelPtrT();
+                }
+            }
+        }
+        return model;
+    }
+
+    /**
+     * Compiles the model from all relevant objects provided by the domain (including
+     * its state indexer, if available), and additionally sets the terminal states as
+     * indicated by Domain::isTerminalState().
+     * \return NULL if the model could not be compiled.
+     */
+    template<class Domain>
+    static FlatModelPtrT compile(const Domain& domain)
+    {
+        FlatModelPtrT model = compile(domain.getTransition(), domain.getReward(),
+                                      domain.getStateGenerator(), domain.getActionGenerator(),
+                                      domain.getStateIndexer());
+        if (!model.get()) return model;
+        for (IndexT s = 0; s < model->numStates(); ++s)
+        {
+            if (domain.isTerminalState(model->states[s])) model->setTerminal(s);
+        }
+        return model;
+    }
+
+    IndexT numStates() const
+    {
+        return states.size();
+    }
+    IndexT numActions() const
+    {
+        return actions.size();
+    }
+    IndexT numRows() const
+    {
+        return rowOffsets.size() - 1;
+    }
+    IndexT numTransitions() const
+    {
+        return successors.size();
+    }
+
+    /**
+     * Returns the index of the row for the state-action pair (s,a)
+     */
+    IndexT row(IndexT s, IndexT a) const
+    {
+        return s * actions.size() + a;
+    }
+    IndexT rowBegin(IndexT r) const
+    {
+        return rowOffsets[r];
+    }
+    IndexT rowEnd(IndexT r) const
+    {
+        return rowOffsets[r + 1];
+    }
+    bool emptyRow(IndexT r) const
+    {
+        return rowOffsets[r] == rowOffsets[r + 1];
+    }
+
+    const StateT& getState(IndexT s) const
+    {
+        return states[s];
+    }
+    const ActionT& getAction(IndexT a) const
+    {
+        return actions[a];
+    }
+
+    /**
+     * Returns the index of the state s. Returns false if this state is not part of the model.
+     */
+    bool getStateIndex(const StateT& s, IndexT& idx) const
+    {
+        if (indexer.get())
+        {
+            IndexT i = indexer->toIndex(s);
+            if ((i >= indexerToState.size()) || (indexerToState[i] == InvalidIndex)) return false;
+            idx = indexerToState[i];
+            return true;
+        }
+        typename StateIndexMapT::const_iterator it = stateIndex.find(s);
+        if (it == stateIndex.end()) return false;
+        idx = it->second;
+        return true;
+    }
+
+    /**
+     * Returns the index of the action a. Returns false if this action is not part of the model.
+     */
+    bool getActionIndex(const ActionT& a, IndexT& idx) const
+    {
+        for (IndexT i = 0; i < actions.size(); ++i)
+        {
+            if (!(actions[i] < a) && !(a < actions[i]))
+            {
+                idx = i;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * Returns the state indexer used, or NULL if the domain did not provide one.
+     */
+    StateIndexerConstPtrT getStateIndexer() const
+    {
+        return indexer;
+    }
+
+    ValueT getReward(IndexT s) const
+    {
+        return rewards[s];
+    }
+
+    bool isTerminal(IndexT s) const
+    {
+        return (terminal[s >> 6] >> (s & 63)) & 1;
+    }
+
+    /**
+     * Calculates sum_over_all_s'[T(s,a,s')*U(s')] for row r with the BellmanKernel.
+     * For rows shorter than BellmanKernel::MinSimdRowLength, the summation order
+     * is the same as in MaxUtilityActionAlgorithm, so the results are identical.
+     */
+    ValueT expectedUtility(IndexT r, const ValueT * u) const
+    {
+        IndexT begin = rowOffsets[r];
+        return BellmanKernel::gatherDot(&successors[0] + begin, &probabilities[0] + begin,
+                                        rowOffsets[r + 1] - begin, u);
+    }
+
+    /**
+     * Finds the action with the maximum expected utility in state s, i.e.
+     * max_over_a{sum_over_all_s'[T(s,a,s')*U(s')]}. As in MaxUtilityActionAlgorithm,
+     * the maximum is initialised with 0, and actions without transition states are
+     * not considered.
+     * \param bestAction index of the best action, or numActions() if no action
+     * exceeded 0.
+     */
+    ValueT maxExpectedUtility(IndexT s, const ValueT * u, IndexT& bestAction) const
+    {
+        ValueT maxVal = 0;
+        bestAction = actions.size();
+        IndexT r = s * actions.size();
+        for (IndexT a = 0; a < actions.size(); ++a, ++r)
+        {
+            if (emptyRow(r)) continue;
+            ValueT ut = expectedUtility(r, u);
+            if (ut > maxVal)
+            {
+                maxVal = ut;
+                bestAction = a;
+            }
+        }
+        return maxVal;
+    }
+
+    /**
+     * The Bellman backup of state s: R(s) + discount * max_over_a{sum_over_all_s'[T(s,a,s')*U(s')]}
+     */
+    ValueT backup(IndexT s, const ValueT * u, ValueT discount) const
+    {
+        IndexT bestAction;
+        return rewards[s] + discount * maxExpectedUtility(s, u, bestAction);
+    }
+
+    /**
+     * Performs the Bellman backup for the states begin..end-1, reading utilities
+     * from in and writing them to out. in and out may be the same array, which
+     * leads to an in-place (Gauss-Seidel) update.
+     * \return the maximum absolute change in utility (residual) of the states.
+     * As in ValueIterationUpdate, a change only counts as new maximum if it is not
+     * within ZERO_EPSILON of the maximum found so far.
+     */
+    ValueT sweep(IndexT begin, IndexT end, ValueT discount, const ValueT * in, ValueT * out) const
+    {
+        ValueT delta = 0;
+        for (IndexT s = begin; s < end; ++s)
+        {
+            ValueT ut = backup(s, in, discount);
+            ValueT utChange = fabs(ut - in[s]);
+            out[s] = ut;
+            if ((utChange > delta) && !equalFloats(utChange, delta, static_cast<ValueT>(ZERO_EPSILON)))
+                delta = utChange;
+        }
+        return delta;
+    }
+
+    /**
+     * Same as sweep(begin, end, discount, in, out), but also collects the statistics
+     * of the utility changes in stats (which is not reset before).
+     */
+    ValueT sweep(IndexT begin, IndexT end, ValueT discount, const ValueT * in, ValueT * out,
+                 SweepStatistics& stats) const
+    {
+        ValueT delta = 0;
+        for (IndexT s = begin; s < end; ++s)
+        {
+            ValueT oldUt = in[s];
+            ValueT ut = backup(s, in, discount);
+            ValueT utChange = fabs(ut - oldUt);
+            out[s] = ut;
+            stats.add(oldUt, ut);
+            if ((utChange > delta) && !equalFloats(utChange, delta, static_cast<ValueT>(ZERO_EPSILON)))
+                delta = utChange;
+        }
+        return delta;
+    }
+
+    /**
+     * Same as sweep(begin, end, discount, in, out, stats), but the states are updated in chunks of
+     * StoppingCriterion::DeadlineChunk states, and the deadline of criterion is checked before each
+     * chunk (with StoppingCriterion::deadlinePassed(), so several threads can share the criterion).
+     * \param expired set to true if the deadline has passed, in which case not all states
+     *      have been updated
+     */
+    ValueT sweep(IndexT begin, IndexT end, ValueT discount, const ValueT * in, ValueT * out,
+                 SweepStatistics& stats, const StoppingCriterion& criterion, bool& expired) const
+    {
+        ValueT delta = 0;
+        expired = false;
+        for (IndexT chunk = begin; chunk < end; chunk += StoppingCriterion::DeadlineChunk)
+        {
+            if (criterion.deadlinePassed())
+            {
+                expired = true;
+                break;
+            }
+            IndexT chunkEnd = std::min(end, static_cast<IndexT>(chunk + StoppingCriterion::DeadlineChunk));
+            ValueT d = sweep(chunk, chunkEnd, discount, in, out, stats);
+            if ((d > delta) && !equalFloats(d, delta, static_cast<ValueT>(ZERO_EPSILON))) delta = d;
+        }
+        return delta;
+    }
+
+    /**
+     * Reads the utility of all states from the utility function u into the vector values.
+     */
+    void readUtility(const UtilityT& u, std::vector<ValueT>& values) const
+    {
+        values.resize(states.size());
+        float mean, variance;  // to be ignored here
+        for (IndexT s = 0; s < states.size(); ++s)
+        {
+            values[s] = u.getUtility(states[s], mean, variance);
+        }
+    }
+
+    /**
+     * Writes the values of all states into the utility function u
+     */
+    void writeUtility(const std::vector<ValueT>& values, UtilityT& u) const
+    {
+        for (IndexT s = 0; s < states.size(); ++s)
+        {
+            u.experienceUtility(states[s], values[s]);
+        }
+    }
+
+    /**
+     * Row offsets into successors and probabilities, size numRows()+1
+     */
+    const std::vector<IndexT>& getRowOffsets() const
+    {
+        return rowOffsets;
+    }
+    const std::vector<IndexT>& getSuccessors() const
+    {
+        return successors;
+    }
+    const std::vector<ValueT>& getProbabilities() const
+    {
+        return probabilities;
+    }
+    const std::vector<ValueT>& getRewards() const
+    {
+        return rewards;
+    }
+
+protected:
+    typedef std::map<StateT, IndexT> StateIndexMapT;
+    static const IndexT InvalidIndex = static_cast<IndexT>(-1);
+
+    /**
+     * Assigns indices to all generated states
+     */
+    class StateCollector: public StateAlgorithm<StateT>
+    {
+    public:
+        explicit StateCollector(FlatModelT& _model): model(_model) {}
+        virtual bool apply(const StateT& s)
+        {
+            IndexT idx = model.states.size();
+            if (model.indexer.get())
+            {
+                IndexT i = model.indexer->toIndex(s);
+                if (i >= model.indexerToState.size())
+                {
+                    PRINTERROR("State " << s << " has an id out of range of the indexer");
+                    return false;
+                }
+                if (model.indexerToState[i] != InvalidIndex)
+                {
+                    PRINTERROR("State " << s << " was generated twice");
+                    return false;
+                }
+                model.indexerToState[i] = idx;
+            }
+            else if (!model.stateIndex.insert(std::make_pair(s, idx)).second)
+            {
+                PRINTERROR("State " << s << " was generated twice");
+                return false;
+            }
+            model.states.push_back(s);
+            return true;
+        }
+    private:
+        FlatModelT& model;
+    };
+
+    /**
+     * Assigns indices to all generated actions
+     */
+    class ActionCollector: public ActionAlgorithm<ActionT>
+    {
+    public:
+        explicit ActionCollector(FlatModelT& _model): model(_model) {}
+        virtual bool apply(const ActionT& a)
+        {
+            model.actions.push_back(a);
+            return true;
+        }
+    private:
+        FlatModelT& model;
+    };
+
+    /**
+     * Appends the row for state-action pair (s,a)
+     */
+    bool compileRow(const TransitionT& t, const StateT& s, const ActionT& a)
+    {
+        StateTransitionListPtrT transitionList;
+        if (t.getTransitionStates(s, a, transitionList) && !transitionList->empty())
+        {
+            float probCnt = 0.0;
+            typename StateTransitionListT::const_iterator it;
+            for (it = transitionList->begin(); it != transitionList->end(); ++it)
+            {
+                IndexT idx;
+                if (!getStateIndex(it->s, idx))
+                {
+                    PRINTERROR("Transition from " << s << " with " << a << " leads to state " << it->s
+                               << " which was not generated by the state generator");
+                    return false;
+                }
+                successors.push_back(idx);
+                probabilities.push_back(it->p);
+                probCnt += it->p;
+            }
+            if (!equalFloats(probCnt, 1.0f, static_cast<float>(ZERO_EPSILON)))
+            {
+                PRINTERROR("Probabilities do not add up to 1 for " << s << " / " << a << ": " << probCnt);
+                return false;
+            }
+        }
+        rowOffsets.push_back(successors.size());
+        return true;
+    }
+
+    void setTerminal(IndexT s)
+    {
+        terminal[s >> 6] |= (static_cast<uint64_t>(1) << (s & 63));
+    }
+
+private:
+    std::vector<StateT> states;
+    std::vector<ActionT> actions;
+    StateIndexMapT stateIndex;  // only used if no indexer is available
+    StateIndexerConstPtrT indexer;
+    std::vector<IndexT> indexerToState;  // maps ids of the indexer to state indices
+
+    std::vector<IndexT> rowOffsets;
+    std::vector<IndexT> successors;
+    std::vector<ValueT> probabilities;
+    std::vector<ValueT> rewards;
+    std::vector<uint64_t> terminal;
+};
+
+template<class State, class Action>
+const typename FlatModel<State, Action>::IndexT FlatModel<State, Action>::InvalidIndex;
+
+}  // namespace rl
+#endif  // RL_FLATMODEL_H
@@ -5,8 +5,11 @@
 #include <rl/StateAlgorithms.h>
 #include <rl/State.h>
 #include <rl/Domain.h>
+#include <rl/StateIndexer.h>
+#include <rl/ActionIndexer.h>
 
 #include <math/RandomNumber.h>
+#include <math/FloatComparison.h>
 #include <general/Exception.h>
 
 #include <stdlib.h>
@@ -46,6 +49,19 @@ public:
         return *this;
     }
 
+    bool operator==(const GridWorldState& o) const
+    {
+        return (x == o.x) && (y == o.y);
+    }
+
+    /**
+     * Hash value for hash tables, see StateHash
+     */
+    size_t hash() const
+    {
+        return (static_cast<size_t>(x) << 16) ^ static_cast<size_t>(y);
+    }
+
 
 protected:
     virtual bool less(const StateT& s) const
@@ -81,6 +97,18 @@ public:
     unsigned int x, y;
 };
 
+/**
+ * Compares grid world states without the virtual less() call
+ */
+template<>
+struct StateEqual<GridWorldState>
+{
+    bool operator()(const GridWorldState& s1, const GridWorldState& s2) const
+    {
+        return s1 == s2;
+    }
+};
+
 /**
  * \brief Action to move in the grid world.
  * \author Jennifer Buehler
@@ -177,10 +205,12 @@ public:
     /**
      * \param _maxX and _maxY: dimensions of the grid world
      * \param _blockX and _blockY: where the block is placed in the world.
+     * \param _rng random engine for randomState(). If NULL, the stream of the calling thread is used.
      */
     GridWorldStateGenerator(unsigned int _maxX,  unsigned int _maxY,
-                            unsigned int _blockX, unsigned int _blockY):
-        maxX(_maxX), maxY(_maxY), blockX(_blockX), blockY(_blockY) {}
+                            unsigned int _blockX, unsigned int _blockY,
+                            const RandomNumberGenerator::EnginePtrT& _rng = RandomNumberGenerator::EnginePtrT()):
+        maxX(_maxX), maxY(_maxY), blockX(_blockX), blockY(_blockY), rng(_rng) {}
 
     virtual ~GridWorldStateGenerator() {}
 
@@ -202,11 +232,12 @@ public:
     }
     virtual GridWorldState randomState()const
     {
+        RandomNumberGenerator::EngineT& r = RandomNumberGenerator::engine(rng);
         unsigned int numX, numY;
         do
         {
-            numX = RandomNumberGenerator::random() % maxX;  // generate 0..(maxX-1)
-            numY = RandomNumberGenerator::random() % maxY;  // generate 0..(maxY-1)
+            numX = r.below(maxX);  // generate 0..(maxX-1)
+            numY = r.below(maxY);  // generate 0..(maxY-1)
         }
         while ((numX == blockX) && (numY == blockY));
         return GridWorldState(numX, numY);
@@ -214,6 +245,61 @@ public:
 
 private:
     unsigned int maxX, maxY, blockX, blockY, goalX, goalY, pitX, pitY;
+    RandomNumberGenerator::EnginePtrT rng;
+};
+
+/**
+ * \brief Maps grid world states to ids x*maxY+y. The id of the
+ * block is included in the range, but the block is never generated.
+ */
+class GridWorldStateIndexer: public StateIndexer<GridWorldState>
+{
+public:
+    /**
+     * \param _maxX and _maxY: dimensions of the grid world
+     */
+    GridWorldStateIndexer(unsigned int _maxX,  unsigned int _maxY):
+        maxX(_maxX), maxY(_maxY) {}
+    virtual ~GridWorldStateIndexer() {}
+
+    virtual IndexT toIndex(const GridWorldState& s) const
+    {
+        return s.x * maxY + s.y;
+    }
+    virtual GridWorldState fromIndex(IndexT i) const
+    {
+        return GridWorldState(i / maxY, i % maxY);
+    }
+    virtual IndexT size() const
+    {
+        return maxX * maxY;
+    }
+private:
+    unsigned int maxX, maxY;
+};
+
+/**
+ * \brief Maps the moves of the grid world to their enum values, which
+ * is also the order of the < operator of MoveAction.
+ */
+class GridWorldActionIndexer: public ActionIndexer<MoveAction>
+{
+public:
+    GridWorldActionIndexer() {}
+    virtual ~GridWorldActionIndexer() {}
+
+    virtual IndexT toIndex(const MoveAction& a) const
+    {
+        return a.getMove();
+    }
+    virtual MoveAction fromIndex(IndexT i) const
+    {
+        return MoveAction(static_cast<MoveAction::MovesT>(i));
+    }
+    virtual IndexT size() const
+    {
+        return 4;
+    }
 };
 
 /**
@@ -226,7 +312,11 @@ class GridWorldActionGenerator: public ActionGenerator<MoveAction>
 public:
     typedef ActionAlgorithm<MoveAction> ActionAlgorithmT;
 
-    GridWorldActionGenerator()
+    /**
+     * \param _rng random engine for randomAction(). If NULL, the stream of the calling thread is used.
+     */
+    explicit GridWorldActionGenerator(const RandomNumberGenerator::EnginePtrT& _rng = RandomNumberGenerator::EnginePtrT()):
+        rng(_rng)
     {
     }
     virtual ~GridWorldActionGenerator() {}
@@ -244,7 +334,7 @@ public:
     }
     virtual MoveAction randomAction()const
     {
-        int num = RandomNumberGenerator::random() % 4;
+        int num = RandomNumberGenerator::engine(rng).below(4);
         // PRINTMSG("Random: "<<num);
         switch (num)
         {
@@ -260,6 +350,8 @@ public:
         PRINTERROR("DEBUG: Should not get here!");
         return MoveAction(MoveAction::Left);
     }
+private:
+    RandomNumberGenerator::EnginePtrT rng;
 };
 
 
@@ -452,6 +544,8 @@ public:
     typedef ActionGenerator<ActionT> ActionGeneratorT;
     typedef Reward<StateT, RewardValueTypeT> RewardT;
     typedef SelectedReward<StateT>  SelectedRewardT;
+    typedef StateIndexer<StateT> StateIndexerT;
+    typedef ActionIndexer<ActionT> ActionIndexerT;
 
 
     typedef Domain<StateT, ActionT> DomainT;
@@ -466,6 +560,25 @@ public:
     typedef typename RewardT::RewardConstPtrT RewardConstPtrT;
     typedef typename StateGeneratorT::StateGeneratorConstPtrT StateGeneratorConstPtrT;
     typedef typename ActionGeneratorT::ActionGeneratorConstPtrT ActionGeneratorConstPtrT;
+    typedef typename StateIndexerT::StateIndexerConstPtrT StateIndexerConstPtrT;
+    typedef typename ActionIndexerT::ActionIndexerConstPtrT ActionIndexerConstPtrT;
+
+    /**
+     * Picks the successor states for transferState() in place of the transition lists.
+     * This keeps GridWorld.h free of the flat model, see setSuccessorSampler().
+     */
+    class SuccessorSampler
+    {
+    public:
+        virtual ~SuccessorSampler() {}
+        /**
+         * Samples the successor of state s with action a, and stores it in next
+         * \return false if the successor could not be sampled
+         */
+        virtual bool transferState(const StateT& s, const ActionT& a,
+                                   RandomNumberGenerator::EngineT& rng, StateT& next) const = 0;
+    };
+    typedef std::shared_ptr<const SuccessorSampler> SuccessorSamplerConstPtrT;
 
     GridDomain(unsigned int _gridX, unsigned int _gridY,
                unsigned int _goalX, unsigned int _goalY,
@@ -476,7 +589,9 @@ public:
         blockX(_blockX), blockY(_blockY), pitX(_pitX), pitY(_pitY),
         defaultReward(_defaultReward), goalReward(_goalReward), pitReward(_pitReward),
         transition(new GridWorldTransition(gridX, gridY, goalX, goalY,
-                                           blockX, blockY, pitX, pitY, _sideActionProbability))
+                                           blockX, blockY, pitX, pitY, _sideActionProbability)),
+        stateIndexer(new GridWorldStateIndexer(gridX, gridY)),
+        actionIndexer(new GridWorldActionIndexer())
     {
     }
 
@@ -498,16 +613,54 @@ public:
 
     virtual StateGeneratorConstPtrT getStateGenerator()const
     {
-        return StateGeneratorConstPtrT(new GridWorldStateGenerator(gridX, gridY, blockX, blockY));
+        return StateGeneratorConstPtrT(new GridWorldStateGenerator(gridX, gridY, blockX, blockY, rng));
     }
     virtual ActionGeneratorConstPtrT getActionGenerator()const
     {
-        return ActionGeneratorConstPtrT(new GridWorldActionGenerator());
+        return ActionGeneratorConstPtrT(new GridWorldActionGenerator(rng));
+    }
+    virtual StateIndexerConstPtrT getStateIndexer()const
+    {
+        return stateIndexer;
+    }
+    virtual ActionIndexerConstPtrT getActionIndexer()const
+    {
+        return actionIndexer;
     }
     virtual StateT getStartState()const
     {
         return GridWorldState(0, 0);
     }
+    /**
+     * Sets the random engine used by transferState() and by the state and action generators
+     * returned from now on. By default (NULL), each thread uses its own stream of
+     * RandomNumberGenerator. With an engine set, the domain can't be used from several
+     * threads at once any more.
+     */
+    void setRandomEngine(const RandomNumberGenerator::EnginePtrT& _rng)
+    {
+        rng = _rng;
+    }
+    RandomNumberGenerator::EnginePtrT getRandomEngine() const
+    {
+        return rng;
+    }
+
+    /**
+     * Lets transferState() pick the successor states with the given sampler instead of
+     * from the transition list, or with NULL from the transition list again. The sampler
+     * has to follow the same probabilities. enableAliasSampling() in GridWorldSampling.h
+     * sets one which samples from alias tables.
+     */
+    void setSuccessorSampler(const SuccessorSamplerConstPtrT& sampler)
+    {
+        sampled = sampler;
+    }
+    SuccessorSamplerConstPtrT getSuccessorSampler() const
+    {
+        return sampled;
+    }
+
     /**
      * Uses a pre-known transition table to transfer the state in a probablistic manner
      */
@@ -515,6 +668,13 @@ public:
     {
         if (isTerminalState(currState)) return currState;
 
+        if (sampled.get())
+        {
+            StateT next;
+            if (!sampled->transferState(currState, action, RandomNumberGenerator::engine(rng), next)) return currState;
+            return next;
+        }
+
         // first, see in which state this action brings us, according to the transition
         // probabilities.
         // Get transition probabilities:
@@ -530,7 +690,7 @@ public:
         // to the probabilities.
         // random number [0..1] for destination state to pick: pick the first one
         // one which causes the cumulation of all probabilites to exceed pRange.
-        float pRange = static_cast<float>(RAND_MAX - RandomNumberGenerator::random()) / static_cast<float>(RAND_MAX);
+        float pRange = 1.0f - RandomNumberGenerator::engine(rng).uniform();
         // PRINTMSG("probability range: "<<pRange);
         StateTransitionListT::iterator sit;
         float cumProb = 0;  // cumulated probabilities
@@ -573,6 +733,11 @@ private:
     float pitReward;
 
     TransitionPtrT transition;
+    StateIndexerConstPtrT stateIndexer;
+    ActionIndexerConstPtrT actionIndexer;
+    RandomNumberGenerator::EnginePtrT rng;
+    // the sampler used by transferState(), if set with setSuccessorSampler()
+    SuccessorSamplerConstPtrT sampled;
 };
 
 
@@ -0,0 +1,249 @@
+#ifndef RL_GRIDWORLDBATCH_H
+#define RL_GRIDWORLDBATCH_H
+// Copyright Jennifer Buehler
+
+#include <rl/GridWorld.h>
+
+#include <math/RandomNumber.h>
+
+#include <memory>
+#include <vector>
+#include <stdint.h>
+
+namespace rl
+{
+
+/**
+ * \brief Runs a number of grid world episodes (lanes) in lockstep.
+ *
+ * Has the same dynamics and rewards as GridDomain, but keeps the states of all
+ * lanes in a structure of arrays and performs one step of all lanes at once in step().
+ * Instead of building the transition lists of GridWorldTransition, the target square is
+ * computed arithmetically from one uniform random number, and each lane draws its random
+ * numbers from its own xorshift generator. The loops over the lanes therefore have no
+ * branches and no calls, so the compiler can vectorise them.
+ *
+ * A lane which is in a terminal state does not perform its action in the next step(),
+ * but is reset to a random non-terminal state instead (auto-reset). This way, a learner
+ * like QLearningController::updateAndGetActions() gets to see the terminal state,
+ * and starts a new episode with the following state.
+ *
+ * \author Jennifer Buehler
+ */
+class GridDomainBatch
+{
+public:
+    typedef GridWorldState StateT;
+    typedef MoveAction ActionT;
+    typedef float RewardValueTypeT;
+    typedef int32_t CoordT;
+    typedef uint8_t FlagT;
+
+    typedef std::shared_ptr<GridDomainBatch> GridDomainBatchPtrT;
+    typedef std::shared_ptr<const GridDomainBatch> GridDomainBatchConstPtrT;
+
+    /**
+     * \param _numLanes number of episodes to run in lockstep
+     * All other parameters are the same as for GridDomain. All lanes start in a random
+     * non-terminal state.
+     */
+    GridDomainBatch(unsigned int _numLanes,
+                    unsigned int _gridX, unsigned int _gridY,
+                    unsigned int _goalX, unsigned int _goalY,
+                    unsigned int _blockX, unsigned int _blockY,
+                    unsigned int _pitX, unsigned int _pitY,
+                    float _defaultReward, float _goalReward, float _pitReward, float _sideActionProbability = 0.1):
+        gridX(_gridX), gridY(_gridY), goalX(_goalX), goalY(_goalY),
+        blockX(_blockX), blockY(_blockY), pitX(_pitX), pitY(_pitY),
+        defaultReward(_defaultReward), goalReward(_goalReward), pitReward(_pitReward),
+        mainProbability(1.0f - 2.0f * _sideActionProbability),
+        sideProbability(_sideActionProbability),
+        x(_numLanes), y(_numLanes), rng(_numLanes), moves(_numLanes),
+        rewards(_numLanes), terminal(_numLanes), states(_numLanes), episodes(0)
+    {
+        for (unsigned int i = 0; i < _numLanes; ++i)
+        {
+            // xorshift must not be seeded with 0
+            rng[i] = (static_cast<uint32_t>(RandomNumberGenerator::random()) << 1) | 1;
+            resetLane(i);
+        }
+    }
+
+    unsigned int numLanes() const
+    {
+        return x.size();
+    }
+
+    /**
+     * Performs the actions in all lanes. Lanes in a terminal state are reset instead.
+     * \param actions one action per lane
+     */
+    void step(const ActionT * actions)
+    {
+        const unsigned int n = numLanes();
+        for (unsigned int i = 0; i < n; ++i)
+        {
+            moves[i] = actions[i].getMove();
+        }
+        step(&moves[0]);
+    }
+
+    /**
+     * Same as step(const ActionT*), but with the actions given by their MoveAction::MovesT values.
+     */
+    void step(const CoordT * mv)
+    {
+        const unsigned int n = numLanes();
+        CoordT * px = &x[0];
+        CoordT * py = &y[0];
+        uint32_t * prng = &rng[0];
+        FlagT * pterm = &terminal[0];
+        RewardValueTypeT * prew = &rewards[0];
+        const float mainThreshold = mainProbability;
+        const float sideThreshold = mainProbability + sideProbability;
+        const RewardValueTypeT rGoal = goalReward, rPit = pitReward, rDefault = defaultReward;
+        const CoordT maxX = gridX, maxY = gridY, bX = blockX, bY = blockY;
+        const CoordT gX = goalX, gY = goalY, ptX = pitX, ptY = pitY;
+
+        for (unsigned int i = 0; i < n; ++i)
+        {
+            uint32_t r = prng[i];
+            r ^= r << 13;
+            r ^= r >> 17;
+            r ^= r << 5;
+            prng[i] = r;
+            float u = static_cast<float>(r >> 8) * (1.0f / 16777216.0f);  // in [0..1)
+
+            CoordT m = mv[i];
+            CoordT dx = (m == MoveAction::Right) - (m == MoveAction::Left);
+            CoordT dy = (m == MoveAction::Up) - (m == MoveAction::Down);
+            // with sideProbability each, the agent moves to one of the two squares perpendicular
+            // to the intended direction instead. Selected by arithmetic to keep the loop branch-free.
+            CoordT side = (u >= mainThreshold);
+            CoordT sign = 1 - 2 * (u >= sideThreshold);
+            CoordT mx = dx + side * (sign * dy - dx);
+            CoordT my = dy + side * (sign * dx - dy);
+
+            // moves which would leave the grid or hit the block leave the agent where it is,
+            // and so does the reset of lanes in a terminal state, which is done below.
+            CoordT nx = px[i] + mx;
+            CoordT ny = py[i] + my;
+            CoordT stay = (nx < 0) | (nx >= maxX) | (ny < 0) | (ny >= maxY) | ((nx == bX) & (ny == bY)) | pterm[i];
+            px[i] += (1 - stay) * mx;
+            py[i] += (1 - stay) * my;
+        }
+
+        for (unsigned int i = 0; i < n; ++i)
+        {
+            if (pterm[i]) resetLane(i);
+        }
+
+        unsigned int reachedTerminal = 0;
+        for (unsigned int i = 0; i < n; ++i)
+        {
+            CoordT goal = (px[i] == gX) & (py[i] == gY);
+            CoordT pit = (px[i] == ptX) & (py[i] == ptY);
+            pterm[i] = goal | pit;
+            prew[i] = rDefault + goal * (rGoal - rDefault) + pit * (rPit - rDefault);
+            reachedTerminal += goal | pit;
+        }
+        episodes += reachedTerminal;
+    }
+
+    /**
+     * The x coordinates of the current states of all lanes
+     */
+    const CoordT * getX() const
+    {
+        return &x[0];
+    }
+    /**
+     * The y coordinates of the current states of all lanes
+     */
+    const CoordT * getY() const
+    {
+        return &y[0];
+    }
+    /**
+     * The rewards of the current states of all lanes
+     */
+    const RewardValueTypeT * getRewards() const
+    {
+        return &rewards[0];
+    }
+    /**
+     * For each lane, 1 if the current state is terminal, 0 otherwise
+     */
+    const FlagT * getTerminal() const
+    {
+        return &terminal[0];
+    }
+
+    /**
+     * Returns the current states of all lanes as GridWorldState objects, as needed
+     * by the learners. They are copied from the coordinate arrays on each call.
+     */
+    const StateT * getStates()
+    {
+        const unsigned int n = numLanes();
+        for (unsigned int i = 0; i < n; ++i)
+        {
+            states[i] = StateT(x[i], y[i]);
+        }
+        return &states[0];
+    }
+
+    /**
+     * The number of episodes which have been finished, i.e. the number of
+     * times a terminal state has been reached by any of the lanes.
+     */
+    unsigned long getEpisodes() const
+    {
+        return episodes;
+    }
+
+private:
+    /**
+     * Puts lane i into a random state which is neither the block nor a terminal state.
+     */
+    void resetLane(unsigned int i)
+    {
+        do
+        {
+            x[i] = nextRandom(i) % gridX;
+            y[i] = nextRandom(i) % gridY;
+        }
+        while (((static_cast<unsigned int>(x[i]) == blockX) && (static_cast<unsigned int>(y[i]) == blockY))
+                || ((static_cast<unsigned int>(x[i]) == goalX) && (static_cast<unsigned int>(y[i]) == goalY))
+                || ((static_cast<unsigned int>(x[i]) == pitX) && (static_cast<unsigned int>(y[i]) == pitY)));
+        rewards[i] = defaultReward;
+        terminal[i] = 0;
+    }
+
+    uint32_t nextRandom(unsigned int i)
+    {
+        uint32_t r = rng[i];
+        r ^= r << 13;
+        r ^= r >> 17;
+        r ^= r << 5;
+        rng[i] = r;
+        return r;
+    }
+
+    unsigned int gridX, gridY, goalX, goalY, blockX, blockY, pitX, pitY;
+    float defaultReward, goalReward, pitReward;
+    float mainProbability, sideProbability;
+
+    // the state of the lanes, one entry per lane each
+    std::vector<CoordT> x;
+    std::vector<CoordT> y;
+    std::vector<uint32_t> rng;  // state of the xorshift generator
+    std::vector<CoordT> moves;  // moves of the last step(const ActionT*)
+    std::vector<RewardValueTypeT> rewards;
+    std::vector<FlagT> terminal;
+    std::vector<StateT> states;  // returned by getStates()
+    unsigned long episodes;
+};
+
+}  // namespace rl
+#endif  // RL_GRIDWORLDBATCH_H
@@ -0,0 +1,57 @@
+#ifndef RL_GRIDWORLDSAMPLING_H
+#define RL_GRIDWORLDSAMPLING_H
+// Copyright Jennifer Buehler
+
+#include <rl/GridWorld.h>
+#include <rl/SampledTransition.h>
+
+namespace rl
+{
+
+/**
+ * \brief Samples the successor states of a GridDomain from the alias tables
+ * of a SampledTransition.
+ *
+ * Set by enableAliasSampling(). It lives in its own header, so that
+ * only the code which uses alias sampling depends on the flat model.
+ */
+class GridWorldAliasSampler: public GridDomain::SuccessorSampler
+{
+public:
+    typedef SampledTransition<GridDomain::StateT, GridDomain::ActionT> SampledTransitionT;
+    typedef SampledTransitionT::SampledTransitionConstPtrT SampledTransitionConstPtrT;
+
+    explicit GridWorldAliasSampler(const SampledTransitionConstPtrT& _sampled): sampled(_sampled) {}
+
+    virtual bool transferState(const GridDomain::StateT& s, const GridDomain::ActionT& a,
+                               RandomNumberGenerator::EngineT& rng, GridDomain::StateT& next) const
+    {
+        return sampled->transferState(s, a, rng, next);
+    }
+
+private:
+    SampledTransitionConstPtrT sampled;
+};
+
+/**
+ * Switches the transferState() of the domain to sampling the successor states from alias
+ * tables (see SampledTransition), which are built from the flat model of the domain.
+ * They follow the same probabilities as the transition list. Use
+ * GridDomain::setSuccessorSampler() with NULL to switch back.
+ * \return false if the flat model could not be compiled, in which case the domain is unchanged
+ */
+inline bool enableAliasSampling(GridDomain& domain)
+{
+    GridWorldAliasSampler::SampledTransitionConstPtrT tables =
+        GridWorldAliasSampler::SampledTransitionT::compile(domain);
+    if (!tables.get())
+    {
+        PRINTERROR("Could not build the alias tables for the grid world");
+        return false;
+    }
+    domain.setSuccessorSampler(GridDomain::SuccessorSamplerConstPtrT(new GridWorldAliasSampler(tables)));
+    return true;
+}
+
+}  // namespace rl
+#endif  // RL_GRIDWORLDSAMPLING_H
@@ -0,0 +1,409 @@
+#ifndef RL_HOGWILDQLEARNING_H
+#define RL_HOGWILDQLEARNING_H
+// Copyright Jennifer Buehler
+
+#include <rl/Exploration.h>
+#include <rl/Policy.h>
+#include <rl/LogBinding.h>
+
+#include <math/RandomNumber.h>
+
+#include <atomic>
+#include <chrono>
+#include <limits>
+#include <new>
+#include <thread>
+#include <vector>
+#include <stdint.h>
+
+namespace rl
+{
+
+/**
+ * \brief Dense table of q-values and visit counts which can be read and updated
+ * by several threads at the same time without locks.
+ *
+ * The table is indexed by the ids of a StateIndexer and an ActionIndexer. Each value
+ * and count is a separate atomic which is read and written with relaxed memory order,
+ * so a thread may read a value which another thread is about to overwrite, and
+ * concurrent updates of the same q-value may get lost. Q-learning tolerates this
+ * (Hogwild!), as the updates of different threads mostly touch different states.
+ *
+ * The row of each state starts at a cache line boundary and is padded to a multiple
+ * of the cache line size, so that threads working on different states do not
+ * invalidate each other's cache lines (false sharing).
+ */
+class SharedQTable
+{
+public:
+    typedef unsigned int IndexT;
+    typedef float ValueT;
+    typedef uint32_t CountT;
+
+    enum {CacheLineSize = 64};
+
+    /**
+     * \param _numStates number of state ids
+     * \param _numActions number of action ids
+     * \param _defaultValue initial q-value of all state-action pairs
+     */
+    SharedQTable(IndexT _numStates, IndexT _numActions, ValueT _defaultValue):
+        nStates(_numStates), nActions(_numActions), defaultValue(_defaultValue)
+    {
+        IndexT cellsPerLine = CacheLineSize / sizeof(Cell);
+        rowSize = ((nActions + cellsPerLine - 1) / cellsPerLine) * cellsPerLine;
+        storage.resize(static_cast<size_t>(nStates) * rowSize * sizeof(Cell) + CacheLineSize);
+        size_t offset = (CacheLineSize - (reinterpret_cast<uintptr_t>(&storage[0]) % CacheLineSize)) % CacheLineSize;
+        cells = reinterpret_cast<Cell*>(&storage[offset]);
+        for (size_t i = 0; i < static_cast<size_t>(nStates) * rowSize; ++i) new (&cells[i]) Cell();
+        reset();
+    }
+
+    /**
+     * Sets all q-values to the default value and all counts to 0. Must not be called
+     * while other threads use the table.
+     */
+    void reset()
+    {
+        for (size_t i = 0; i < static_cast<size_t>(nStates) * rowSize; ++i)
+        {
+            cells[i].value.store(defaultValue, std::memory_order_relaxed);
+            cells[i].count.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    IndexT numStates() const
+    {
+        return nStates;
+    }
+    IndexT numActions() const
+    {
+        return nActions;
+    }
+
+    ValueT getValue(IndexT s, IndexT a) const
+    {
+        return cell(s, a).value.load(std::memory_order_relaxed);
+    }
+    void setValue(IndexT s, IndexT a, ValueT v)
+    {
+        cell(s, a).value.store(v, std::memory_order_relaxed);
+    }
+
+    CountT getCount(IndexT s, IndexT a) const
+    {
+        return cell(s, a).count.load(std::memory_order_relaxed);
+    }
+    /**
+     * \return the new count
+     */
+    CountT incrementCount(IndexT s, IndexT a)
+    {
+        return cell(s, a).count.fetch_add(1, std::memory_order_relaxed) + 1;
+    }
+
+    /**
+     * max_over_a(Q[s,a])
+     */
+    ValueT getMaxValue(IndexT s) const
+    {
+        ValueT best = getValue(s, 0);
+        for (IndexT a = 1; a < nActions; ++a)
+        {
+            ValueT v = getValue(s, a);
+            if (v > best) best = v;
+        }
+        return best;
+    }
+
+    /**
+     * \return true if any action has been tried from state s
+     */
+    bool visited(IndexT s) const
+    {
+        for (IndexT a = 0; a < nActions; ++a)
+        {
+            if (getCount(s, a) > 0) return true;
+        }
+        return false;
+    }
+
+private:
+    SharedQTable(const SharedQTable& o);
+
+    struct Cell
+    {
+        std::atomic<ValueT> value;
+        std::atomic<CountT> count;
+    };
+
+    Cell& cell(IndexT s, IndexT a)
+    {
+        return cells[static_cast<size_t>(s) * rowSize + a];
+    }
+    const Cell& cell(IndexT s, IndexT a) const
+    {
+        return cells[static_cast<size_t>(s) * rowSize + a];
+    }
+
+    IndexT nStates;
+    IndexT nActions;
+    IndexT rowSize;  // number of cells per row, including padding
+    ValueT defaultValue;
+    std::vector<char> storage;
+    Cell * cells;  // aligned to the cache line size within storage
+};
+
+
+/**
+ * \brief Result of a HogwildQLearning::train() run
+ */
+struct HogwildStatistics
+{
+    HogwildStatistics(): numThreads(0), steps(0), episodes(0), seconds(0) {}
+
+    double stepsPerSecond() const
+    {
+        return (seconds > 0) ? steps / seconds : 0;
+    }
+    double stepsPerSecondPerThread() const
+    {
+        return (numThreads > 0) ? stepsPerSecond() / numThreads : 0;
+    }
+
+    unsigned int numThreads;
+    unsigned long steps;  // steps of all threads
+    unsigned long episodes;  // terminal states reached by all threads
+    double seconds;  // wall time of the training
+};
+
+
+/**
+ * \brief Q-learning with several worker threads which share one q-table (Hogwild!).
+ *
+ * Each worker runs its own episodes in the shared domain, starting in the start
+ * state of the domain and in a random state after each terminal state. It performs the
+ * same update as QLearningController, on a SharedQTable which all workers update
+ * without locks. Actions are selected epsilon-greedy with the exploration function, like
+ * in QLearningController, but each worker uses its own stream of random numbers
+ * (RandomNumberGenerator::newStream()) for this, so that the workers never share a generator.
+ *
+ * The domain has to provide a StateIndexer and an ActionIndexer, and its
+ * transferState(), reward function and state generator have to be safe to call
+ * from several threads at once (which is the case for GridDomain, unless it has been given
+ * a random engine of its own with GridDomain::setRandomEngine()).
+ *
+ * The learning rate and exploration functions are called with the visit counts of the
+ * shared table, and have to be thread-safe as well (all implementations in Exploration.h are).
+ *
+ * \param Domain must be the class type of the domain used (NOT the base domain class!)
+ */
+template<class Domain>
+class HogwildQLearning
+{
+public:
+    typedef Domain DomainT;
+    typedef typename DomainT::StateT StateT;
+    typedef typename DomainT::ActionT ActionT;
+    typedef typename DomainT::DomainPtrT DomainPtrT;
+    typedef typename DomainT::RewardConstPtrT RewardConstPtrT;
+    typedef typename DomainT::StateGeneratorConstPtrT StateGeneratorConstPtrT;
+    typedef typename DomainT::StateIndexerConstPtrT StateIndexerConstPtrT;
+    typedef typename DomainT::ActionIndexerConstPtrT ActionIndexerConstPtrT;
+    typedef SharedQTable::IndexT IndexT;
+    typedef SharedQTable::CountT FreqCntT;
+    typedef Exploration<float, FreqCntT> ExplorationT;
+    typedef typename ExplorationT::ExplorationConstPtrT ExplorationConstPtrT;
+    typedef typename LearningRate::LearningRatePtrT LearningRatePtrT;
+    typedef Policy<StateT, ActionT> PolicyT;
+    typedef typename PolicyT::PolicyPtrT PolicyPtrT;
+    typedef LookupPolicy<StateT, ActionT> LookupPolicyT;
+
+    /**
+     * Parameters as in QLearningController.
+     * \param _domain the domain to be used. Needs a StateIndexer and an ActionIndexer.
+     */
+    HogwildQLearning(DomainPtrT _domain, const LearningRatePtrT& _learnRate,
+                     const float _discount, const float _defaultQ,
+                     ExplorationConstPtrT _exploration, float _epsilonGreedy):
+        domain(_domain), learnRate(_learnRate), discount(_discount),
+        exploration(_exploration), epsilonGreedy(_epsilonGreedy),
+        reward(_domain->getReward()), stateGenerator(_domain->getStateGenerator()),
+        stateIndexer(_domain->getStateIndexer()), actionIndexer(_domain->getActionIndexer()),
+        q(stateIndexer.get() ? stateIndexer->size() : 0, actionIndexer.get() ? actionIndexer->size() : 0, _defaultQ)
+    {
+        if (discount >= 1.0f) discount = 1.0f - std::numeric_limits<float>::epsilon();
+        if (discount < 0.0f) discount = 0.0f;
+    }
+
+    /**
+     * Runs the training with numThreads workers (including the calling thread),
+     * each of which performs stepsPerThread steps. Can be called several times,
+     * the q-table is kept between calls.
+     * \param numThreads number of threads to use. If 0, the number of hardware threads is used.
+     * \return false if the domain does not provide the required indexers or reward function
+     */
+    bool train(unsigned int numThreads, unsigned long stepsPerThread)
+    {
+        if (!stateIndexer.get() || !actionIndexer.get() || (actionIndexer->size() == 0))
+        {
+            PRINTERROR("Hogwild q-learning needs a state and an action indexer for the domain");
+            return false;
+        }
+        if (!reward.get() || !stateGenerator.get())
+        {
+            PRINTERROR("Hogwild q-learning needs a reward function and a state generator");
+            return false;
+        }
+        if (numThreads == 0) numThreads = std::thread::hardware_concurrency();
+        if (numThreads == 0) numThreads = 1;
+
+        std::vector<WorkerCounters> counters(numThreads);
+        std::vector<RandomNumberGenerator::EngineT> streams;
+        for (unsigned int i = 0; i < numThreads; ++i) streams.push_back(RandomNumberGenerator::newStream());
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        std::vector<std::thread> threads;
+        for (unsigned int i = 1; i < numThreads; ++i)
+        {
+            threads.push_back(std::thread(&HogwildQLearning::work, this, streams[i], stepsPerThread, &counters[i]));
+        }
+        work(streams[0], stepsPerThread, &counters[0]);
+        for (size_t i = 0; i < threads.size(); ++i)
+        {
+            threads[i].join();
+        }
+
+        lastStatistics = HogwildStatistics();
+        lastStatistics.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        lastStatistics.numThreads = numThreads;
+        for (unsigned int i = 0; i < numThreads; ++i)
+        {
+            lastStatistics.steps += counters[i].steps;
+            lastStatistics.episodes += counters[i].episodes;
+        }
+        return true;
+    }
+
+    /**
+     * Statistics of the last call of train()
+     */
+    const HogwildStatistics& getLastStatistics() const
+    {
+        return lastStatistics;
+    }
+
+    const SharedQTable& getQTable() const
+    {
+        return q;
+    }
+
+    /**
+     * Returns the learned policy, with the action of the maximum q-value for each state
+     * from which any action has been tried. Must not be called during train().
+     */
+    PolicyPtrT getLearnedPolicy() const
+    {
+        PolicyPtrT retPolicy(new LookupPolicyT());
+        for (IndexT s = 0; s < q.numStates(); ++s)
+        {
+            if (!q.visited(s)) continue;
+            IndexT best = 0;
+            for (IndexT a = 1; a < q.numActions(); ++a)
+            {
+                if (q.getValue(s, a) > q.getValue(s, best)) best = a;
+            }
+            retPolicy->bestAction(stateIndexer->fromIndex(s), actionIndexer->fromIndex(best), q.getValue(s, best), 1.0);
+        }
+        return retPolicy;
+    }
+
+private:
+    HogwildQLearning(const HogwildQLearning& o);
+
+    // the counters of each worker, which it stores once when it has finished
+    struct WorkerCounters
+    {
+        WorkerCounters(): steps(0), episodes(0) {}
+        unsigned long steps;
+        unsigned long episodes;
+    };
+
+    void work(RandomNumberGenerator::EngineT rng, unsigned long steps, WorkerCounters * counters)
+    {
+
+        StateT s = domain->getStartState();
+        bool hasLast = false;  // false at the start of an episode
+        IndexT lastS = 0, lastA = 0;
+        unsigned long episodes = 0;
+        for (unsigned long step = 0; step < steps; ++step)
+        {
+            IndexT sId = stateIndexer->toIndex(s);
+            bool terminal = domain->isTerminalState(s);
+            if (hasLast) update(lastS, lastA, reward->getReward(s), sId, terminal);
+            if (terminal)
+            {
+                ++episodes;
+                hasLast = false;
+                while (domain->isTerminalState(s)) s = stateGenerator->randomState();
+                continue;
+            }
+
+            if (rng.uniform() < epsilonGreedy)
+            {
+                lastA = rng.below(q.numActions());
+            }
+            else
+            {
+                // argmax_over_a{ expl(Q[s,a],freq[s,a]) }, the first of equal utilities
+                lastA = 0;
+                float bestUt = exploration->getEstimatedReward(q.getValue(sId, 0), q.getCount(sId, 0));
+                for (IndexT a = 1; a < q.numActions(); ++a)
+                {
+                    float ut = exploration->getEstimatedReward(q.getValue(sId, a), q.getCount(sId, a));
+                    if (ut > bestUt)
+                    {
+                        lastA = a;
+                        bestUt = ut;
+                    }
+                }
+            }
+            lastS = sId;
+            hasLast = true;
+            s = domain->transferState(s, actionIndexer->fromIndex(lastA));
+        }
+        counters->steps = steps;
+        counters->episodes = episodes;
+    }
+
+    /**
+     * Q[s,a] = Q[s,a] + learnRate * (reward + discount * max_over_a'(Q[s',a']) - Q[s,a])
+     */
+    void update(IndexT s, IndexT a, float r, IndexT nextS, bool nextTerminal)
+    {
+        FreqCntT numTried = q.incrementCount(s, a) - 1;  // this trial does not count yet
+        float adaptedLearnRate = learnRate->get(numTried);
+        if (adaptedLearnRate < std::numeric_limits<float>::epsilon()) return;
+        // no future rewards from a terminal state
+        float bestActionUtility = nextTerminal ? 0.0f : q.getMaxValue(nextS);
+        float oldQ = q.getValue(s, a);
+        q.setValue(s, a, oldQ + adaptedLearnRate * (r + discount * bestActionUtility - oldQ));
+    }
+
+    DomainPtrT domain;
+    LearningRatePtrT learnRate;
+    float discount;
+    ExplorationConstPtrT exploration;
+    float epsilonGreedy;
+
+    RewardConstPtrT reward;
+    StateGeneratorConstPtrT stateGenerator;
+    StateIndexerConstPtrT stateIndexer;
+    ActionIndexerConstPtrT actionIndexer;
+
+    SharedQTable q;
+    HogwildStatistics lastStatistics;
+};
+
+}  // namespace rl
+#endif  // RL_HOGWILDQLEARNING_H
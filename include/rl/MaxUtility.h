@@ -12,8 +12,6 @@
 #include <math/FloatComparison.h>
 #include <general/Exception.h>
 
-#define ZERO_EPSILON 1e-07
-
 namespace rl
 {
 
@@ -0,0 +1,267 @@
+#ifndef RL_PARALLELVALUEITERATION_H
+#define RL_PARALLELVALUEITERATION_H
+// Copyright Jennifer Buehler
+
+#include <rl/FlatModel.h>
+#include <rl/StoppingCriterion.h>
+#include <rl/LogBinding.h>
+
+#include <math/FloatComparison.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <math.h>
+
+namespace rl
+{
+
+/**
+ * \brief Performs Jacobi value iteration sweeps over a FlatModel with a pool of threads.
+ *
+ * The states of the model are partitioned into contiguous ranges, one per thread.
+ * Within a sweep, all threads read the utilities of the previous sweep and
+ * write the new utilities of their own range, so no synchronisation is needed
+ * except once at the end of each sweep. Each thread keeps its own maximum utility
+ * change, and the maxima are reduced by the calling thread afterwards.
+ *
+ * Each state is updated with exactly the same operations as in the serial
+ * valueIteration() working on the FlatModel, so the utilities after each sweep are
+ * identical to the serial version, independent of the number of threads.
+ *
+ * The calling thread processes the first range itself, so numThreads-1
+ * additional threads are started, and they are kept alive between sweeps.
+ */
+template<class State, class Action>
+class ParallelValueIterationSweep
+{
+public:
+    typedef FlatModel<State, Action> FlatModelT;
+    typedef typename FlatModelT::IndexT IndexT;
+
+    /**
+     * \param _model the compiled model. Reference is kept internally!
+     * \param numThreads the number of threads to use (including the calling thread).
+     * If 0, the number of hardware threads is used.
+     */
+    ParallelValueIterationSweep(const FlatModelT& _model, unsigned int numThreads):
+        model(_model), in(NULL), out(NULL), discount(0), collectStatistics(false), criterion(NULL), expired(false),
+        generation(0), pending(0), stop(false)
+    {
+        if (numThreads == 0) numThreads = std::thread::hardware_concurrency();
+        if (numThreads == 0) numThreads = 1;
+        if (numThreads > model.numStates()) numThreads = model.numStates();
+        if (numThreads == 0) numThreads = 1;
+
+        IndexT n = model.numStates();
+        for (unsigned int i = 0; i <= numThreads; ++i)
+        {
+            rangeBegin.push_back(static_cast<IndexT>((static_cast<unsigned long long>(n) * i) / numThreads));
+        }
+        deltas.resize(numThreads);
+        for (unsigned int i = 1; i < numThreads; ++i)
+        {
+            threads.push_back(std::thread(&ParallelValueIterationSweep::work, this, i));
+        }
+    }
+
+    ~ParallelValueIterationSweep()
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            stop = true;
+        }
+        startCond.notify_all();
+        for (size_t i = 0; i < threads.size(); ++i)
+        {
+            threads[i].join();
+        }
+    }
+
+    unsigned int numThreads() const
+    {
+        return deltas.size();
+    }
+
+    /**
+     * Performs one sweep, reading utilities from u and writing the new utilities to newU.
+     * \param stats if not NULL, the statistics of the utility changes are collected in here.
+     * \return the maximum change of utility of any state
+     */
+    float sweep(const std::vector<float>& u, std::vector<float>& newU, float _discount,
+                SweepStatistics * stats = NULL, const StoppingCriterion * _criterion = NULL)
+    {
+        newU.resize(u.size());
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            in = &u[0];
+            out = &newU[0];
+            discount = _discount;
+            collectStatistics = (stats != NULL);
+            criterion = _criterion;
+            pending = threads.size();
+            ++generation;
+        }
+        startCond.notify_all();
+
+        sweepRange(0);
+
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            while (pending > 0) doneCond.wait(lock);
+        }
+
+        float delta = 0;
+        expired = false;
+        for (size_t i = 0; i < deltas.size(); ++i)
+        {
+            float d = deltas[i].value;
+            if ((d > delta) && !equalFloats(d, delta, static_cast<float>(ZERO_EPSILON)))
+                delta = d;
+            if (stats) stats->merge(deltas[i].stats);
+            if (deltas[i].expired) expired = true;
+        }
+        return delta;
+    }
+
+    /**
+     * True if the deadline of the criterion passed to the last sweep() has passed
+     * during it, in which case not all states have been updated.
+     */
+    bool isExpired() const
+    {
+        return expired;
+    }
+
+private:
+    ParallelValueIterationSweep(const ParallelValueIterationSweep& o);
+
+    // the result of each thread, written once at the end of its part of a sweep
+    struct ThreadDelta
+    {
+        ThreadDelta(): value(0), expired(false) {}
+        float value;
+        SweepStatistics stats;
+        bool expired;
+    };
+
+    /**
+     * Sweeps the range of thread i and stores its result in deltas[i]. The statistics
+     * are collected in a local, so the threads do not write to each other's cache lines
+     * during the sweep.
+     */
+    void sweepRange(unsigned int i)
+    {
+        if (!collectStatistics)
+        {
+            deltas[i].value = model.sweep(rangeBegin[i], rangeBegin[i + 1], discount, in, out);
+            return;
+        }
+        SweepStatistics stats;
+        bool expired = false;
+        float d;
+        if (criterion) d = model.sweep(rangeBegin[i], rangeBegin[i + 1], discount, in, out, stats, *criterion, expired);
+        else d = model.sweep(rangeBegin[i], rangeBegin[i + 1], discount, in, out, stats);
+        deltas[i].value = d;
+        deltas[i].stats = stats;
+        deltas[i].expired = expired;
+    }
+
+    void work(unsigned int i)
+    {
+        unsigned int seenGeneration = 0;
+        while (true)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                while (!stop && (generation == seenGeneration)) startCond.wait(lock);
+                if (stop) return;
+                seenGeneration = generation;
+            }
+            sweepRange(i);
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                --pending;
+            }
+            doneCond.notify_one();
+        }
+    }
+
+    const FlatModelT& model;
+    std::vector<IndexT> rangeBegin;  // range of thread i is rangeBegin[i]..rangeBegin[i+1]-1
+    std::vector<ThreadDelta> deltas;
+    std::vector<std::thread> threads;
+
+    // parameters of the current sweep, protected by mutex when written
+    const float * in;
+    float * out;
+    float discount;
+    bool collectStatistics;
+    const StoppingCriterion * criterion;  // its deadline is checked within the sweep, may be NULL
+    bool expired;
+
+    std::mutex mutex;
+    std::condition_variable startCond;
+    std::condition_variable doneCond;
+    unsigned int generation;  // counts the sweeps started
+    unsigned int pending;  // number of additional threads which have not finished the current sweep
+    bool stop;
+};
+
+
+/**
+ * Value iteration on a compiled model, with each sweep split across numThreads threads.
+ * Uses the same termination criterion as the serial valueIteration() on the FlatModel,
+ * and each sweep leads to the same utilities.
+ * \param model the compiled model
+ * \param u initial utility of each state in the model, indexed by state index. Will
+ * contain the resulting utilities.
+ * \param discount discount factor
+ * \param maxErr maximum error allowed in the utility of any state (determines termination criterion).
+ * \param numThreads number of threads to use. If 0, the number of hardware threads is used.
+ * \param criterion optional additional termination criteria (e.g. maximum number of iterations
+ * or a deadline). After return, it tells which criterion stopped the iterations.
+ * \return the number of iterations performed
+ */
+template<class State, class Action>
+unsigned int parallelValueIteration(const FlatModel<State, Action>& model, std::vector<float>& u,
+                                    float discount, float maxErr, unsigned int numThreads,
+                                    StoppingCriterion::StoppingCriterionPtrT criterion =
+                                        StoppingCriterion::StoppingCriterionPtrT())
+{
+    u.resize(model.numStates());
+    if (model.numStates() == 0) return 0;  // nothing to update
+    std::vector<float> tempU(u);
+
+    ParallelValueIterationSweep<State, Action> parallelSweep(model, numThreads);
+
+    float delta = 0;
+    float discountRatio = static_cast<float>(1.0 - discount) / static_cast<float>(discount);
+    float minDelta = maxErr * discountRatio;
+    PRINTMSG("Starting parallel value iteration with " << parallelSweep.numThreads() << " threads, discount="
+        << discount << ", discountRatio=" << discountRatio << ", maxErr=" << maxErr << ", minDelta=" << minDelta);
+    unsigned int cnt = 0;
+    SweepStatistics stats;
+    if (criterion.get()) criterion->start();
+    do
+    {
+        stats.reset();
+        delta = parallelSweep.sweep(u, tempU, discount, criterion.get() ? &stats : NULL, criterion.get());
+        // the incomplete sweep is dropped, so u keeps the last complete one
+        if (parallelSweep.isExpired() && criterion->checkDeadline()) break;
+        u.swap(tempU);
+        PRINTMSG("Finished iteration, delta=" << delta << ", iteration number=" << cnt);
+        ++cnt;
+        if (criterion.get() && criterion->update(stats)) break;
+    }
+    while (delta > minDelta);
+
+    if (criterion.get() && (criterion->getReason() == StoppingCriterion::NotStopped)) criterion->setConverged();
+    PRINTMSG("Number of iterations: " << cnt);
+    if (criterion.get()) PRINTMSG("Stopped because of: " << StoppingCriterion::getReasonName(criterion->getReason()));
+    return cnt;
+}
+
+}  // namespace rl
+#endif  // RL_PARALLELVALUEITERATION_H
@@ -2,8 +2,12 @@
 #define __POLICY_H__
 // Copyright Jennifer Buehler
 
+#include <atomic>
 #include <map>
 #include <memory>
+#include <vector>
+
+#include <rl/StateIndexer.h>
 
 namespace rl
 {
@@ -130,5 +134,147 @@ protected:
     PolicyMapT p;
 };
 
+
+/**
+ * Table lookup policy for domains providing a StateIndexer: the actions are
+ * stored in a vector indexed by the state id. bestAction() replaces an action for a state.
+ */
+template<class State, class Action>
+class IndexedPolicy: public Policy<State, Action>
+{
+public:
+    typedef State StateT;
+    typedef Action ActionT;
+    typedef Policy<StateT, ActionT> PolicyT;
+    typedef typename PolicyT::PolicyPtrT PolicyPtrT;
+    typedef StateIndexer<StateT> StateIndexerT;
+    typedef typename StateIndexerT::StateIndexerConstPtrT StateIndexerConstPtrT;
+    typedef typename StateIndexerT::IndexT IndexT;
+
+    typedef IndexedPolicy<StateT, ActionT> IndexedPolicyT;
+    typedef std::shared_ptr<IndexedPolicyT> IndexedPolicyPtrT;
+    typedef std::shared_ptr<const IndexedPolicyT> IndexedPolicyConstPtrT;
+
+    explicit IndexedPolicy(const StateIndexerConstPtrT& _indexer):
+        PolicyT(), indexer(_indexer), p(_indexer->size()), assigned(_indexer->size(), false) {}
+    IndexedPolicy(const IndexedPolicy& o): PolicyT(o), indexer(o.indexer), p(o.p), assigned(o.assigned) {}
+    virtual ~IndexedPolicy() {}
+
+    virtual bool getAction(const State& s, Action& targetAction) const
+    {
+        IndexT i = indexer->toIndex(s);
+        if ((i >= p.size()) || !assigned[i]) return false;
+        targetAction = p[i];
+        return true;
+    }
+    virtual void bestAction(const State& s, const Action& a,  float = 1.0, float = 1.0)
+    {
+        IndexT i = indexer->toIndex(s);
+        if (i >= p.size()) return;
+        p[i] = a;
+        assigned[i] = true;
+    }
+    virtual PolicyPtrT clone() const
+    {
+        return PolicyPtrT(new IndexedPolicyT(*this));
+    }
+
+    virtual void print(std::ostream& o) const
+    {
+        for (IndexT i = 0; i < p.size(); ++i)
+        {
+            if (assigned[i]) o << indexer->fromIndex(i) << " -> " << p[i] << std::endl;
+        }
+    }
+protected:
+    StateIndexerConstPtrT indexer;
+    std::vector<Action> p;
+    std::vector<bool> assigned;
+};
+
+
+/**
+ * Table lookup policy for domains providing a StateIndexer, like IndexedPolicy, but the
+ * actions are kept in chunks of ChunkSize state ids, which the copies of the policy share.
+ * clone() only copies the pointers to the chunks, and bestAction() copies a chunk before
+ * changing it if another copy still uses it, so a copy which differs in a few states only
+ * costs the pointers and the changed chunks. Chunks without any action are not allocated.
+ * Copies may be used by different threads, as long as each copy is used by one thread
+ * at a time.
+ */
+template<class State, class Action>
+class ChunkedPolicy: public Policy<State, Action>
+{
+public:
+    typedef State StateT;
+    typedef Action ActionT;
+    typedef Policy<StateT, ActionT> PolicyT;
+    typedef typename PolicyT::PolicyPtrT PolicyPtrT;
+    typedef StateIndexer<StateT> StateIndexerT;
+    typedef typename StateIndexerT::StateIndexerConstPtrT StateIndexerConstPtrT;
+    typedef typename StateIndexerT::IndexT IndexT;
+
+    typedef ChunkedPolicy<StateT, ActionT> ChunkedPolicyT;
+    typedef std::shared_ptr<ChunkedPolicyT> ChunkedPolicyPtrT;
+    typedef std::shared_ptr<const ChunkedPolicyT> ChunkedPolicyConstPtrT;
+
+    enum {ChunkSize = 1024};
+
+    explicit ChunkedPolicy(const StateIndexerConstPtrT& _indexer):
+        PolicyT(), indexer(_indexer), chunks((_indexer->size() + ChunkSize - 1) / ChunkSize) {}
+    ChunkedPolicy(const ChunkedPolicy& o): PolicyT(o), indexer(o.indexer), chunks(o.chunks) {}
+    virtual ~ChunkedPolicy() {}
+
+    virtual bool getAction(const State& s, Action& targetAction) const
+    {
+        IndexT i = indexer->toIndex(s);
+        IndexT c = i / ChunkSize;
+        if ((c >= chunks.size()) || !chunks[c].get() || !chunks[c]->assigned[i % ChunkSize]) return false;
+        targetAction = chunks[c]->actions[i % ChunkSize];
+        return true;
+    }
+    virtual void bestAction(const State& s, const Action& a,  float = 1.0, float = 1.0)
+    {
+        IndexT i = indexer->toIndex(s);
+        IndexT c = i / ChunkSize;
+        if (c >= chunks.size()) return;
+        ChunkPtrT& chunk = chunks[c];
+        if (!chunk.get()) chunk.reset(new Chunk());
+        else if (chunk.use_count() > 1) chunk.reset(new Chunk(*chunk));
+        // the copies which used the chunk have released it, possibly in other threads
+        else std::atomic_thread_fence(std::memory_order_acquire);
+        chunk->actions[i % ChunkSize] = a;
+        chunk->assigned[i % ChunkSize] = true;
+    }
+    virtual PolicyPtrT clone() const
+    {
+        return PolicyPtrT(new ChunkedPolicyT(*this));
+    }
+
+    virtual void print(std::ostream& o) const
+    {
+        for (IndexT c = 0; c < chunks.size(); ++c)
+        {
+            if (!chunks[c].get()) continue;
+            const Chunk& chunk = *chunks[c];
+            for (IndexT j = 0; j < ChunkSize; ++j)
+            {
+                if (chunk.assigned[j]) o << indexer->fromIndex(c * ChunkSize + j) << " -> " << chunk.actions[j] << std::endl;
+            }
+        }
+    }
+protected:
+    struct Chunk
+    {
+        Chunk(): actions(ChunkSize), assigned(ChunkSize, false) {}
+        std::vector<Action> actions;
+        std::vector<bool> assigned;
+    };
+    typedef std::shared_ptr<Chunk> ChunkPtrT;
+
+    StateIndexerConstPtrT indexer;
+    std::vector<ChunkPtrT> chunks;
+};
+
 }
 #endif
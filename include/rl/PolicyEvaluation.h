@@ -0,0 +1,305 @@
+#ifndef RL_POLICYEVALUATION_H
+#define RL_POLICYEVALUATION_H
+// Copyright Jennifer Buehler
+
+#include <rl/FlatModel.h>
+#include <rl/StoppingCriterion.h>
+#include <rl/LogBinding.h>
+
+#include <math/FloatComparison.h>
+
+#include <vector>
+#include <math.h>
+
+namespace rl
+{
+
+/**
+ * Method used to evaluate a fixed policy pi in policy iteration, i.e. to find the
+ * utilities U = R + discount * P_pi * U.
+ * ModifiedPolicyIteration: a fixed number of value iteration steps with the fixed policy.
+ * SOR: successive over-relaxation on the linear system (I - discount * P_pi) U = R,
+ * until the maximum change of utility is below the tolerance.
+ * BiCGSTAB: the stabilised bi-conjugate gradient method on the same linear system,
+ * until the relative residual ||R - (I - discount * P_pi) U|| / ||R|| is below the tolerance.
+ */
+typedef enum PolicyEvaluationMethod {ModifiedPolicyIteration, SOR, BiCGSTAB} PolicyEvaluationMethodT;
+
+/**
+ * Checks whether from every state of the model, a state for which the policy action has
+ * no transition states (e.g. a terminal state) can be reached with the policy.
+ * Only for such (proper) policies, the utilities are finite if discount is 1.
+ * \param model the compiled model
+ * \param policy action index for each state, indexed by state index
+ */
+template<class State, class Action>
+bool isProperPolicy(const FlatModel<State, Action>& model,
+                    const std::vector<typename FlatModel<State, Action>::IndexT>& policy)
+{
+    typedef typename FlatModel<State, Action>::IndexT IndexT;
+
+    const std::vector<IndexT>& succ = model.getSuccessors();
+    IndexT nStates = model.numStates();
+
+    // predecessors of each state with the policy action, in CSR format
+    std::vector<IndexT> offsets(nStates + 1, 0);
+    for (IndexT s = 0; s < nStates; ++s)
+    {
+        IndexT r = model.row(s, policy[s]);
+        for (IndexT i = model.rowBegin(r); i < model.rowEnd(r); ++i) ++offsets[succ[i] + 1];
+    }
+    for (IndexT s = 0; s < nStates; ++s) offsets[s + 1] += offsets[s];
+    std::vector<IndexT> predecessors(offsets[nStates]);
+    std::vector<IndexT> fill(offsets.begin(), offsets.end() - 1);
+    for (IndexT s = 0; s < nStates; ++s)
+    {
+        IndexT r = model.row(s, policy[s]);
+        for (IndexT i = model.rowBegin(r); i < model.rowEnd(r); ++i) predecessors[fill[succ[i]]++] = s;
+    }
+
+    // search backwards from the states without transitions
+    std::vector<bool> reached(nStates, false);
+    std::vector<IndexT> open;
+    for (IndexT s = 0; s < nStates; ++s)
+    {
+        if (model.emptyRow(model.row(s, policy[s])))
+        {
+            reached[s] = true;
+            open.push_back(s);
+        }
+    }
+    IndexT numReached = open.size();
+    while (!open.empty())
+    {
+        IndexT s = open.back();
+        open.pop_back();
+        for (IndexT i = offsets[s]; i < offsets[s + 1]; ++i)
+        {
+            IndexT p = predecessors[i];
+            if (reached[p]) continue;
+            reached[p] = true;
+            ++numReached;
+            open.push_back(p);
+        }
+    }
+    return numReached == nStates;
+}
+
+
+/**
+ * Solves (I - discount * P_pi) U = R for the policy pi on a compiled model, with
+ * successive over-relaxation. States for which the policy action has no transition
+ * states get U(s) = R(s).
+ *
+ * If discount is 1 and the policy does not reach a terminal state from every state,
+ * the system has no solution, and the method stops after maxIter iterations.
+ *
+ * \param model the compiled model
+ * \param policy action index for each state, indexed by state index
+ * \param u the initial guess (e.g. the utilities of the previous policy), will
+ * contain the result
+ * \param discount discount factor
+ * \param tolerance stop when the maximum change of utility within one iteration is below this value
+ * \param maxIter maximum number of iterations
+ * \param omega the relaxation factor (0..2). 1 is the Gauss-Seidel method.
+ * \param iterations will contain the number of iterations done
+ * \param criterion if not NULL, its deadline is checked after each iteration (see
+ *      StoppingCriterion::checkDeadline()), and the evaluation is stopped when it has passed
+ * \return true if the tolerance was reached within maxIter iterations
+ */
+template<class State, class Action>
+bool sorPolicyEvaluation(const FlatModel<State, Action>& model,
+                         const std::vector<typename FlatModel<State, Action>::IndexT>& policy,
+                         std::vector<float>& u, float discount, float tolerance,
+                         unsigned int maxIter, float omega, unsigned int& iterations,
+                         StoppingCriterion * criterion = NULL)
+{
+    typedef typename FlatModel<State, Action>::IndexT IndexT;
+
+    const std::vector<IndexT>& succ = model.getSuccessors();
+    const std::vector<float>& prob = model.getProbabilities();
+    IndexT nStates = model.numStates();
+    u.resize(nStates);
+
+    for (iterations = 0; iterations < maxIter;)
+    {
+        float delta = 0;
+        for (IndexT s = 0; s < nStates; ++s)
+        {
+            IndexT r = model.row(s, policy[s]);
+            float sum = 0;  // expected utility of the successors other than s
+            float pSelf = 0;  // probability to stay in s
+            for (IndexT i = model.rowBegin(r); i < model.rowEnd(r); ++i)
+            {
+                if (succ[i] == s) pSelf += prob[i];
+                else sum += prob[i] * u[succ[i]];
+            }
+            float diag = 1.0f - discount * pSelf;
+            float target;
+            if (diag > static_cast<float>(ZERO_EPSILON)) target = (model.getReward(s) + discount * sum) / diag;
+            else target = model.getReward(s) + discount * (sum + pSelf * u[s]);  // singular, no solution exists
+            float newUt = u[s] + omega * (target - u[s]);
+            float change = fabs(newUt - u[s]);
+            if (change > delta) delta = change;
+            u[s] = newUt;
+        }
+        ++iterations;
+        if (delta < tolerance) return true;
+        if (criterion && criterion->checkDeadline()) return false;
+    }
+    return false;
+}
+
+
+/**
+ * Solves (I - discount * P_pi) U = R for the policy pi on a compiled model, with
+ * the BiCGSTAB method. The vectors are kept in double precision internally.
+ * States for which the policy action has no transition states get U(s) = R(s).
+ *
+ * If discount is 1 and the policy does not reach a terminal state from every state,
+ * the system is singular (or nearly singular, due to rounding of the probabilities). This
+ * is checked with isProperPolicy() beforehand, and false is returned without changing u.
+ * The true residual of the result is checked at the end as well, and if it is not within
+ * the tolerance, u is left unchanged and false is returned.
+ *
+ * \param model the compiled model
+ * \param policy action index for each state, indexed by state index
+ * \param u the initial guess (e.g. the utilities of the previous policy), will
+ * contain the result
+ * \param discount discount factor
+ * \param tolerance stop when the relative residual ||R - (I - discount * P_pi) U|| / ||R|| is below this value
+ * \param maxIter maximum number of iterations
+ * \param iterations will contain the number of iterations done
+ * \param criterion if not NULL, its deadline is checked before each iteration (see
+ *      StoppingCriterion::checkDeadline()), and the evaluation is stopped when it has passed
+ * \return true if the tolerance was reached within maxIter iterations
+ */
+template<class State, class Action>
+bool bicgstabPolicyEvaluation(const FlatModel<State, Action>& model,
+                              const std::vector<typename FlatModel<State, Action>::IndexT>& policy,
+                              std::vector<float>& u, float discount, float tolerance,
+                              unsigned int maxIter, unsigned int& iterations,
+                              StoppingCriterion * criterion = NULL)
+{
+    typedef typename FlatModel<State, Action>::IndexT IndexT;
+    typedef std::vector<double> VectorT;
+
+    IndexT nStates = model.numStates();
+    u.resize(nStates);
+    iterations = 0;
+    if (nStates == 0) return true;
+    if ((discount >= 1) && !isProperPolicy(model, policy)) return false;
+
+    const std::vector<IndexT>& succ = model.getSuccessors();
+    const std::vector<float>& prob = model.getProbabilities();
+
+    // y = (I - discount * P_pi) x
+    struct Operator
+    {
+        static void apply(const FlatModel<State, Action>& model, const std::vector<IndexT>& policy,
+                          const std::vector<IndexT>& succ, const std::vector<float>& prob,
+                          double discount, const VectorT& x, VectorT& y)
+        {
+            for (IndexT s = 0; s < x.size(); ++s)
+            {
+                IndexT r = model.row(s, policy[s]);
+                double sum = 0;
+                for (IndexT i = model.rowBegin(r); i < model.rowEnd(r); ++i) sum += prob[i] * x[succ[i]];
+                y[s] = x[s] - discount * sum;
+            }
+        }
+    };
+
+    VectorT x(u.begin(), u.end());
+    VectorT b(model.getRewards().begin(), model.getRewards().end());
+    VectorT r(nStates), rHat(nStates), p(nStates, 0), v(nStates, 0), sVec(nStates), t(nStates);
+
+    double bNorm = 0;
+    for (IndexT i = 0; i < nStates; ++i) bNorm += b[i] * b[i];
+    bNorm = sqrt(bNorm);
+    if (bNorm == 0) bNorm = 1;
+
+    Operator::apply(model, policy, succ, prob, discount, x, r);
+    double rNorm = 0;
+    for (IndexT i = 0; i < nStates; ++i)
+    {
+        r[i] = b[i] - r[i];
+        rHat[i] = r[i];
+        rNorm += r[i] * r[i];
+    }
+    bool converged = (sqrt(rNorm) / bNorm) < tolerance;
+
+    double rho = 1, alpha = 1, omega = 1;
+    while (!converged && (iterations < maxIter))
+    {
+        if (criterion && criterion->checkDeadline()) break;
+        ++iterations;
+        double rhoNew = 0;
+        for (IndexT i = 0; i < nStates; ++i) rhoNew += rHat[i] * r[i];
+        if (rhoNew == 0)
+        {
+            PRINTMSG("WARNING: BiCGSTAB broke down (rho=0) after " << iterations << " iterations");
+            break;
+        }
+        double beta = (rhoNew / rho) * (alpha / omega);
+        rho = rhoNew;
+        for (IndexT i = 0; i < nStates; ++i) p[i] = r[i] + beta * (p[i] - omega * v[i]);
+        Operator::apply(model, policy, succ, prob, discount, p, v);
+        double rHatV = 0;
+        for (IndexT i = 0; i < nStates; ++i) rHatV += rHat[i] * v[i];
+        if (rHatV == 0)
+        {
+            PRINTMSG("WARNING: BiCGSTAB broke down (rHat*v=0) after " << iterations << " iterations");
+            break;
+        }
+        alpha = rho / rHatV;
+        double sNorm = 0;
+        for (IndexT i = 0; i < nStates; ++i)
+        {
+            sVec[i] = r[i] - alpha * v[i];
+            sNorm += sVec[i] * sVec[i];
+        }
+        if ((sqrt(sNorm) / bNorm) < tolerance)
+        {
+            for (IndexT i = 0; i < nStates; ++i) x[i] += alpha * p[i];
+            converged = true;
+            break;
+        }
+        Operator::apply(model, policy, succ, prob, discount, sVec, t);
+        double tt = 0, ts = 0;
+        for (IndexT i = 0; i < nStates; ++i)
+        {
+            tt += t[i] * t[i];
+            ts += t[i] * sVec[i];
+        }
+        if (tt == 0)
+        {
+            PRINTMSG("WARNING: BiCGSTAB broke down (t=0) after " << iterations << " iterations");
+            break;
+        }
+        omega = ts / tt;
+        rNorm = 0;
+        for (IndexT i = 0; i < nStates; ++i)
+        {
+            x[i] += alpha * p[i] + omega * sVec[i];
+            r[i] = sVec[i] - omega * t[i];
+            rNorm += r[i] * r[i];
+        }
+        converged = (sqrt(rNorm) / bNorm) < tolerance;
+        if (omega == 0) break;
+    }
+
+    // The recursively updated residual can drift away from the true residual, which
+    // happens in particular for singular systems. Only accept the solution if the true
+    // residual is within the tolerance, otherwise leave u at the initial guess.
+    Operator::apply(model, policy, succ, prob, discount, x, r);
+    rNorm = 0;
+    for (IndexT i = 0; i < nStates; ++i) rNorm += (b[i] - r[i]) * (b[i] - r[i]);
+    if ((sqrt(rNorm) / bNorm) >= tolerance) return false;
+
+    for (IndexT i = 0; i < nStates; ++i) u[i] = static_cast<float>(x[i]);
+    return true;
+}
+
+}  // namespace rl
+#endif  // RL_POLICYEVALUATION_H
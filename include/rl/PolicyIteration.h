@@ -11,11 +11,16 @@
 #include <rl/Policy.h>
 #include <rl/Transition.h>
 #include <rl/LogBinding.h>
+#include <rl/FlatModel.h>
+#include <rl/PolicyEvaluation.h>
+#include <rl/StoppingCriterion.h>
 
 #include <math/FloatComparison.h>
+#include <math/RandomNumber.h>
 
 #include <assert.h>
 #include <math.h>
+#include <vector>
 
 namespace rl
 {
@@ -224,6 +229,7 @@ public:
     typedef Utility<StateT, UtilityDataTypeT> UtilityT;
     typedef Policy<StateT, ActionT> PolicyT;
     typedef LookupPolicy<StateT, ActionT> LookupPolicyT;
+    typedef IndexedPolicy<StateT, ActionT> IndexedPolicyT;
 
 
     typedef typename UtilityT::UtilityPtrT UtilityPtrT;
@@ -236,14 +242,18 @@ public:
     typedef typename ActionGeneratorT::ActionGeneratorConstPtrT ActionGeneratorConstPtrT;
     typedef typename DomainT::DomainConstPtrT DomainConstPtrT;
 
+    typedef FlatModel<StateT, ActionT> FlatModelT;
+    typedef typename FlatModelT::FlatModelConstPtrT FlatModelConstPtrT;
+    typedef StoppingCriterion::StoppingCriterionPtrT StoppingCriterionPtrT;
 
 
     explicit PolicyIterationController(DomainConstPtrT _domain, float _defaultUtility,
                                        float _discount, bool _train = true):
         LearningControllerT(_domain, _train),
-        policy(new LookupPolicyT()),
+        policy(makePolicy(_domain)),
         defaultUtility(_defaultUtility),
-        discount(_discount), initialised(false) {}
+        discount(_discount), useFlatModel(false), evalMethod(ModifiedPolicyIteration),
+        evalTolerance(1e-06), maxEvalIter(1000), evalOmega(1.0f), initialised(false) {}
     virtual ~PolicyIterationController() {}
 
     virtual bool isOnlineLearner()
@@ -251,6 +261,46 @@ public:
         return false;
     }
 
+    /**
+     * If set to true, the domain is compiled into a FlatModel before learning, and
+     * the policy iteration is performed on the compiled model. This requires a finite
+     * domain, and is only considered in the next call of initialize().
+     */
+    void setUseFlatModel(bool on)
+    {
+        useFlatModel = on;
+    }
+
+    /**
+     * Sets the method used for policy evaluation. SOR and BiCGSTAB solve the linear
+     * system of the policy utilities on the compiled model, so they imply setUseFlatModel(true).
+     * See the flat policyIteration() for a description of the parameters.
+     */
+    void setPolicyEvaluation(PolicyEvaluationMethodT method, float tolerance = 1e-06, unsigned int maxIter = 1000,
+                             float omega = 1.0f)
+    {
+        evalMethod = method;
+        evalTolerance = tolerance;
+        maxEvalIter = maxIter;
+        evalOmega = omega;
+        if (method != ModifiedPolicyIteration) useFlatModel = true;
+    }
+
+    /**
+     * Sets additional termination criteria for policy iteration, e.g. a maximum
+     * number of iterations or a deadline. After learning, the criterion tells
+     * which criterion stopped the iterations. NULL to stop only when the policy
+     * does not change any more.
+     */
+    void setStoppingCriterion(const StoppingCriterionPtrT& c)
+    {
+        criterion = c;
+    }
+    StoppingCriterionPtrT getStoppingCriterion() const
+    {
+        return criterion;
+    }
+
     /**
      */
     virtual PolicyConstPtrT getPolicy()const
@@ -262,7 +312,7 @@ public:
         return NULL;
     }
 
-    virtual void resetStartState(const StateT& startState)
+    virtual void resetStartState(const StateT&)
     {
     }
 
@@ -281,9 +331,24 @@ public:
 
 protected:
     typedef MappedUtility<StateT> MappedUtilityT;
+    typedef IndexedUtility<StateT> IndexedUtilityT;
+
+    /**
+     * Creates an IndexedPolicy if the domain provides a state indexer, and
+     * a LookupPolicy otherwise.
+     */
+    static PolicyPtrT makePolicy(const DomainConstPtrT& domain)
+    {
+        if (domain.get() && domain->getStateIndexer().get())
+        {
+            return PolicyPtrT(new IndexedPolicyT(domain->getStateIndexer()));
+        }
+        return PolicyPtrT(new LookupPolicyT());
+    }
+
     /**
      */
-    virtual bool learnOffline(const StateT& currState)
+    virtual bool learnOffline(const StateT&)
     {
         if (!this->domain.get() ||
                 !this->domain->getReward().get() ||
@@ -294,12 +359,38 @@ protected:
             PRINTERROR("Can't perform value iteration because one of the required objects is NULL");
             return false;
         }
-        UtilityPtrT utility(new MappedUtilityT(defaultUtility));
+        UtilityPtrT utility;
+        if (this->domain->getStateIndexer().get())
+            utility = UtilityPtrT(new IndexedUtilityT(this->domain->getStateIndexer(), defaultUtility));
+        else
+            utility = UtilityPtrT(new MappedUtilityT(defaultUtility));
+
+        if (useFlatModel)
+        {
+            FlatModelConstPtrT flatModel = FlatModelT::compile(*(this->domain));
+            if (!flatModel.get())
+            {
+                PRINTERROR("Could not compile the domain into a flat model");
+                return false;
+            }
+            std::vector<UtilityDataTypeT> flatUtility;
+            flatModel->readUtility(*utility, flatUtility);
+            PRINTMSG("Start flat policy iteration..");
+            PolicyPtrT resultPolicy = policyIteration(*flatModel, flatUtility, discount, 5,
+                                       evalMethod, evalTolerance, maxEvalIter, evalOmega, criterion);
+            if (!resultPolicy.get())
+            {
+                PRINTERROR("Error in policy iteration");
+                return false;
+            }
+            policy = resultPolicy;
+            return true;
+        }
 
         PRINTMSG("Start policy iteration..");
         PolicyPtrT resultPolicy = policyIteration(utility, policy,
                                   this->domain->getReward(), this->domain->getTransition(),
-                                  this->domain->getStateGenerator(), this->domain->getActionGenerator(), discount);
+                                  this->domain->getStateGenerator(), this->domain->getActionGenerator(), discount, 5, criterion);
         if (!resultPolicy.get())
         {
             PRINTERROR("Error in value iteration");
@@ -324,7 +415,7 @@ protected:
         return a;
     }
 
-    virtual bool initializeImpl(const StateT& startState)
+    virtual bool initializeImpl(const StateT&)
     {
         initialised = true;
         return true;
@@ -335,6 +426,12 @@ private:
     PolicyPtrT policy;
     float defaultUtility;
     float discount;
+    bool useFlatModel;
+    PolicyEvaluationMethodT evalMethod;
+    float evalTolerance;
+    unsigned int maxEvalIter;
+    float evalOmega;
+    StoppingCriterionPtrT criterion;
     bool initialised;
 };
 
@@ -360,6 +457,9 @@ private:
   * \param discount this is used for the policy evaluation
   * \param modPolicyIter for policy evaluation (modified policy iteration). Indicates how many value
   * iteration steps are performed per iteration of the policy iteration algorithm to update the utility.
+  * \param criterion optional additional termination criteria, checked after each policy improvement
+  * with the statistics of the last value iteration step of the policy evaluation. After return,
+  * it tells which criterion stopped the iterations (Converged if the policy did not change any more).
   */
 template<class State, class Action>
 std::shared_ptr<Policy<State, Action> > policyIteration(
@@ -369,7 +469,8 @@ std::shared_ptr<Policy<State, Action> > policyIteration(
     std::shared_ptr<const Transition<State, Action> > t,
     std::shared_ptr<const StateGenerator<State> > sg,
     std::shared_ptr<const ActionGenerator<Action> > ag,
-    float discount, unsigned int modPolicyIter = 5)
+    float discount, unsigned int modPolicyIter = 5,
+    StoppingCriterion::StoppingCriterionPtrT criterion = StoppingCriterion::StoppingCriterionPtrT())
 {
 
     typedef PolicyIterationUpdate<State, Action> PolicyIterationUpdateT;
@@ -463,13 +564,225 @@ std::shared_ptr<Policy<State, Action> > policyIteration(
         unchanged = policyIterationUpdate->isUnchanged();
         ++cnt;
         // if (cnt==19) {PRINTMSG("WARN: Break here"); break;}
+        if (!unchanged && criterion.get() && criterion->update(valueIterationUpdate->getStatistics())) break;
     }
     while (!unchanged);
 
+    if (criterion.get() && unchanged) criterion->setConverged();
     PRINTMSG("Number of iterations: " << cnt);
+    if (criterion.get()) PRINTMSG("Stopped because of: " << StoppingCriterion::getReasonName(criterion->getReason()));
     return policyIterationUpdate->getPolicy();
 }
 
+
+/**
+ * Fast path of the policy iteration algorithm working on a compiled model.
+ * Performs the same policy evaluation (modPolicyIter value iteration steps with the
+ * fixed policy) and policy improvement steps as the policyIteration() function working
+ * on the Utility, Reward and Transition interfaces, but on plain state and action indices.
+ * \param model the compiled model
+ * \param u initial utility of each state in the model, indexed by state index. Will
+ * contain the utilities of the last policy evaluation.
+ * \param discount this is used for the policy evaluation
+ * \param modPolicyIter for policy evaluation (modified policy iteration). Indicates how many value
+ * iteration steps are performed per iteration of the policy iteration algorithm to update the utility.
+ * Only used if evalMethod is ModifiedPolicyIteration.
+ * \param evalMethod method to use for the policy evaluation. With SOR and BiCGSTAB, the utilities
+ * of the policy are calculated exactly (up to evalTolerance) as solution of the linear system
+ * U = R + discount * P_pi * U. Unlike modified policy iteration, this does not cap the expected utility of
+ * the policy action at 0 from below, so utilities of states can become negative.
+ * \param evalTolerance the tolerance for SOR and BiCGSTAB, see sorPolicyEvaluation() and bicgstabPolicyEvaluation()
+ * \param maxEvalIter the maximum number of iterations of SOR and BiCGSTAB for each policy evaluation.
+ * If the policy does not reach a terminal state and discount is 1, there is no solution, and the
+ * evaluation is stopped at this limit.
+ * \param evalOmega the relaxation factor of SOR (0..2), see sorPolicyEvaluation(). Also used
+ * when SOR takes over from a failed BiCGSTAB evaluation.
+ * \param criterion optional additional termination criteria, checked after each policy improvement
+ * with the statistics of the utility changes caused by the policy evaluation. Its deadline is also
+ * checked after each sweep of the policy evaluation, which is then stopped, and the policy is
+ * not improved any more. After return, it tells which criterion stopped the iterations
+ * (Converged if the policy did not change any more).
+ * \return the resulting policy
+ */
+template<class State, class Action>
+std::shared_ptr<Policy<State, Action> > policyIteration(const FlatModel<State, Action>& model,
+                                                       std::vector<float>& u,
+                                                       float discount, unsigned int modPolicyIter = 5,
+                                                       PolicyEvaluationMethodT evalMethod = ModifiedPolicyIteration,
+                                                       float evalTolerance = 1e-06, unsigned int maxEvalIter = 1000,
+                                                       float evalOmega = 1.0f,
+                                                       StoppingCriterion::StoppingCriterionPtrT criterion =
+                                                           StoppingCriterion::StoppingCriterionPtrT())
+{
+    typedef FlatModel<State, Action> FlatModelT;
+    typedef typename FlatModelT::IndexT IndexT;
+    typedef Policy<State, Action> PolicyT;
+    typedef LookupPolicy<State, Action> LookupPolicyT;
+    typedef IndexedPolicy<State, Action> IndexedPolicyT;
+    typedef typename PolicyT::PolicyPtrT PolicyPtrT;
+
+    if (model.numActions() == 0)
+    {
+        PRINTERROR("Can't perform policy iteration without actions");
+        return NULL;
+    }
+
+    IndexT nStates = model.numStates();
+    u.resize(nStates);
+    std::vector<float> tempU(u);
+
+    // initialise the policy with random actions
+    std::vector<IndexT> policy(nStates);
+    for (IndexT s = 0; s < nStates; ++s)
+    {
+        policy[s] = RandomNumberGenerator::threadEngine().below(model.numActions());
+    }
+
+    unsigned int cnt = 0;
+    bool unchanged = true;
+    std::vector<float> prevU;
+    if (criterion.get()) criterion->start();
+    do
+    {
+        if (criterion.get()) prevU = u;
+        bool expired = false;  // the deadline has passed during the evaluation
+        // policy evaluation:
+        if (evalMethod == ModifiedPolicyIteration)
+        {
+            for (unsigned int k = 0; k < modPolicyIter; ++k)
+            {
+                if (criterion.get() && criterion->checkDeadline())
+                {
+                    expired = true;
+                    break;
+                }
+                for (IndexT s = 0; s < nStates; ++s)
+                {
+                    IndexT r = model.row(s, policy[s]);
+                    float policyUt = 0;
+                    if (!model.emptyRow(r))
+                    {
+                        float ut = model.expectedUtility(r, &u[0]);
+                        if (ut > policyUt) policyUt = ut;
+                    }
+                    tempU[s] = model.getReward(s) + discount * policyUt;
+                }
+                u.swap(tempU);
+            }
+        }
+        else
+        {
+            unsigned int evalIter = 0;
+            bool converged = false;
+            if (evalMethod == BiCGSTAB)
+            {
+                converged = bicgstabPolicyEvaluation(model, policy, u, discount, evalTolerance, maxEvalIter, evalIter,
+                                                     criterion.get());
+                expired = criterion.get() && (criterion->getReason() == StoppingCriterion::Deadline);
+                // If the system is singular (the policy does not reach a terminal state and discount is 1),
+                // SOR still drives the utilities of the trapped states towards -infinity (with negative
+                // rewards), so the policy improvement changes their actions.
+                if (!converged && !expired)
+                {
+                    PRINTMSG("WARNING: BiCGSTAB failed in policy iteration step " << cnt << ", using SOR instead");
+                }
+            }
+            if ((evalMethod == SOR) || ((evalMethod == BiCGSTAB) && !converged && !expired))
+            {
+                converged = sorPolicyEvaluation(model, policy, u, discount, evalTolerance, maxEvalIter, evalOmega, evalIter,
+                                                criterion.get());
+                expired = criterion.get() && (criterion->getReason() == StoppingCriterion::Deadline);
+            }
+            if (!converged && !expired)
+            {
+                PRINTMSG("WARNING: Policy evaluation did not converge within " << evalIter
+                         << " iterations in policy iteration step " << cnt);
+            }
+        }
+
+        // the policy is not improved with the utilities of an incomplete evaluation
+        if (expired)
+        {
+            unchanged = false;
+            break;
+        }
+
+        // policy improvement:
+        unchanged = true;
+        if (evalMethod == ModifiedPolicyIteration)
+        {
+            for (IndexT s = 0; s < nStates; ++s)
+            {
+                IndexT bestAction;
+                float maxActionUtVal = model.maxExpectedUtility(s, &u[0], bestAction);
+                IndexT r = model.row(s, policy[s]);
+                float maxPolicyUtVal = 0;
+                if (!model.emptyRow(r))
+                {
+                    float ut = model.expectedUtility(r, &u[0]);
+                    if (ut > maxPolicyUtVal) maxPolicyUtVal = ut;
+                }
+                if (maxActionUtVal > maxPolicyUtVal)
+                {
+                    policy[s] = bestAction;
+                    unchanged = false;
+                }
+            }
+        }
+        else
+        {
+            for (IndexT s = 0; s < nStates; ++s)
+            {
+                // The exact utilities can be negative, so the expected utilities are
+                // compared without the cap at 0. Differences within the tolerance of the
+                // evaluation are ignored, so the algorithm can't cycle between equal policies.
+                IndexT r = model.row(s, policy[s]);
+                if (model.emptyRow(r)) continue;
+                float policyUtVal = model.expectedUtility(r, &u[0]);
+                IndexT bestAction = policy[s];
+                float maxActionUtVal = policyUtVal;
+                for (IndexT a = 0; a < model.numActions(); ++a)
+                {
+                    IndexT ar = model.row(s, a);
+                    if (model.emptyRow(ar)) continue;
+                    float ut = model.expectedUtility(ar, &u[0]);
+                    if (ut > maxActionUtVal)
+                    {
+                        maxActionUtVal = ut;
+                        bestAction = a;
+                    }
+                }
+                if ((bestAction != policy[s]) && !equalFloats(maxActionUtVal, policyUtVal, evalTolerance))
+                {
+                    policy[s] = bestAction;
+                    unchanged = false;
+                }
+            }
+        }
+        ++cnt;
+        if (!unchanged && criterion.get())
+        {
+            SweepStatistics stats;
+            for (IndexT s = 0; s < nStates; ++s) stats.add(prevU[s], u[s]);
+            if (criterion->update(stats)) break;
+        }
+    }
+    while (!unchanged);
+
+    if (criterion.get() && unchanged) criterion->setConverged();
+    PRINTMSG("Number of iterations: " << cnt);
+    if (criterion.get()) PRINTMSG("Stopped because of: " << StoppingCriterion::getReasonName(criterion->getReason()));
+
+    PolicyPtrT resultPolicy;
+    if (model.getStateIndexer().get()) resultPolicy = PolicyPtrT(new IndexedPolicyT(model.getStateIndexer()));
+    else resultPolicy = PolicyPtrT(new LookupPolicyT());
+    for (IndexT s = 0; s < nStates; ++s)
+    {
+        resultPolicy->bestAction(model.getState(s), model.getAction(policy[s]));
+    }
+    return resultPolicy;
+}
+
 }
 
 #endif
@@ -0,0 +1,296 @@
+#ifndef RL_PRIORITIZEDSWEEPING_H
+#define RL_PRIORITIZEDSWEEPING_H
+// Copyright Jennifer Buehler
+
+#include <rl/FlatModel.h>
+#include <rl/StoppingCriterion.h>
+#include <rl/LogBinding.h>
+
+#include <math/FloatComparison.h>
+
+#include <algorithm>
+#include <limits>
+#include <vector>
+#include <math.h>
+
+namespace rl
+{
+
+/**
+ * \brief For each state of a FlatModel, the list of states from which it
+ * can be reached with any action (with a probability > 0).
+ *
+ * Stored in CSR format like the FlatModel: the predecessors of state s are
+ * the entries offsets[s] .. offsets[s+1]-1 of predecessors. Each predecessor is
+ * listed only once per state, even if it reaches the state with several actions.
+ */
+template<class State, class Action>
+class PredecessorIndex
+{
+public:
+    typedef FlatModel<State, Action> FlatModelT;
+    typedef typename FlatModelT::IndexT IndexT;
+
+    explicit PredecessorIndex(const FlatModelT& model)
+    {
+        IndexT nStates = model.numStates();
+        IndexT nActions = model.numActions();
+        const std::vector<IndexT>& succ = model.getSuccessors();
+
+        // count the transitions into each state, then fill the lists
+        std::vector<IndexT> cnt(nStates + 1, 0);
+        for (IndexT i = 0; i < succ.size(); ++i) ++cnt[succ[i] + 1];
+        for (IndexT s = 0; s < nStates; ++s) cnt[s + 1] += cnt[s];
+        std::vector<IndexT> all(succ.size());
+        std::vector<IndexT> fill(cnt.begin(), cnt.end() - 1);
+        for (IndexT s = 0; s < nStates; ++s)
+        {
+            for (IndexT a = 0; a < nActions; ++a)
+            {
+                IndexT r = model.row(s, a);
+                for (IndexT i = model.rowBegin(r); i < model.rowEnd(r); ++i)
+                {
+                    all[fill[succ[i]]++] = s;
+                }
+            }
+        }
+
+        // the lists are sorted by construction, so duplicates are adjacent
+        offsets.reserve(nStates + 1);
+        offsets.push_back(0);
+        for (IndexT s = 0; s < nStates; ++s)
+        {
+            for (IndexT i = cnt[s]; i < cnt[s + 1]; ++i)
+            {
+                if ((i == cnt[s]) || (all[i] != all[i - 1])) predecessors.push_back(all[i]);
+            }
+            offsets.push_back(predecessors.size());
+        }
+    }
+
+    IndexT begin(IndexT s) const
+    {
+        return offsets[s];
+    }
+    IndexT end(IndexT s) const
+    {
+        return offsets[s + 1];
+    }
+    IndexT get(IndexT i) const
+    {
+        return predecessors[i];
+    }
+
+private:
+    std::vector<IndexT> offsets;
+    std::vector<IndexT> predecessors;
+};
+
+
+/**
+ * \brief Binary max-heap of the ids 0..size-1 with a priority each. Because
+ * the position of each id in the heap is kept, the priority of an id can be
+ * changed and an id can be removed in O(log n).
+ */
+class IndexedMaxHeap
+{
+public:
+    typedef unsigned int IndexT;
+
+    explicit IndexedMaxHeap(IndexT size): pos(size, static_cast<IndexT>(NotInHeap)), priority(size, 0) {}
+
+    bool empty() const
+    {
+        return heap.empty();
+    }
+    IndexT size() const
+    {
+        return heap.size();
+    }
+    bool contains(IndexT id) const
+    {
+        return pos[id] != static_cast<IndexT>(NotInHeap);
+    }
+    IndexT top() const
+    {
+        return heap[0];
+    }
+    float topPriority() const
+    {
+        return priority[heap[0]];
+    }
+
+    /**
+     * Inserts the id, or changes its priority if it is already in the heap.
+     */
+    void set(IndexT id, float p)
+    {
+        if (!contains(id))
+        {
+            priority[id] = p;
+            pos[id] = heap.size();
+            heap.push_back(id);
+            up(pos[id]);
+            return;
+        }
+        float old = priority[id];
+        priority[id] = p;
+        if (p > old) up(pos[id]);
+        else down(pos[id]);
+    }
+
+    void remove(IndexT id)
+    {
+        if (!contains(id)) return;
+        IndexT i = pos[id];
+        IndexT last = heap.back();
+        heap.pop_back();
+        pos[id] = static_cast<IndexT>(NotInHeap);
+        if (i == heap.size()) return;  // removed the last element
+        heap[i] = last;
+        pos[last] = i;
+        up(i);
+        down(pos[last]);
+    }
+
+    IndexT pop()
+    {
+        IndexT id = heap[0];
+        remove(id);
+        return id;
+    }
+
+private:
+    enum {NotInHeap = 0xffffffff};
+
+    void swap(IndexT i, IndexT j)
+    {
+        std::swap(heap[i], heap[j]);
+        pos[heap[i]] = i;
+        pos[heap[j]] = j;
+    }
+    void up(IndexT i)
+    {
+        while (i > 0)
+        {
+            IndexT parent = (i - 1) / 2;
+            if (!(priority[heap[i]] > priority[heap[parent]])) return;
+            swap(i, parent);
+            i = parent;
+        }
+    }
+    void down(IndexT i)
+    {
+        while (true)
+        {
+            IndexT largest = i;
+            IndexT l = 2 * i + 1, r = 2 * i + 2;
+            if ((l < heap.size()) && (priority[heap[l]] > priority[heap[largest]])) largest = l;
+            if ((r < heap.size()) && (priority[heap[r]] > priority[heap[largest]])) largest = r;
+            if (largest == i) return;
+            swap(i, largest);
+            i = largest;
+        }
+    }
+
+    std::vector<IndexT> heap;  // the ids, ordered as binary heap
+    std::vector<IndexT> pos;  // position of each id in heap, or NotInHeap
+    std::vector<float> priority;  // priority of each id
+};
+
+
+/**
+ * Value iteration by prioritized sweeping on a compiled model. Instead of sweeping
+ * over all states, only the state with the largest Bellman residual
+ * |R(s) + discount * max_over_a{sum_over_all_s'[T(s,a,s')*U(s')]} - U(s)| is updated
+ * at a time, after which the residuals of its predecessors are recalculated.
+ * States are only updated while their residual exceeds the same threshold as used
+ * by valueIteration() for the maximum utility change of a sweep, so the termination
+ * criterion is the same: the algorithm stops when no state would change by more than
+ * maxErr * (1 - discount) / discount in a full sweep.
+ *
+ * \param model the compiled model
+ * \param u initial utility of each state in the model, indexed by state index. Will
+ * contain the resulting utilities.
+ * \param discount discount factor
+ * \param maxErr maximum error allowed in the utility of any state (determines termination criterion).
+ * \param maxBackups maximum number of state updates to perform, 0 for no limit.
+ * \param criterion optional additional termination criteria. Each block of as many backups as there
+ * are states counts as one iteration, with the statistics of the updates within the block.
+ * After return, it tells which criterion stopped the algorithm.
+ * \return the number of state updates (backups) performed
+ */
+template<class State, class Action>
+unsigned long prioritizedSweeping(const FlatModel<State, Action>& model, std::vector<float>& u,
+                                  float discount, float maxErr, unsigned long maxBackups = 0,
+                                  StoppingCriterion::StoppingCriterionPtrT criterion =
+                                      StoppingCriterion::StoppingCriterionPtrT())
+{
+    typedef FlatModel<State, Action> FlatModelT;
+    typedef typename FlatModelT::IndexT IndexT;
+
+    IndexT nStates = model.numStates();
+    u.resize(nStates);
+
+    float discountRatio = static_cast<float>(1.0 - discount) / static_cast<float>(discount);
+    float minDelta = maxErr * discountRatio;
+    PRINTMSG("Starting prioritized sweeping with discount=" << discount << ", discountRatio="
+        << discountRatio << ", maxErr=" << maxErr << ", minDelta=" << minDelta);
+
+    PredecessorIndex<State, Action> predecessors(model);
+    IndexedMaxHeap queue(nStates);
+
+    for (IndexT s = 0; s < nStates; ++s)
+    {
+        float ut = model.backup(s, &u[0], discount);
+        float residual = fabs(ut - u[s]);
+        if ((residual > minDelta) && !equalFloats(residual, minDelta, static_cast<float>(ZERO_EPSILON)))
+            queue.set(s, residual);
+    }
+
+    if (criterion.get()) criterion->start();
+    SweepStatistics stats;
+    unsigned long backups = 0;
+    while (!queue.empty() && ((maxBackups == 0) || (backups < maxBackups)))
+    {
+        IndexT s = queue.pop();
+        float ut = model.backup(s, &u[0], discount);
+        stats.add(u[s], ut);
+        u[s] = ut;
+        ++backups;
+        if (criterion.get() && ((backups % nStates) == 0))
+        {
+            if (criterion->update(stats)) break;
+            stats.reset();
+        }
+        for (IndexT i = predecessors.begin(s); i < predecessors.end(s); ++i)
+        {
+            IndexT p = predecessors.get(i);
+            float ut = model.backup(p, &u[0], discount);
+            float residual = fabs(ut - u[p]);
+            if ((residual > minDelta) && !equalFloats(residual, minDelta, static_cast<float>(ZERO_EPSILON)))
+                queue.set(p, residual);
+            else
+                queue.remove(p);
+        }
+    }
+    if (criterion.get() && (criterion->getReason() != StoppingCriterion::NotStopped))
+    {
+        PRINTMSG("Prioritized sweeping stopped because of: "
+                 << StoppingCriterion::getReasonName(criterion->getReason()));
+    }
+    else if (!queue.empty())
+    {
+        PRINTMSG("WARNING: Prioritized sweeping stopped after the maximum of " << maxBackups
+                 << " backups, maximum residual=" << queue.topPriority());
+    }
+    else if (criterion.get())
+    {
+        criterion->setConverged();
+    }
+    PRINTMSG("Number of backups: " << backups << " (" << (static_cast<double>(backups) / nStates) << " sweeps)");
+    return backups;
+}
+
+}  // namespace rl
+#endif  // RL_PRIORITIZEDSWEEPING_H
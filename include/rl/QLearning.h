@@ -3,93 +3,70 @@
 //  Copyright Jennifer Buehler
 
 #include <rl/Transition.h>
-#include <rl/StateActionPair.h>
 #include <rl/StateAlgorithms.h>
 #include <rl/Exploration.h>
 #include <rl/Policy.h>
+#include <rl/QTable.h>
+#include <rl/ChangeStatistics.h>
+#include <rl/EligibilityTraces.h>
+#include <rl/TransitionModel.h>
+#include <rl/Checkpoint.h>
 
 #include <math/RandomNumber.h>
 #include <general/Exception.h>
 
+#include <chrono>
 #include <iostream>
 #include <limits>
-#include <deque>
-#include <set>
-#include <map>
+#include <string>
 #include <utility>
-
-// if defined, during q-learning the transition
-// function is learned
-// #define LEARN_TRANSITION
-
-// #define UPDATE_WITH_OLD_REWARD
-
-// keep the average q-value changes for the last X steps
-// (number defined here). If macro undefined, no averages
-// are kept.
-#define KEEP_AVG_CHANGE 10000
+#include <vector>
+#include <algorithm>
+#include <atomic>
 
 namespace rl
 {
 
-
 /**
- * \brief A pair of action and value, which can be used as a key.
- * The key will be the Action, therefore this datatype has
- * to support the < operator.
- * The value is simply associated with the action and plays
- * no role for the key.
- * \author Jennifer Buehler
- * \date May 2011
+ * Reward policy of QLearningController: the q-value of the last state and action is
+ * updated with the reward received in the state reached (the default).
  */
-template<class Action, typename Value>
-class ActionValuePair
+struct CurrentRewardUpdate
 {
-public:
-    typedef Action ActionT;
-    typedef Value ValueT;
-
-    ActionValuePair() {}
-    ActionValuePair(const ActionT& _a, const ValueT& _v): a(_a), v(_v) {}
-    ActionValuePair(const ActionValuePair& o): a(o.a), v(o.v) {}
-
-    friend std::ostream& operator<<(std::ostream& o, const ActionValuePair& p)
-    {
-        o << "Action=" << p.a << ", value=" << p.v;
-        return o;
-    }
-    ActionValuePair& operator=(const ActionValuePair& o)
-    {
-        if (this == &o) return *this;
-        a = o.a;
-        v = o.v;
-        return *this;
-    }
-
-    bool operator < (const ActionValuePair& p) const
-    {
-        return (a < p.a);
-    }
-    ActionT a;
-    ValueT v;
-private:
+    enum {UseLastReward = 0};
 };
 
-
+/**
+ * Reward policy of QLearningController: the q-value of the last state and action is
+ * updated with the reward received in the last state, as in Russell & Norvig. The reward
+ * of a terminal state is then passed on as its utility.
+ */
+struct LastRewardUpdate
+{
+    enum {UseLastReward = 1};
+};
 
 /**
  * Implementation of a LearningController for the q learning algorithm.
  *
- * State and Action template parameters have to be usable as a key in a map (i.e.
- * support the < operator). They should both also implement the = operator and
- * copy constructor.
+ * State and Action template parameters have to support the < operator. They should
+ * both also implement the = operator and copy constructor. The q-values are kept in a
+ * QTable, so StateHash and StateEqual have to work for the State type.
  *
  * \author Jennifer Buehler
  * \date May 2011
  * \param Domain must be the class type of the domain used (NOT the base domain class!)
  * \param UtilityType utility value to use for the q-table entries
+ * \param ChangeStatisticsPolicy keeps the statistics of the q-value changes: ChangeStatistics,
+ *      or NoChangeStatistics to compile them out
+ * \param TransitionModelPolicy learns the transition function for planning: LearnedTransitionModel,
+ *      or NoTransitionModel to compile the model learning and planning out
+ * \param RewardUpdatePolicy the reward the q-values are updated with: CurrentRewardUpdate or LastRewardUpdate
  */
-template<class Domain, typename UtilityType = float>
+template<class Domain, typename UtilityType = float,
+         class ChangeStatisticsPolicy = ChangeStatistics,
+         template<class, class> class TransitionModelPolicy = LearnedTransitionModel,
+         class RewardUpdatePolicy = CurrentRewardUpdate>
 class QLearningController: public LearningController<Domain, UtilityType>
 {
 public:
@@ -98,11 +75,17 @@ public:
     typedef typename DomainT::ActionT ActionT;
     typedef typename DomainT::RewardValueTypeT RewardValueTypeT;
     typedef typename DomainT::DomainConstPtrT DomainConstPtrT;
+    typedef typename DomainT::RewardConstPtrT RewardConstPtrT;
 
     typedef UtilityType UtilityDataTypeT;
     typedef LearningController<DomainT, UtilityDataTypeT> LearningControllerT;
 
-    typedef QLearningController<DomainT, UtilityDataTypeT> QLearningControllerT;
+    typedef ChangeStatisticsPolicy ChangeStatisticsT;
+    typedef TransitionModelPolicy<StateT, ActionT> TransitionModelT;
+    typedef RewardUpdatePolicy RewardUpdateT;
+
+    typedef QLearningController<DomainT, UtilityDataTypeT, ChangeStatisticsT,
+            TransitionModelPolicy, RewardUpdateT> QLearningControllerT;
     typedef ActionGenerator<ActionT> ActionGeneratorT;
     typedef unsigned int FreqCntT; // datatype to count the frequency of events
     typedef Exploration<UtilityDataTypeT, FreqCntT> ExplorationT;
@@ -118,8 +101,16 @@ public:
     typedef typename UtilityT::UtilityConstPtrT UtilityConstPtrT;
     typedef typename ExplorationT::ExplorationConstPtrT ExplorationConstPtrT;
     typedef typename LearningRate::LearningRatePtrT LearningRatePtrT;
-    typedef typename std::shared_ptr<StateT> StatePtrT;
-    typedef typename std::shared_ptr<const StateT> StateConstPtrT;
+
+    /**
+     * The backups done by updateAndGetAction(), see setEligibilityTraces()
+     */
+    enum TraceMethod
+    {
+        OneStep,  // one-step q-learning (the default)
+        WatkinsQLambda,  // Watkins's Q(lambda)
+        SarsaLambda  // SARSA(lambda)
+    };
 
     /**
      * \param _defaultQ default q value for state-action pairs which haven't been encountered so far
@@ -138,18 +129,37 @@ public:
                         const float _discount, const UtilityDataTypeT& _defaultQ,
                         ExplorationConstPtrT _exploration, float _epsilonGreedy, bool _train = true):
         LearningControllerT(_domain, _train),
-        lastState(NULL), learnRate(_learnRate), discount(_discount),
+        q(collectActions(_domain), _domain->getActionIndexer(), _defaultQ),
+        learnRate(_learnRate), discount(_discount),
         defaultQ(_defaultQ),
         actionGenerator(this->domain->getActionGenerator()),
+        reward(this->domain->getReward()),
         exploration(_exploration), epsilonGreedy(_epsilonGreedy),
-        policy(new LookupPolicyT()),
-        initialised(false)
-#ifdef LEARN_TRANSITION
-        , learnedTransition(new LearnableTransitionMapT())
-#endif
+        policyVersion(0), policyPublishInterval(0), updatesSincePublish(0),
+        initialised(false),
+        traceMethod(OneStep), lambda(0), traceCutoff(0),
+        traces(q.numActions()),
+        planningSteps(0), planningBudget(0),
+        checkpointRows(0)
     {
         if (discount >= 1.0f) discount = 1.0f - std::numeric_limits<float>::epsilon();
         if (discount < 0.0f) discount = 0.0f;
+
+        // the q-table slots of the actions, in the order of the action generator
+        std::vector<ActionT> generated;
+        ActionCollector collector(generated);
+        actionGenerator->foreachAction(collector);
+        for (size_t i = 0; i < generated.size(); ++i)
+        {
+            QSlotT slot = q.getSlot(generated[i]);
+            if (slot == static_cast<QSlotT>(QTableT::NoSlot))
+            {
+                PRINTERROR("Action " << generated[i] << " is not known to the action indexer of the domain");
+                continue;
+            }
+            generatorOrder.push_back(slot);
+        }
+        publishedPolicy = makePolicy();
     }
 
 
@@ -160,20 +170,146 @@ public:
 
     virtual ActionT getBestLearnedAction(const StateT& currentState) const
     {
-        QMap_const_iterator qit = q.find(currentState); // get the q-entry for the state
-        if (qit == q.end())
+        // the best action of each state is kept up to date by the q-table
+        QSlotT best = q.getBestSlot(q.find(currentState));
+        if (best == static_cast<QSlotT>(QTableT::NoSlot))
         {
             PRINTMSG("WARNING: There is no action learned for state " << currentState << ". Choosing random action.");
             return actionGenerator->randomAction();
         }
-        ActionValuePairT bestActionForState = getMaxQValue(qit->second);
-        return bestActionForState.a;
+        return q.getAction(best);
+    }
+
+
+    /**
+     * Returns the action with the maximum q-value learned for the state.
+     * \return false if no action has been learned for the state yet
+     */
+    bool getGreedyAction(const StateT& s, ActionT& action) const
+    {
+        QSlotT best = q.getBestSlot(q.find(s));
+        if (best == static_cast<QSlotT>(QTableT::NoSlot)) return false;
+        action = q.getAction(best);
+        return true;
+    }
+
+    /**
+     * Updates the q-value of state s and action a from one experienced transition
+     * (s, a, reward, next), where reward is the reward received in state next.
+     * This allows to learn from experience which has been collected elsewhere (e.g.
+     * by the actors of ActorLearner) instead of by updateAndGetAction(). It does
+     * not change the last state and action of the online learning.
+     */
+    void updateFromTransition(const StateT& s, const ActionT& a, const RewardValueTypeT& reward, const StateT& next)
+    {
+        if (learnsTransition()) experienceTransition(s, a, next);
+        RewardValueTypeT lastReward = RewardUpdateT::UseLastReward ? this->reward->getReward(s) : 0;
+        updateFreqAndQValue(s, a, lastReward, next, reward);
     }
 
+    /**
+     * Batched version of updateAndGetAction() for numLanes episodes which are run in
+     * lockstep, e.g. by GridDomainBatch. Each lane keeps its own last state and action,
+     * so that lane i learns as if states[i] was passed to updateAndGetAction() of its
+     * own controller, while all lanes share the q-table. If numLanes differs from
+     * the one of the last call, all lanes start a new episode.
+     * \param states the current state of each lane
+     * \param rewards the reward of each state in states, as computed along with the
+     *      states by the caller
+     * \param actions will contain the action to perform in each lane. The action of a
+     *      lane in a terminal state is meaningless, it starts a new episode in the next step.
+     */
+    void updateAndGetActions(const StateT * states, const RewardValueTypeT * rewards,
+                             ActionT * actions, unsigned int numLanes)
+    {
+        if (lanes.size() != numLanes) lanes.assign(numLanes, StepContext());
+        if (!this->train)
+        {
+            for (unsigned int i = 0; i < numLanes; ++i)
+            {
+                actions[i] = getBestLearnedAction(states[i]);
+            }
+            return;
+        }
+        for (unsigned int i = 0; i < numLanes; ++i)
+        {
+            actions[i] = update(lanes[i], states[i], rewards[i]);
+        }
+    }
 
+    /**
+     * Publishes the greedy policy learned so far (see publishPolicy()) and returns it.
+     * Has to be called by the thread which learns, or while nothing learns. Other
+     * threads use getPolicySnapshot().
+     */
     virtual PolicyConstPtrT getPolicy()const
     {
-        return getLearnedPolicy();
+        publishPolicy();
+        return getPolicySnapshot();
+    }
+
+    /**
+     * Returns the greedy policy published last by the learning thread, with publishPolicy(),
+     * getPolicy() or after the number of updates set with setPolicyPublishInterval().
+     * Can be called by any thread at any time: the returned policy does not change afterwards.
+     * Before the first publication, the policy has no actions.
+     */
+    PolicyConstPtrT getPolicySnapshot() const
+    {
+        return std::atomic_load(&publishedPolicy);
+    }
+
+    /**
+     * Makes the greedy policy learned so far the one returned by getPolicySnapshot().
+     * The controller keeps the policy between the calls, and only updates the states whose
+     * best action has changed since the last call in it. If the domain provides a StateIndexer,
+     * the published copy shares all unchanged chunks of states with the previous one (see
+     * ChunkedPolicy), otherwise it is a full copy. Does nothing if no best action has changed.
+     * Has to be called by the thread which learns, or while nothing learns.
+     */
+    void publishPolicy() const
+    {
+        if (!policy.get())
+        {
+            // first call: changes have not been tracked so far
+            policy = getLearnedPolicy();
+        }
+        else
+        {
+            if (changedEntries.empty()) return;
+            for (size_t i = 0; i < changedEntries.size(); ++i)
+            {
+                QEntryT e = changedEntries[i];
+                QSlotT best = q.getBestSlot(e);
+                policy->bestAction(q.getState(e), q.getAction(best), q.getValue(e, best), 1.0);
+                entryChanged[e] = false;
+            }
+            changedEntries.clear();
+        }
+        std::atomic_store(&publishedPolicy, PolicyConstPtrT(policy->clone()));
+        policyVersion.fetch_add(1, std::memory_order_release);
+    }
+
+    /**
+     * Lets the learning thread publish the policy (see publishPolicy()) after every
+     * updates q-value updates, so that other threads polling getPolicySnapshot() see the
+     * policy while it is learned. With 0 (the default), the policy is only published by
+     * publishPolicy() and getPolicy().
+     */
+    void setPolicyPublishInterval(unsigned long updates)
+    {
+        policyPublishInterval = updates;
+        updatesSincePublish = 0;
+    }
+
+    /**
+     * Is increased each time a changed policy is published, so that threads polling for
+     * the policy can tell whether getPolicySnapshot() has changed since they last called it.
+     * Can be called by any thread.
+     */
+    unsigned long getPolicyVersion() const
+    {
+        return policyVersion.load(std::memory_order_acquire);
     }
     virtual UtilityConstPtrT getUtility()const
     {
@@ -182,7 +318,86 @@ public:
 
     virtual void resetStartState(const StateT& startState)
     {
-        lastState = NULL;
+        last.valid = false;
+        traces.clear();
+    }
+
+    /**
+     * Sets the random engine used for the epsilon-greedy choice and for the planning.
+     * By default (NULL), the stream of the calling thread of RandomNumberGenerator is used.
+     * The random actions come from the action generator of the domain, which has its own engine.
+     */
+    void setRandomEngine(const RandomNumberGenerator::EnginePtrT& _rng)
+    {
+        rng = _rng;
+    }
+
+    /**
+     * Selects the backups done by updateAndGetAction(). With WatkinsQLambda or SarsaLambda,
+     * each step updates all state-action pairs of the episode which have an eligibility
+     * trace, so that rewards propagate back along the episode in one step instead of
+     * one state per episode. The trace of the pair just performed is set to 1 (replacing
+     * traces), and all traces are multiplied by discount*lambda after each step. Traces
+     * below cutoff are dropped, so the cost of a step is proportional to the number of
+     * pairs with a trace of at least cutoff, and not to the size of the q-table.
+     * SARSA(lambda) backs up the q-value of the action which is performed next, Watkins's
+     * Q(lambda) the maximum q-value, and it drops all traces when the next action is not
+     * a greedy one. updateAndGetActions() and updateFromTransition() always do one-step backups.
+     * \param method the backups to do
+     * \param _lambda trace decay parameter 0..1. 0 is the same as one-step learning.
+     * \param cutoff traces below this value are dropped
+     */
+    void setEligibilityTraces(TraceMethod method, float _lambda, float cutoff = 0.01)
+    {
+        traceMethod = method;
+        lambda = _lambda;
+        traceCutoff = cutoff;
+        traces.clear();
+    }
+
+    TraceMethod getTraceMethod() const
+    {
+        return traceMethod;
+    }
+
+    /**
+     * Switches on or off learning the transition function from the experienced transitions.
+     * The learned transition function is kept when switched off, and extended
+     * when switched on again. Not possible with NoTransitionModel.
+     */
+    void setLearnTransition(bool on)
+    {
+        model.setLearning(on);
+    }
+
+    /**
+     * \return the learned transition function, or NULL if it has never been learned
+     */
+    std::shared_ptr<const LearnableTransitionMapT> getLearnedTransition() const
+    {
+        return model.getLearnedTransition();
+    }
+
+    /**
+     * Switches on Dyna-Q planning: after each step of updateAndGetAction(), numSteps
+     * simulated one-step backups are done. Each one picks a random state-action pair
+     * which has been experienced so far, samples the successor state from the learned
+     * transition function, and updates the q-value as for a real transition, with the
+     * reward of the domain. This switches on learning the transition function, so it
+     * is not possible with NoTransitionModel.
+     * \param numSteps number of simulated backups after each real step, 0 to switch planning off
+     * \param budget if not zero, the simulated backups after a step stop when this time has elapsed
+     */
+    void setPlanning(unsigned int numSteps, std::chrono::microseconds budget = std::chrono::microseconds(0))
+    {
+        if ((numSteps > 0) && !TransitionModelT::CanLearn)
+        {
+            PRINTERROR("The controller has been compiled without a transition model, can't plan");
+            return;
+        }
+        planningSteps = numSteps;
+        planningBudget = budget;
+        if (numSteps > 0) setLearnTransition(true);
     }
 
     virtual int finishedLearning()const
@@ -192,272 +407,358 @@ public:
 
     virtual void printValues(std::ostream& o) const
     {
-#ifdef LEARN_TRANSITION
-        o << "## Learned transition: " << std::endl;
-        learnedTransition->print(o);
-#endif
+        if (learnsTransition())
+        {
+            o << "## Learned transition: " << std::endl;
+            model.print(o);
+        }
+        // print the states in their order, not in the order they were inserted in the table
+        std::vector<QEntryT> entries = getSortedEntries();
         std::stringstream strng;
         strng << "## Trials: " << std::endl;
-        NSA_const_iterator nit;
-        for (nit = nsaFreq.begin(); nit != nsaFreq.end(); ++nit)
+        for (size_t i = 0; i < entries.size(); ++i)
         {
-            strng << nit->first << " : " << nit->second << std::endl;
+            for (QSlotT slot = 0; slot < q.numActions(); ++slot)
+            {
+                FreqCntT cnt = q.getCount(entries[i], slot);
+                if (cnt == 0) continue;
+                strng << q.getState(entries[i]) << " / " << q.getAction(slot) << " : " << cnt << std::endl;
+            }
         }
 
         strng << "## Q-Table: " << std::endl;
         printQValues(strng);
 
         strng << std::endl << "## Current policy:" << std::endl;
-        PolicyPtrT policy = getLearnedPolicy();
-        policy->print(strng);
+        getPolicy()->print(strng);
         o << strng.str() << std::endl;
     }
 
 
     /**
-     * Returns the learned policy from applying the q-learning algorithm
+     * Returns the learned policy from applying the q-learning algorithm. Unlike getPolicy(),
+     * this builds a new policy from the whole q-table.
      */
     PolicyPtrT getLearnedPolicy() const
     {
-        PolicyPtrT retPolicy(new LookupPolicyT());
-        QMap_const_iterator it;
+        PolicyPtrT retPolicy = makePolicy();
         // for each state entry in the q-table, find the best associated action
-        for (it = q.begin(); it != q.end(); ++it)
+        for (QEntryT e = 0; e < q.size(); ++e)
         {
-            const ActionValueSetT& setRef = it->second; // keep a reference for better code readability
-            if (setRef.empty())  // the set should NOT be empty!
-            {
-                PRINTERROR("No actions were assigned it state " << it->first << ". This is an inconsistency.");
-                continue;
-            }
-            ActionValuePairT bestActionForState = getMaxQValue(setRef);
-
+            QSlotT best = q.getBestSlot(e);
+            // the state was visited, but no q-value assigned because the learning rate was down
+            if (best == static_cast<QSlotT>(QTableT::NoSlot)) continue;
             // last parameter of bestAction(), confidence, is irrelevant for LookupP
-            retPolicy->bestAction(it->first, bestActionForState.a, bestActionForState.v, 1.0);
+            retPolicy->bestAction(q.getState(e), q.getAction(best), q.getValue(e, best), 1.0);
         }
         return retPolicy;
     }
 
-    virtual void printStats(std::ostream& o) const
+    /**
+     * Selects which statistics of the q-value changes are kept from now on, and resets them.
+     * By default, the average of the last 10000 changes is kept. Has no effect
+     * with NoChangeStatistics.
+     * \param kinds combination of ChangeStatistics::Kind flags, ChangeStatistics::None to keep none
+     * \param windowSize number of last changes averaged for ChangeStatistics::Window
+     * \param alpha weight of a new change for ChangeStatistics::MovingAverage
+     */
+    void setChangeStatistics(unsigned int kinds, unsigned int windowSize = 10000, double alpha = 0.001)
     {
-        o << "size of q-table: " << q.size();
-#ifdef KEEP_AVG_CHANGE
-        o << " average q-change in the last " << KEEP_AVG_CHANGE << " updates: " << getAvgChange();
-#endif
+        changeStats = ChangeStatisticsT(kinds, windowSize, alpha);
     }
 
-protected:
-    typedef ActionValuePair<ActionT, UtilityDataTypeT> ActionValuePairT;
-    typedef std::set<ActionValuePairT> ActionValueSetT;
-    typedef LookupPolicy<StateT, ActionT> LookupPolicyT;
-
-    typedef std::map<StateT, ActionValueSetT> QMap;
-    typedef typename QMap::iterator QMap_iterator;
-    typedef typename QMap::const_iterator QMap_const_iterator;
-
+    const ChangeStatisticsT& getChangeStatistics() const
+    {
+        return changeStats;
+    }
 
+    virtual void printStats(std::ostream& o) const
+    {
+        o << "size of q-table: " << q.size();
+        changeStats.print(o);
+    }
 
     /**
-     * Finds the action with the maximum expected utility, that is, finds
-     * argmax_over_a{ expl(Q[s,a],freq[s,a]) } where expl is the exploration function,
-     * and freq is the frequency of action a tried from state s.
-     *
-     * Only X percent of the time, this maximum action is NOT found, but instead a random
-     * action is returned (where X = QLearningController::epsilonGreedy), thereby adding an epsilon-greedy
-     * strategy.
-     *
-     * IMPORTANT: This class should only be used internally, while the qlearning object
-     * passed in constructor is valid and unchanged
+     * Saves the q-values and visit counts to a binary checkpoint (see CheckpointHeader),
+     * with one row per q-table entry, in the order of the entries, and the states
+     * identified by the StateIndexer of the domain.
+     * The first save to a path writes the whole q-table, leaving room for as many entries
+     * again. The file is then kept open, and the following saves to the same path only
+     * write the entries which have been added or changed since the last save, and the ones
+     * of the save before, to the side of the file which is not in use (see CheckpointWriter).
+     * When the room is used up, the whole q-table is written again.
+     * The learned transition function is not saved.
+     * \return false if the domain has no state indexer, or the file could not be written
      */
-    class MaxExpectedUtility: public ActionAlgorithm<ActionT>
+    bool saveCheckpoint(const std::string& path)
     {
-    public:
-        /**
-         * \param _qlearn the QLearningController object. Reference is kept internally!
-         * \param _s the state from which the optimal action will be chosen
-         */
-        explicit MaxExpectedUtility(const QLearningControllerT& _qlearn, const StateT& _s):
-            qlearn(_qlearn), qit(qlearn.getQEntry(_s)), s(_s), applied(false)
-        {
-
-            // generate a random number [0..1] to see whether we should try the best
-            // action, or rather a random action.
-            float rdm = static_cast<float>(RAND_MAX - RandomNumberGenerator::random()) / static_cast<float>(RAND_MAX);
-            if (rdm >= qlearn.epsilonGreedy)
+        StateIndexerConstPtrT indexer = this->domain->getStateIndexer();
+        if (!indexer.get())
+        {
+            PRINTERROR("Checkpoints need a state indexer of the domain");
+            return false;
+        }
+        bool ok = true;
+        if (!checkpoint.get() || (checkpoint->getPath() != path) || (q.size() > checkpoint->getHeader().capacity))
+        {
+            checkpoint.reset(new CheckpointWriter());
+            uint64_t capacity = std::max(2 * static_cast<uint64_t>(q.size()), static_cast<uint64_t>(MinCheckpointCapacity));
+            CheckpointHeader header = CheckpointHeader::make(CheckpointHeader::QValues, sizeof(UtilityDataTypeT),
+                                      sizeof(FreqCntT), q.numActions(), indexer->size(), capacity, defaultQ,
+                                      this->domain->getActionIndexer().get() ? CheckpointHeader::ActionIndexerIds
+                                      : CheckpointHeader::SortedActions);
+            ok = checkpoint->create(path, header);
+            std::vector<uint32_t> index(indexer->size(), static_cast<uint32_t>(CheckpointHeader::NoRow));
+            for (QEntryT e = 0; ok && (e < q.size()); e += CheckpointChunk)
             {
-                returnBest = true;
+                ok = writeCheckpointRows(*indexer, e, std::min(q.size() - e, static_cast<QEntryT>(CheckpointChunk)), &index);
             }
-            else
+            ok = ok && checkpoint->writeIndex(index.empty() ? NULL : &index[0]);
+        }
+        else
+        {
+            // write the changed entries in runs of consecutive entries
+            std::vector<QEntryT> dirty = q.getDirtyEntries();
+            std::sort(dirty.begin(), dirty.end());
+            for (size_t i = 0; ok && (i < dirty.size()); )
             {
-                // PRINTMSG("Return RANDOM");
-                returnBest = false;
-                ActionT a = qlearn.actionGenerator->randomAction(); // generate random action
-                UtilityDataTypeT actionUtility = qlearn.defaultQ;
-                // find q-entry for this action:
-                qlearn.getQValue(qit, a, actionUtility); 
-                // if no q-value exists yet, actionUtility will remain unchanged
-                maxAction = ActionValuePairT(a, actionUtility);
+                size_t j = i + 1;
+                while ((j < dirty.size()) && (dirty[j] == dirty[j - 1] + 1) && (j - i < CheckpointChunk)) ++j;
+                ok = writeCheckpointRows(*indexer, dirty[i], j - i, NULL);
+                i = j;
             }
+            // the rows of the new entries
+            for (QEntryT e = checkpointRows; ok && (e < q.size()); ++e)
+            {
+                ok = checkpoint->writeIndex(indexer->toIndex(q.getState(e)), e);
+            }
+        }
+        if (!ok || !checkpoint->commit(q.size()))
+        {
+            checkpoint.reset();  // the next save writes everything again
+            return false;
+        }
+        checkpointRows = q.size();
+        if (q.isTrackingDirty()) q.clearDirty();
+        else q.setTrackDirty(true);
+        return true;
+    }
 
+    /**
+     * Replaces the q-table by the one in a checkpoint saved with saveCheckpoint(), for a
+     * domain with the same actions and state indexer. The checkpoint is mapped into
+     * memory and copied into the q-table. To answer queries directly from a mapped
+     * checkpoint instead, see CheckpointPolicy.
+     * The learned transition function, the eligibility traces and the last steps of the online
+     * learning are reset, and the next saveCheckpoint() writes the whole q-table.
+     * \return false if the checkpoint could not be opened or does not fit, in which
+     *      case the q-table is unchanged
+     */
+    bool loadCheckpoint(const std::string& path)
+    {
+        StateIndexerConstPtrT indexer = this->domain->getStateIndexer();
+        if (!indexer.get())
+        {
+            PRINTERROR("Checkpoints need a state indexer of the domain");
+            return false;
+        }
+        CheckpointFile file;
+        if (!file.open(path)) return false;
+        if (!file.check(CheckpointHeader::QValues, sizeof(UtilityDataTypeT), sizeof(FreqCntT),
+                        q.numActions(), indexer->size()))
+        {
+            return false;
+        }
+        uint32_t order = this->domain->getActionIndexer().get() ? CheckpointHeader::ActionIndexerIds
+                         : CheckpointHeader::SortedActions;
+        if (file.getHeader().columnOrder != order)
+        {
+            PRINTERROR("The q-values of the checkpoint " << path << " are in a different order of the actions");
+            return false;
         }
-        virtual ~MaxExpectedUtility() {}
 
-        virtual bool apply(const ActionT& a)
+        // read again if a writer has committed in the meantime. The rows are read into a
+        // table of their own, so that q is only replaced with a consistent checkpoint.
+        QTableT loaded(collectActions(this->domain), this->domain->getActionIndexer(), defaultQ);
+        uint64_t numRows, g;
+        do
         {
-            if (!returnBest)
+            g = file.getGeneration();
+            numRows = file.numRows(g);
+            const uint32_t * ids = file.getRowIds(g);
+            for (uint64_t r = 0; r < numRows; ++r)
             {
-                if (!applied) applied = true;
-                return true; // we don't have to explore, because a random action is to be returned
+                if (ids[r] >= indexer->size())
+                {
+                    PRINTERROR("The checkpoint " << path << " has the state id " << ids[r] << " out of range");
+                    return false;
+                }
             }
 
-            UtilityDataTypeT actionUtility = qlearn.defaultQ;
-            // find q-entry:
-            qlearn.getQValue(qit, a, actionUtility); // if no q-value exists yet, actionUtility will remain unchanged
-            // get freqency of action a tried from state s
-            FreqCntT freq = qlearn.getFrequency(s, a);
-            // get estimated reward determined by exploration function
-            UtilityDataTypeT ut = qlearn.exploration->getEstimatedReward(actionUtility, freq);
-            // PRINTMSG("Checking action "<<a<<" for state "<<s<<", yields in utility "<<ut);
-            if (!applied)  // first action: this will be the best found so far
-            {
-                maxAction.a = a;
-                maxAction.v = ut;
-                applied = true;
-                return true;
-            }
-            if (ut > maxAction.v)
+            loaded.clear();
+            QSlotT numSlots = loaded.numActions();
+            const UtilityDataTypeT * values = file.getValues<UtilityDataTypeT>(g);
+            const FreqCntT * counts = file.getCounts<FreqCntT>(g);
+            const uint8_t * flags = file.getFlags(g);
+            for (uint64_t r = 0; r < numRows; ++r)
             {
-                maxAction.a = a;
-                maxAction.v = ut;
+                QEntryT e = loaded.insert(indexer->fromIndex(ids[r]));
+                size_t cell = static_cast<size_t>(r) * numSlots;
+                for (QSlotT slot = 0; slot < numSlots; ++slot)
+                {
+                    if (flags[cell + slot]) loaded.setQValue(e, slot, values[cell + slot]);
+                    if (counts[cell + slot] > 0) loaded.setCount(e, slot, counts[cell + slot]);
+                }
             }
-            return true;
-        }
-        // returns false if no max action was found (i.e. no actions were generated).
-        // then, getBestAction() will return an undefined action.
-        bool hasResult()
-        {
-            return applied;
         }
-        /**
-         * Returns the action found with the best utility, given the set exploration function.
-         * In addition to the exploration funciton, a random action is chosen X percent of
-         * the time instead of the best action found, witch probability QLearningController::epsilonGreedy
-         * (epsilon-greedy exploration)
-         *
-         * See also hasResult()
-         */
-        ActionValuePairT getBestAction()
-        {
-            return maxAction;
+        while (!file.isCurrent(g));
+        if (loaded.size() != numRows) PRINTMSG("WARNING: The checkpoint " << path << " has duplicate states");
+
+        checkpoint.reset();
+        q.swap(loaded);
+        policy.reset();
+        changedEntries.clear();
+        entryChanged.clear();
+        publishPolicy();
+        last.valid = false;
+        lanes.clear();
+        traces.clear();
+        model.clear();
+        return true;
+    }
 
-        }
-    private:
-        MaxExpectedUtility() {}
-        // the assigned exploration function for trying new actions from particular states
-        const QLearningControllerT& qlearn;
-        QMap_const_iterator qit; // iterator pointing to the q-table entry for state s
-        StateT s;
-        ActionValuePairT maxAction;
-        bool applied;
-        // set to true if the best action has to be found. If set to false,
-        // always a random action is returned.
-        bool returnBest;
+protected:
+    typedef QTable<StateT, ActionT, UtilityDataTypeT, FreqCntT> QTableT;
+    typedef typename QTableT::ActionValuePairT ActionValuePairT;
+    typedef typename QTableT::EntryT QEntryT;
+    typedef typename QTableT::SlotT QSlotT;
+    typedef typename DomainT::ActionIndexerConstPtrT ActionIndexerConstPtrT;
+    typedef typename DomainT::StateIndexerConstPtrT StateIndexerConstPtrT;
+    typedef EligibilityTraces<QEntryT, QSlotT, UtilityDataTypeT> EligibilityTracesT;
+    typedef LookupPolicy<StateT, ActionT> LookupPolicyT;
+    typedef ChunkedPolicy<StateT, ActionT> ChunkedPolicyT;
+
+    /**
+     * The state, action and reward of the last update step. They are kept by
+     * value and overwritten in each step, so that a step does not allocate memory.
+     */
+    struct StepContext
+    {
+        StepContext(): reward(0), valid(false) {}
+        StateT state;  // state in the last update step
+        ActionT action;  // last action performed
+        RewardValueTypeT reward;  // experienced reward in the last update step
+        bool valid;  // false if there is no last state, e.g. after a terminal state was reached
     };
 
 
+
     /**
-     * Finds the action with the maximum associated q-value, that is, finds
-     * max_over_a(Q[s,a]). If the best action found so far is not in the q-table yet,
-     * isNewAction() will return true, and getMaxAction() will then return an action with
-     * defaultQ as utility. This will be an action which has been tried and was not in
-     * the q-table yet, when defaultQ was higher than all utilities assigned to other actions
-     * from this state.
-     *
-     * IMPORTANT: This class should only be used internally, while the qlearning object
-     * passed in constructor is valid and unchanged
+     * Collects the actions generated by an ActionGenerator
      */
-    class MaxQValue: public ActionAlgorithm<ActionT>
+    class ActionCollector: public ActionAlgorithm<ActionT>
     {
     public:
-        /**
-         * \param _qlearn the QLearningController object. Reference is kept internally!
-         * \param _s the state from which the optimal action will be chosen
-         */
-        explicit MaxQValue(const QLearningControllerT& _qlearn, const StateT& _s):
-            qlearn(_qlearn), qit(qlearn.getQEntry(_s)), applied(false), isNew(false) {}
-        virtual ~MaxQValue() {}
-
+        explicit ActionCollector(std::vector<ActionT>& _actions): actions(_actions) {}
+        virtual ~ActionCollector() {}
         virtual bool apply(const ActionT& a)
         {
-            UtilityDataTypeT actionUtility = qlearn.defaultQ;
-
-            // if getQValue returns false, no such action is in the q-table yet,
-            // and actionUtility will remain unchanged
-            bool newAction = !qlearn.getQValue(qit, a, actionUtility);
-
-            // PRINTMSG("Checking action "<<a<<" for state "<<s<<", yields in utility "<<ut);
-            if (!applied)  // first action tried: This will be the best action found so far
-            {
-                maxAction.a = a;
-                maxAction.v = actionUtility;
-                isNew = newAction;
-                applied = true;
-                return true;
-            }
-            if (actionUtility > maxAction.v)
-            {
-                maxAction.a = a;
-                maxAction.v = actionUtility;
-                isNew = newAction;
-            }
+            actions.push_back(a);
             return true;
         }
-        // returns false if no max action was found (i.e. no actions were generated).
-        // then, getMaxEntry() will return an undefined action.
-        bool hasResult()
+    private:
+        std::vector<ActionT>& actions;
+    };
+
+    /**
+     * Returns all actions of the domain, in the order of the ids of its action
+     * indexer if it has one, otherwise in the order of the action generator.
+     */
+    static std::vector<ActionT> collectActions(const DomainConstPtrT& domain)
+    {
+        std::vector<ActionT> actions;
+        ActionIndexerConstPtrT indexer = domain->getActionIndexer();
+        if (indexer.get())
         {
-            return applied;
+            for (unsigned int i = 0; i < indexer->size(); ++i) actions.push_back(indexer->fromIndex(i));
+            return actions;
         }
-        bool isNewAction()
+        ActionCollector collector(actions);
+        if (!domain->getActionGenerator()->foreachAction(collector))
         {
-            return isNew;
+            PRINTERROR("Could not enumerate all actions");
         }
-        // see also hasResult()
-        ActionValuePairT getMaxEntry()
+        return actions;
+    }
+
+    /**
+     * Finds the action with the maximum expected utility, that is, finds
+     * argmax_over_a{ expl(Q[s,a],freq[s,a]) } where expl is the exploration function,
+     * and freq is the frequency of action a tried from state s. The actions are tried
+     * in the order of the action generator, and the first of equal utilities is chosen.
+     *
+     * Only X percent of the time, this maximum action is NOT found, but instead a random
+     * action is returned (where X = QLearningController::epsilonGreedy), thereby adding an epsilon-greedy
+     * strategy.
+     *
+     * \return false if no actions are generated for the domain, in which case action is undefined.
+     */
+    bool getMaxExpectedUtilityAction(const StateT& s, ActionT& action) const
+    {
+        QEntryT qit = getQEntry(s);
+
+        // generate a random number [0..1] to see whether we should try the best
+        // action, or rather a random action.
+        float rdm = 1.0f - RandomNumberGenerator::engine(rng).uniform();
+        if (rdm < epsilonGreedy)
         {
-            return maxAction;
+            action = actionGenerator->randomAction(); // generate random action
+            return !generatorOrder.empty();
         }
-    private:
-        MaxQValue() {}
-        // the assigned exploration function for trying new actions from particular states
-        const QLearningControllerT& qlearn;
-        QMap_const_iterator qit; // iterator pointing to the q-table entry for state s
-        ActionValuePairT maxAction;
-        bool applied;
-        bool isNew;
-    };
-
 
+        QSlotT bestSlot = static_cast<QSlotT>(QTableT::NoSlot);
+        UtilityDataTypeT bestUt = defaultQ;
+        for (size_t i = 0; i < generatorOrder.size(); ++i)
+        {
+            QSlotT slot = generatorOrder[i];
+            // if no q-value exists yet, this is the default q value
+            UtilityDataTypeT actionUtility = (qit == static_cast<QEntryT>(QTableT::NoEntry)) ? defaultQ : q.getValue(qit, slot);
+            // get freqency of action a tried from state s, kept in the same record
+            FreqCntT freq = q.getCount(qit, slot);
+            // get estimated reward determined by exploration function
+            UtilityDataTypeT ut = exploration->getEstimatedReward(actionUtility, freq);
+            if ((i == 0) || (ut > bestUt))
+            {
+                bestSlot = slot;
+                bestUt = ut;
+            }
+        }
+        if (bestSlot == static_cast<QSlotT>(QTableT::NoSlot)) return false;
+        action = q.getAction(bestSlot);
+        return true;
+    }
 
 
     /**
      */
     virtual bool learnOnline(const StateT& currentState)
     {
-        if (!this->domain->getReward().get())
+        if (!reward.get())
         {
             PRINTERROR("Need reward function to update q-table");
             return false;
         }
-        float currReward = this->domain->getReward()->getReward(currentState);
+        float currReward = reward->getReward(currentState);
         // PRINTMSG("Reward "<<currReward<<" for "<<currentState);
-        update(currentState, currReward);
+        if (traceMethod == OneStep) update(currentState, currReward);
+        else updateWithTraces(currentState, currReward);
+        if (TransitionModelT::CanLearn && (planningSteps > 0)) plan();
         return true;
     }
 
     virtual ActionT getBestAction(const StateT& currentState)const
     {
-        return lastAction;
+        return last.action;
     }
 
     virtual bool initializeImpl(const StateT& startState)
@@ -469,68 +770,236 @@ protected:
 
     ActionT update(const StateT& s, const RewardValueTypeT& reward)
     {
-        if (lastState.get())
+        return update(last, s, reward);
+    }
+
+    /**
+     * Updates the q-table for reaching state s with the given reward, after the step
+     * kept in ctx, and chooses the next action, which is kept in ctx along with s.
+     */
+    ActionT update(StepContext& ctx, const StateT& s, const RewardValueTypeT& reward)
+    {
+        if (ctx.valid)
         {
-#ifdef LEARN_TRANSITION
-            // PRINTMSG("Experience "<<*lastState<<" -> "<<s);
-            learnedTransition->experienceTransition(*lastState, lastAction, s);
-#endif
-            updateFreqAndQTable(s, reward);
+            // PRINTMSG("Experience "<<ctx.state<<" -> "<<s);
+            if (learnsTransition()) experienceTransition(ctx.state, ctx.action, s);
+            updateFreqAndQTable(ctx, s, reward);
         }
         if (this->domain->isTerminalState(s))
         {
             // PRINTMSG("  ####### Reached terminal state. Recommend old action " <<
-            //    lastAction << ". Current reward: "<<reward);
-            lastState = NULL;
-            lastReward = 0.0;
+            //    ctx.action << ". Current reward: "<<reward);
+            ctx.valid = false;
+            ctx.reward = 0.0;
         }
         else
         {
-            MaxExpectedUtility mUt(*this, s);
-            actionGenerator->foreachAction(mUt);
-            if (mUt.hasResult())
+            ActionT bestAction;
+            if (getMaxExpectedUtilityAction(s, bestAction))
             {
-                lastAction = mUt.getBestAction().a;
-                // PRINTMSG("   Maximum expected utility for "<<s<<": "<<lastAction);
-                lastState = StatePtrT(new StateT(s)); // XXX possibly debug after changes on 25/10/15
-                lastReward = reward;
+                ctx.action = bestAction;
+                // PRINTMSG("   Maximum expected utility for "<<s<<": "<<ctx.action);
+                ctx.state = s; // copied into the existing object, no allocation
+                ctx.reward = reward;
+                ctx.valid = true;
             }
             else
             {
                 PRINTMSG("WARNING: No actions were applied on the state " << 
                     s << ", this will reset the Q-learning algorithm. Is it a bug?");
-                lastState = NULL;
+                ctx.valid = false;
             }
         }
-        return lastAction;
+        return ctx.action;
+    }
+
+
+
+
+
+    /**
+     * Learns the transition from s1 with action a to s2, and adds (s1, a) to the
+     * state-action pairs used for planning.
+     */
+    void experienceTransition(const StateT& s1, const ActionT& a, const StateT& s2)
+    {
+        QSlotT slot = q.getSlot(a);
+        if (slot == static_cast<QSlotT>(QTableT::NoSlot)) return;
+        model.experience(s1, a, s2, q.insert(s1), slot, q.numActions());
+    }
+
+    /**
+     * Whether the transition function is learned. Always false with NoTransitionModel,
+     * which lets the compiler remove the model learning.
+     */
+    bool learnsTransition() const
+    {
+        return TransitionModelT::CanLearn && model.isLearning();
+    }
+
+    /**
+     * Performs the simulated backups of Dyna-Q planning, see setPlanning()
+     */
+    void plan()
+    {
+        if (model.numPairs() == 0) return;
+        RandomNumberGenerator::EngineT& r = RandomNumberGenerator::engine(rng);
+        bool useBudget = (planningBudget.count() > 0);
+        std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + planningBudget;
+        for (unsigned int i = 0; i < planningSteps; ++i)
+        {
+            if (useBudget && (std::chrono::steady_clock::now() >= deadline)) break;
+            const typename TransitionModelT::PairT& pair = model.getPair(r.below(model.numPairs()));
+            const StateT& s = q.getState(pair.first);
+            // pick the successor according to the learned probabilities
+            float pRange = r.uniform();
+            if (!model.sampleSuccessor(s, q.getAction(pair.second), pRange, planned)) continue;
+
+            RewardValueTypeT lastReward = RewardUpdateT::UseLastReward ? reward->getReward(s) : 0;
+            // use the learning rate of the real experience, the simulated one does not count as a trial
+            FreqCntT numTried = q.getCount(pair.first, pair.second);
+            if (numTried > 0) --numTried;
+            updateQValue(pair.first, pair.second, learnRate->get(numTried), lastReward, planned, reward->getReward(planned));
+        }
     }
 
+    /**
+     * Same as update() for the online learning, but with the backups of
+     * eligibility traces as selected with setEligibilityTraces().
+     */
+    ActionT updateWithTraces(const StateT& s, const RewardValueTypeT& reward)
+    {
+        bool terminal = this->domain->isTerminalState(s);
+        // the next action is needed for the backup of SARSA(lambda), and for Watkins's
+        // Q(lambda) to know whether it is a greedy one, so it is chosen first.
+        ActionT nextAction;
+        bool haveNext = !terminal && getMaxExpectedUtilityAction(s, nextAction);
+        if (last.valid)
+        {
+            if (learnsTransition()) experienceTransition(last.state, last.action, s);
+            backupTraces(s, reward, terminal, haveNext ? q.getSlot(nextAction) : static_cast<QSlotT>(QTableT::NoSlot));
+        }
+        if (terminal || !haveNext)
+        {
+            if (!terminal)
+            {
+                PRINTMSG("WARNING: No actions were applied on the state " <<
+                    s << ", this will reset the Q-learning algorithm. Is it a bug?");
+            }
+            // the episode ends here
+            traces.clear();
+            last.valid = false;
+            last.reward = 0.0;
+            return last.action;
+        }
+        last.action = nextAction;
+        last.state = s;
+        last.reward = reward;
+        last.valid = true;
+        return last.action;
+    }
 
+    /**
+     * helper function for updateWithTraces(): reached state s with the given reward
+     * after the last state and action, and nextSlot will be performed next. Updates the
+     * q-values of all pairs with a trace by the error of the q-value of the last state
+     * and action.
+     */
+    void backupTraces(const StateT& s, const RewardValueTypeT& reward, bool terminal, QSlotT nextSlot)
+    {
+        QSlotT slot = q.getSlot(last.action);
+        if (slot == static_cast<QSlotT>(QTableT::NoSlot))
+        {
+            PRINTERROR("Action " << last.action << " has no entry in the q-table");
+            return;
+        }
+        QEntryT qit = q.insert(last.state);
+        q.incrementCount(qit, slot);
 
+        UtilityDataTypeT nextUtility = 0.0;
+        bool greedy = true;
+        if (terminal)
+        {
+            if (RewardUpdateT::UseLastReward) nextUtility = reward;
+        }
+        else
+        {
+            QEntryT next = getQEntry(s);
+            UtilityDataTypeT maxUtility = q.getMaxValue(next);
+            UtilityDataTypeT nextQ = defaultQ;
+            if (nextSlot != static_cast<QSlotT>(QTableT::NoSlot)) q.getQValue(next, nextSlot, nextQ);
+            greedy = !(nextQ < maxUtility);
+            nextUtility = (traceMethod == SarsaLambda) ? nextQ : maxUtility;
+        }
+        RewardValueTypeT updateReward = RewardUpdateT::UseLastReward ? last.reward : reward;
+        UtilityDataTypeT lastQ = defaultQ;
+        q.getQValue(qit, slot, lastQ);
+        UtilityDataTypeT tdError = updateReward + discount * nextUtility - lastQ;
 
+        traces.set(qit, slot, 1.0);
+        for (size_t i = 0; i < traces.size(); ++i)
+        {
+            const typename EligibilityTracesT::Trace& t = traces[i];
+            // each pair is updated with its own learning rate
+            double adaptedLearnRate = learnRate->get(q.getCount(t.entry, t.slot) - 1);
+            if (adaptedLearnRate < std::numeric_limits<float>::epsilon()) adaptedLearnRate = 0;
+            UtilityDataTypeT qDiff = adaptedLearnRate * tdError * t.value;
+            if ((t.entry == qit) && (t.slot == slot)) changeStats.add(qDiff);
+            if (adaptedLearnRate == 0) continue;  // no learning any more for this pair
+            UtilityDataTypeT oldQ = defaultQ;
+            q.getQValue(t.entry, t.slot, oldQ);
+            setQValue(t.entry, t.slot, oldQ + qDiff);
+        }
+        if ((traceMethod == WatkinsQLambda) && !greedy) traces.clear();
+        else traces.decay(discount * lambda, traceCutoff);
+    }
 
     /**
-     * helper function to update the frequency table and the q-values table for the current state s.
+     * helper function to update the frequency and the q-value of the last state and action
+     * in ctx, which are kept in the same q-table record, for the current state s.
      */
-    void updateFreqAndQTable(const StateT& s, const RewardValueTypeT& reward)
+    void updateFreqAndQTable(const StepContext& ctx, const StateT& s, const RewardValueTypeT& reward)
     {
-        if (!lastState.get())
+        if (!ctx.valid)
         {
-            throw Exception("invalid lastState pointer!", __FILE__, __LINE__);
+            throw Exception("there is no last state!", __FILE__, __LINE__);
         }
-        // update the frequencies map and the q-value.
-        std::pair<NSA_iterator, bool> it = nsaFreq.insert(std::make_pair(StateActionPairT(*lastState, lastAction), 1));
-        if (!it.second)  // Inserting was not successful, so the entry exists already. Update it.
+        updateFreqAndQValue(ctx.state, ctx.action, ctx.reward, s, reward);
+    }
+
+    /**
+     * helper function to update the frequency and the q-value of state lastState and action
+     * lastAction, after which state s was reached with the reward reward. lastReward is
+     * the reward which was received in lastState.
+     */
+    void updateFreqAndQValue(const StateT& lastState, const ActionT& lastAction,
+                             const RewardValueTypeT& lastReward, const StateT& s, const RewardValueTypeT& reward)
+    {
+        QSlotT slot = q.getSlot(lastAction);
+        if (slot == static_cast<QSlotT>(QTableT::NoSlot))
         {
-            it.first->second = it.first->second + 1;
+            PRINTERROR("Action " << lastAction << " has no entry in the q-table");
+            return;
         }
-        unsigned int numTried = it.first->second - 1; // will be at least 0 (this trial does not count yet)
-        double adaptedLearnRate = learnRate->get(numTried);
+        // insert the state. If it exists already, we'll get the existing entry.
+        QEntryT qit = q.insert(lastState);
+
+        // update the frequency and the q-value.
+        unsigned int numTried = q.incrementCount(qit, slot) - 1; // will be at least 0 (this trial does not count yet)
+        updateQValue(qit, slot, learnRate->get(numTried), lastReward, s, reward);
+    }
+
+    /**
+     * helper function to update the q-value of the q-table entry qit and slot with the learning
+     * rate adaptedLearnRate, after which state s was reached with the reward reward. lastReward is
+     * the reward which was received in the state of qit.
+     */
+    void updateQValue(QEntryT qit, QSlotT slot, double adaptedLearnRate,
+                      const RewardValueTypeT& lastReward, const StateT& s, const RewardValueTypeT& reward)
+    {
         if (adaptedLearnRate < std::numeric_limits<float>::epsilon())
         {
-#ifdef KEEP_AVG_CHANGE
-            updateAverage(0.0);
-#endif
+            changeStats.add(0.0);
             return; // no learning any more, as learning rate is down
         }
 
@@ -542,21 +1011,23 @@ protected:
         if (this->domain->isTerminalState(s))  
         {
             // we are at a terminal state. From here, we won't have any transitions from any actions
-#ifdef UPDATE_WITH_OLD_REWARD
-            // we have to pass on the current reward for the update of the old q-value
-            bestActionUtility = reward; 
-#else
-            // since we use the current reward (terminal) for update, we won't need more future rewards
-            bestActionUtility = 0.0; 
-#endif
+            if (RewardUpdateT::UseLastReward)
+            {
+                // we have to pass on the current reward for the update of the old q-value
+                bestActionUtility = reward;
+            }
+            else
+            {
+                // since we use the current reward (terminal) for update, we won't need more future rewards
+                bestActionUtility = 0.0;
+            }
         }
         else
         {
-            MaxQValue mQ(*this, s); // will calculate max_over_a(Qtable[s,a])
-            actionGenerator->foreachAction(mQ);
-            if (mQ.hasResult())
+            if (!generatorOrder.empty())
             {
-                bestActionUtility = mQ.getMaxEntry().v;
+                // max_over_a(Qtable[s,a]), where actions not in the q-table yet have the default q value
+                bestActionUtility = q.getMaxValue(getQEntry(s));
             }
             else
             {
@@ -565,37 +1036,15 @@ protected:
         }
         // PRINTMSG(" | Maximum expected utility for "<<s<<": "<<bestAction);
 
-#ifdef UPDATE_WITH_OLD_REWARD
-        RewardValueTypeT updateReward = lastReward;
-#else
-        RewardValueTypeT updateReward = reward;
-#endif
+        RewardValueTypeT updateReward = RewardUpdateT::UseLastReward ? lastReward : reward;
         UtilityDataTypeT expectedDiscountedReward = updateReward + discount * bestActionUtility;
 
         // --- step 2: weigh the old value against the expected discounted reward by the learning rate
         // q(lastState,lastAction) = (1-learnRate)*q(lastState,lastAction) + learnRate*expectedDiscountedReward;
 
         // now, retrieve and update the value in the q-table Q[lastState, lastAction]
-        // first, try to insert an empty value. If this fails, we'll have the iterator to the existing value at least.
-        std::pair<QMap_iterator, bool> qitI = q.insert(std::make_pair(*lastState, ActionValueSetT()));
-        ActionValueSetT& setRef = qitI.first->second; // For code readability, we'll keep a reference to the action set
-
         UtilityDataTypeT lastQ = defaultQ; // if no q[lastState,lastAction] exist, we'll assume default q value
-        typename ActionValueSetT::iterator setIt = setRef.end();
-        if (!qitI.second)   // q-values exist for lastState, so try to find lastAction as well in the set
-        {
-            setIt = setRef.find(ActionValuePairT(lastAction, 0));
-        }
-        if (setIt != setRef.end()) // lastState/lastAction had value assigned
-        {
-            lastQ = setIt->v;
-            /* We have to erase this entry because ActionValuePairT is a key and thus
-             * the iterators are const. The values can't be changed. Even if only the action has a key
-             * function and basically we could change the value. We could add a const method to
-             * ActionValuePair which changes only v (havnig no effect on the key) but this is dodgey, so for
-             * now we'll keep the more unefficient way of replacing the set entry altogether */
-            setRef.erase(setIt);
-        }
+        q.getQValue(qit, slot, lastQ);
 
         /*if ((numTried>100000) && (fabs(bestActionUtility+reward-lastQ) > 0.1)) {
             PRINTMSG("Strange, we still get quite a big change: "<<(bestActionUtility+reward-lastQ)<<" tried="<<numTried<<", "<<s);
@@ -609,19 +1058,14 @@ protected:
         // b) simpler version as in Mitchell:
         // UtilityDataTypeT newQ=expectedDiscountedReward;
 
-#ifdef KEEP_AVG_CHANGE
-        updateAverage(qDiff);
-#endif
+        changeStats.add(qDiff);
         // PRINTMSG("new q: "<<newQ<<", adaptedLearnRate="<<adaptedLearnRate<<", reward="<<reward 
         //      <<", expected reward: "<<expectedDiscountedReward<<", bestAction="<<bestAction.v<<", discount="<<discount);
 
         // insert new value in q-table
-        if (!setRef.insert(ActionValuePairT(lastAction, newQ)).second) // will succeed because this is an empty set
-        {
-            PRINTERROR("Consistency!"); // this will not happen, but I'll leave it for debugging
-        }
+        setQValue(qit, slot, newQ);
 
-        // PRINTMSG(" | Expected reward for "<<*lastState<<" -> "<<s<<": "<<expectedDiscountedReward
+        // PRINTMSG(" | Expected reward for "<<lastState<<" -> "<<s<<": "<<expectedDiscountedReward
         // <<" best Action: "<<bestAction<<" reward="<<reward);
         // PRINTMSG(" | old Q: "<<lastQ<<", new Q: "<<newQ);
     }
@@ -629,38 +1073,9 @@ protected:
 
 
     /**
-     * From a set of actions with q-values associated, pick the one
-     * action which has the maximum q-value.
-     */
-    ActionValuePairT getMaxQValue(const ActionValueSetT& avSet) const
-    {
-        if (avSet.empty())  // the set should NOT be empty!
-        {
-            throw Exception("No actions were assigned in set. This is an inconsistency.", __FILE__, __LINE__);
-        }
-
-        ActionValuePairT maxAction;
-        // find the action which yields in the maximum utility
-        typename ActionValueSetT::const_iterator valIt;
-        for (valIt = avSet.begin(); valIt != avSet.end(); ++valIt)
-        {
-            if (valIt == avSet.begin()) // first iteration: update maximum
-            {
-                maxAction = ActionValuePairT(*valIt);
-                continue;
-            }
-            if (valIt->v > maxAction.v)
-            {
-                maxAction = ActionValuePairT(*valIt);
-            }
-        }
-        return maxAction;
-    }
-
-    /**
-     * Helper function, returns iterator to q-entry for the state
+     * Helper function, returns the q-entry for the state (QTableT::NoEntry if there is none)
      */
-    QMap_const_iterator getQEntry(const StateT& s) const
+    QEntryT getQEntry(const StateT& s) const
     {
         return q.find(s); // get the q-entry for the state
     }
@@ -679,26 +1094,15 @@ protected:
 
     /**
      * Helper function to retrieve the Q-Value for a state-action pair, given that the parameter qit
-     * points to the entry for a state. All actions previously tried from this state will have to be contained
+     * is the entry for a state. All actions previously tried from this state will have to be contained
      * in this entry.
      * Returns false if no such pair is in the Q-table yet, and actionUtility remains unchanged.
      * If a Q-valueu exists, the function returns true and actionUtility will contain the assigned value.
      */
-    bool getQValue(QMap_const_iterator qit, const ActionT& a, UtilityDataTypeT& actionUtility) const
+    bool getQValue(QEntryT qit, const ActionT& a, UtilityDataTypeT& actionUtility) const
     {
-        if (qit != q.end()) // current state exists in the q-table
-        {
-            const ActionValueSetT& setRef = qit->second; // for code readability, we'll get the reference
-            typedef typename ActionValueSetT::iterator SetItT;
-            // find the action in the set. Utiltiy value does not matter as it is not used for sorting.
-            SetItT setIt = setRef.find(ActionValuePairT(a, 0));
-            if (setIt != setRef.end())
-            {
-                actionUtility = setIt->v;
-                return true;
-            }
-        }
-        return false;
+        // returns false if the current state does not exist in the q-table
+        return q.getQValue(qit, a, actionUtility);
     }
 
 
@@ -708,74 +1112,143 @@ protected:
      */
     FreqCntT getFrequency(const StateT& s, const ActionT& a) const
     {
-        NSA_const_iterator it = nsaFreq.find(StateActionPairT(s, a));
-        if (it == nsaFreq.end()) return 0;
-        return it->second;
+        QSlotT slot = q.getSlot(a);
+        if (slot == static_cast<QSlotT>(QTableT::NoSlot)) return 0;
+        return q.getCount(getQEntry(s), slot);
+    }
+
+    /**
+     * Returns the entries of the q-table, ordered by their states
+     */
+    std::vector<QEntryT> getSortedEntries() const
+    {
+        std::vector<QEntryT> entries(q.size());
+        for (QEntryT e = 0; e < q.size(); ++e) entries[e] = e;
+        std::sort(entries.begin(), entries.end(), EntryLess(q));
+        return entries;
     }
 
     void printQValues(std::ostream& o) const
     {
-        QMap_const_iterator it;
-        for (it = q.begin(); it != q.end(); ++it)
+        // print the states in their order, not in the order they were inserted in the table
+        std::vector<QEntryT> entries = getSortedEntries();
+        for (size_t i = 0; i < entries.size(); ++i)
         {
-            const ActionValueSetT& setRef = it->second; // keep a reference for better code readability
-            typename ActionValueSetT::iterator sIt;
-            for (sIt = setRef.begin(); sIt != setRef.end(); ++sIt)
+            for (QSlotT slot = 0; slot < q.numActions(); ++slot)
             {
-                o << it->first << " / " << *sIt << std::endl;
+                if (!q.isAssigned(entries[i], slot)) continue;
+                o << q.getState(entries[i]) << " / "
+                  << ActionValuePairT(q.getAction(slot), q.getValue(entries[i], slot)) << std::endl;
             }
         }
     }
 
 
 
+    /**
+     * Average q-value change in the last updates, if the statistics of the changes keep
+     * ChangeStatistics::Window (which they do by default), otherwise 0.
+     */
     float getAvgChange() const
     {
-#ifdef KEEP_AVG_CHANGE
-        UtilityDataTypeT sum = 0;
-        typename std::deque<UtilityDataTypeT>::const_iterator it;
-        for (it = avg.begin(); it != avg.end(); ++it)
+        return changeStats.getWindowAverage();
+    }
+
+    /**
+     * Sets the q-value in the q-table and keeps track of the changes of the best action
+     */
+    void setQValue(QEntryT e, QSlotT slot, const UtilityDataTypeT& v)
+    {
+        QSlotT oldBest = q.getBestSlot(e);
+        q.setQValue(e, slot, v);
+        if (q.getBestSlot(e) != oldBest) bestActionChanged(e);
+        if ((policyPublishInterval > 0) && (++updatesSincePublish >= policyPublishInterval))
         {
-            sum += *it;
+            updatesSincePublish = 0;
+            publishPolicy();
         }
-        return sum / avg.size();
-#else
-        return 0.0;
-#endif
     }
 
-    void updateAverage(UtilityDataTypeT diff)
+    /**
+     * Creates an empty ChunkedPolicy if the domain provides a state indexer, and
+     * a LookupPolicy otherwise.
+     */
+    PolicyPtrT makePolicy() const
+    {
+        StateIndexerConstPtrT indexer = this->domain->getStateIndexer();
+        if (indexer.get()) return PolicyPtrT(new ChunkedPolicyT(indexer));
+        return PolicyPtrT(new LookupPolicyT());
+    }
+
+    /**
+     * Writes the n q-table entries starting at e to the rows with the same numbers
+     * of the open checkpoint. If index is given, the rows are also entered in it.
+     */
+    bool writeCheckpointRows(const StateIndexer<StateT>& indexer, QEntryT e, size_t n, std::vector<uint32_t> * index)
     {
-#ifdef KEEP_AVG_CHANGE
-        if (avg.size() >= KEEP_AVG_CHANGE)
+        QSlotT numSlots = q.numActions();
+        std::vector<uint32_t> ids(n);
+        std::vector<UtilityDataTypeT> values(n * numSlots);
+        std::vector<FreqCntT> counts(n * numSlots);
+        std::vector<uint8_t> flags(n * numSlots);
+        for (size_t i = 0; i < n; ++i)
         {
-            avg.pop_front();
+            ids[i] = indexer.toIndex(q.getState(e + i));
+            if (ids[i] >= indexer.size())
+            {
+                PRINTERROR("The state indexer maps " << q.getState(e + i) << " to " << ids[i]
+                           << ", which is out of its range");
+                return false;
+            }
+            if (index) (*index)[ids[i]] = e + i;
+            for (QSlotT slot = 0; slot < numSlots; ++slot)
+            {
+                values[i * numSlots + slot] = q.getValue(e + i, slot);
+                counts[i * numSlots + slot] = q.getCount(e + i, slot);
+                flags[i * numSlots + slot] = q.isAssigned(e + i, slot) ? 1 : 0;
+            }
         }
-        avg.push_back(diff);
-#endif
+        return checkpoint->writeRows(e, n, &ids[0], &values[0], &counts[0], &flags[0]);
     }
-private:
 
-#ifdef KEEP_AVG_CHANGE
-    std::deque<UtilityDataTypeT> avg;
-#endif
-    typedef StateActionPair<StateT, ActionT> StateActionPairT;
-
-    typedef std::map<StateActionPairT, FreqCntT>  NSAFreq;
-    typedef typename NSAFreq::iterator NSA_iterator;
-    typedef typename NSAFreq::const_iterator NSA_const_iterator;
+    /**
+     * Records that the best action of q-table entry e has changed, so that it is
+     * updated in the policy by the next publishPolicy().
+     */
+    void bestActionChanged(QEntryT e)
+    {
+        if (!policy.get()) return;  // no policy published yet, it will be built from the q-table
+        if (e >= entryChanged.size()) entryChanged.resize(q.size(), false);
+        if (entryChanged[e]) return;
+        entryChanged[e] = true;
+        changedEntries.push_back(e);
+    }
 
+private:
+    // rows gathered per write, and the minimum number of rows of a checkpoint
+    enum {CheckpointChunk = 4096, MinCheckpointCapacity = 1024};
 
-    // Frequencies of the state-action pairs
-    NSAFreq nsaFreq; // number of observed state-action pairs
+    // orders q-table entries by their states
+    struct EntryLess
+    {
+        explicit EntryLess(const QTableT& _q): q(_q) {}
+        bool operator()(QEntryT e1, QEntryT e2) const
+        {
+            return q.getState(e1) < q.getState(e2);
+        }
+        const QTableT& q;
+    };
 
-    // q-map. Because the value type of this map is an ordered set of type ActionValuePairT,
-    // the entries will be ordered by the actions, and actions will be unique.
-    QMap q;
+    // q-table, with one slot per action for each state, holding the q-value
+    // and the number of observed state-action pairs
+    QTableT q;
+    // the q-table slots of the actions, in the order they are generated by actionGenerator
+    std::vector<QSlotT> generatorOrder;
 
-    StatePtrT lastState;// state in the last update step
-    ActionT lastAction; // last action performed, with corresponding q-value
-    RewardValueTypeT lastReward; // experienced reward in the last update step
+    // the last step of the online learning with updateAndGetAction()
+    StepContext last;
+    // the last step of each lane of updateAndGetActions()
+    std::vector<StepContext> lanes;
     LearningRatePtrT learnRate;
     float discount;
     UtilityDataTypeT defaultQ; // default q value
@@ -783,6 +1256,9 @@ private:
     // should generte all possible actions for the underlying domain
     ActionGeneratorConstPtrT actionGenerator;
 
+    // the reward function of the domain, retrieved once because domains may create it on each call
+    RewardConstPtrT reward;
+
     // the assigned exploration function for trying new actions from particular states
     ExplorationConstPtrT exploration;
     // value 0..1 indicating a probability that not best, but a random
@@ -791,13 +1267,43 @@ private:
     // an action has been tried before. ALWAYS a not optimal action will be chosen,
     // i.e. there will constantly be epxolration.
     float epsilonGreedy;
-
-    PolicyPtrT policy;
+    // the random engine, or NULL to use the stream of the calling thread
+    RandomNumberGenerator::EnginePtrT rng;
+
+    // the policy kept by the learning thread, and the q-table entries whose best action has
+    // changed since it was published last (flagged in entryChanged by entry index, to list
+    // each entry once)
+    mutable PolicyPtrT policy;
+    mutable std::vector<QEntryT> changedEntries;
+    mutable std::vector<bool> entryChanged;
+    // the copy of the policy published last, accessed with std::atomic_load / std::atomic_store
+    mutable PolicyConstPtrT publishedPolicy;
+    mutable std::atomic<unsigned long> policyVersion;
+    unsigned long policyPublishInterval;
+    unsigned long updatesSincePublish;
 
     bool initialised;
-#ifdef LEARN_TRANSITION
-    std::shared_ptr<LearnableTransitionMapT> learnedTransition;
-#endif
+    // statistics of the q-value changes
+    ChangeStatisticsT changeStats;
+
+    // the backups of updateAndGetAction(), see setEligibilityTraces()
+    TraceMethod traceMethod;
+    float lambda;
+    float traceCutoff;
+    EligibilityTracesT traces;
+    // the transition function learned from the experienced transitions, see setLearnTransition()
+    TransitionModelT model;
+    // the successor state picked by plan(), kept to re-use its memory
+    StateT planned;
+
+    // the simulated backups after each step, see setPlanning()
+    unsigned int planningSteps;
+    std::chrono::microseconds planningBudget;
+
+    // the checkpoint written by the last saveCheckpoint(), kept open for incremental
+    // saves, and the number of q-table entries it had
+    CheckpointWriter::CheckpointWriterPtrT checkpoint;
+    QEntryT checkpointRows;
 
 };
 
@@ -0,0 +1,513 @@
+#ifndef RL_QTABLE_H
+#define RL_QTABLE_H
+// Copyright Jennifer Buehler
+
+#include <rl/State.h>
+#include <rl/ActionIndexer.h>
+
+#include <algorithm>
+#include <iostream>
+#include <vector>
+#include <stdint.h>
+
+namespace rl
+{
+
+/**
+ * \brief A pair of action and value, which can be used as a key.
+ * The key will be the Action, therefore this datatype has
+ * to support the < operator.
+ * The value is simply associated with the action and plays
+ * no role for the key.
+ * \author Jennifer Buehler
+ * \date May 2011
+ */
+template<class Action, typename Value>
+class ActionValuePair
+{
+public:
+    typedef Action ActionT;
+    typedef Value ValueT;
+
+    ActionValuePair() {}
+    ActionValuePair(const ActionT& _a, const ValueT& _v): a(_a), v(_v) {}
+    ActionValuePair(const ActionValuePair& o): a(o.a), v(o.v) {}
+
+    friend std::ostream& operator<<(std::ostream& o, const ActionValuePair& p)
+    {
+        o << "Action=" << p.a << ", value=" << p.v;
+        return o;
+    }
+    ActionValuePair& operator=(const ActionValuePair& o)
+    {
+        if (this == &o) return *this;
+        a = o.a;
+        v = o.v;
+        return *this;
+    }
+
+    bool operator < (const ActionValuePair& p) const
+    {
+        return (a < p.a);
+    }
+    ActionT a;
+    ValueT v;
+private:
+};
+
+
+/**
+ * \brief Table of q-values Q[s,a] for the states encountered so far and a fixed,
+ * finite set of actions.
+ *
+ * The states are kept in a hash table with open addressing (linear probing):
+ * the slots are a flat array of (hash value, entry index) pairs, so a lookup
+ * mostly touches one cache line and compares states only if the hash values match.
+ * The states are stored in a contiguous array, indexed by the entry index, which is
+ * assigned in the order the states are inserted and stays valid as long as the
+ * table is not cleared.
+ *
+ * Each action has a fixed slot 0..numActions()-1, and the q-values of a state
+ * are one contiguous row of numActions() records, indexed by the slot. Each record
+ * also holds the number of times the action has been tried from the state (see
+ * incrementCount()), so that both are found with one lookup. The slot of
+ * an action is determined by an ActionIndexer if one is given, otherwise the actions
+ * are ordered by their < operator and the slot is found by binary search.
+ * A q-value which has not been assigned yet is not part of the table (see getQValue()),
+ * but its record holds the default value.
+ *
+ * For each state, the slot of the assigned q-value with the maximum value (the
+ * lowest slot among equal values) is cached, and only recomputed when the value of
+ * the cached slot is decreased. This makes the greedy action lookup O(1).
+ *
+ * Optionally (see setTrackDirty()), the table keeps a list of the entries which have been
+ * inserted or changed since the last clearDirty(), so that a checkpoint only has to
+ * write those.
+ *
+ * \param State the state type. StateHash and StateEqual have to work for it.
+ * \param Action the action type, has to support the < operator.
+ * \param Value the type of the q-values
+ * \param Count the type of the visit counts
+ */
+template<class State, class Action, typename Value, typename Count = unsigned int,
+         class Hash = StateHash<State>, class Equal = StateEqual<State> >
+class QTable
+{
+public:
+    typedef State StateT;
+    typedef Action ActionT;
+    typedef Value ValueT;
+    typedef Count CountT;
+    typedef ActionValuePair<ActionT, ValueT> ActionValuePairT;
+    typedef ActionIndexer<ActionT> ActionIndexerT;
+    typedef typename ActionIndexerT::ActionIndexerConstPtrT ActionIndexerConstPtrT;
+    typedef unsigned int EntryT;
+    typedef unsigned int SlotT;
+
+    enum {NoEntry = 0xffffffff, NoSlot = 0xffffffff};
+
+    /**
+     * \param _actions all actions. If an indexer is given, they have to be ordered by
+     * the id of the indexer, otherwise they are sorted by the < operator here.
+     * \param _indexer optional indexer mapping the actions to their slots. The indexer
+     * has to map the actions to the ids 0..size()-1.
+     * \param _defaultValue the value of q-values which have not been assigned yet
+     */
+    QTable(const std::vector<ActionT>& _actions, const ActionIndexerConstPtrT& _indexer,
+           const ValueT& _defaultValue):
+        actions(_actions), indexer(_indexer), defaultValue(_defaultValue),
+        slots(MinCapacity), mask(MinCapacity - 1), trackDirty(false)
+    {
+        if (!indexer.get()) std::sort(actions.begin(), actions.end());
+    }
+
+    SlotT numActions() const
+    {
+        return actions.size();
+    }
+
+    const ActionT& getAction(SlotT slot) const
+    {
+        return actions[slot];
+    }
+
+    /**
+     * \return the slot of action a, or NoSlot if it is not one of the actions of the table
+     */
+    SlotT getSlot(const ActionT& a) const
+    {
+        if (indexer.get()) return indexer->toIndex(a);
+        typename std::vector<ActionT>::const_iterator it = std::lower_bound(actions.begin(), actions.end(), a);
+        if ((it == actions.end()) || (a < *it)) return static_cast<SlotT>(NoSlot);
+        return it - actions.begin();
+    }
+
+    const ValueT& getDefaultValue() const
+    {
+        return defaultValue;
+    }
+
+    /**
+     * \return the entry index of state s, or NoEntry if it is not in the table
+     */
+    EntryT find(const StateT& s) const
+    {
+        uint32_t h = hashValue(s);
+        for (uint32_t i = h & mask; ; i = (i + 1) & mask)
+        {
+            const Slot& slot = slots[i];
+            if (slot.entry == static_cast<EntryT>(NoEntry)) return static_cast<EntryT>(NoEntry);
+            if ((slot.hash == h) && equal(states[slot.entry], s)) return slot.entry;
+        }
+    }
+
+    /**
+     * Inserts the state s without any q-values assigned, unless it is in the table already.
+     * \return the entry index of state s
+     */
+    EntryT insert(const StateT& s)
+    {
+        uint32_t h = hashValue(s);
+        uint32_t i = h & mask;
+        for (; ; i = (i + 1) & mask)
+        {
+            const Slot& slot = slots[i];
+            if (slot.entry == static_cast<EntryT>(NoEntry)) break;
+            if ((slot.hash == h) && equal(states[slot.entry], s)) return slot.entry;
+        }
+        EntryT e = states.size();
+        states.push_back(s);
+        records.resize(records.size() + actions.size(), Record(defaultValue));
+        bestSlot.push_back(static_cast<SlotT>(NoSlot));
+        numAssigned.push_back(0);
+        if (trackDirty)
+        {
+            dirty.push_back(true);
+            dirtyEntries.push_back(e);
+        }
+        if (2 * states.size() > slots.size())
+        {
+            grow();
+            i = h & mask;
+            while (slots[i].entry != static_cast<EntryT>(NoEntry)) i = (i + 1) & mask;
+        }
+        slots[i].hash = h;
+        slots[i].entry = e;
+        return e;
+    }
+
+    /**
+     * Number of states in the table
+     */
+    unsigned int size() const
+    {
+        return states.size();
+    }
+
+    bool empty() const
+    {
+        return states.empty();
+    }
+
+    void clear()
+    {
+        slots.assign(MinCapacity, Slot());
+        mask = MinCapacity - 1;
+        states.clear();
+        records.clear();
+        bestSlot.clear();
+        numAssigned.clear();
+        dirty.clear();
+        dirtyEntries.clear();
+    }
+
+    /**
+     * Exchanges the contents of the two tables, including the actions and the tracking state.
+     */
+    void swap(QTable& o)
+    {
+        actions.swap(o.actions);
+        std::swap(indexer, o.indexer);
+        std::swap(defaultValue, o.defaultValue);
+        slots.swap(o.slots);
+        std::swap(mask, o.mask);
+        states.swap(o.states);
+        records.swap(o.records);
+        bestSlot.swap(o.bestSlot);
+        numAssigned.swap(o.numAssigned);
+        std::swap(trackDirty, o.trackDirty);
+        dirty.swap(o.dirty);
+        dirtyEntries.swap(o.dirtyEntries);
+        std::swap(hasher, o.hasher);
+        std::swap(equal, o.equal);
+    }
+
+    /**
+     * Switches tracking of the entries which are inserted or changed on or off. When it
+     * is switched on, no entry counts as changed.
+     */
+    void setTrackDirty(bool on)
+    {
+        trackDirty = on;
+        dirty.assign(on ? states.size() : 0, false);
+        dirtyEntries.clear();
+    }
+
+    bool isTrackingDirty() const
+    {
+        return trackDirty;
+    }
+
+    /**
+     * The entries which have been inserted, or whose q-values or counts have been
+     * changed, since tracking was switched on or clearDirty() was called, in the order
+     * of their first change.
+     */
+    const std::vector<EntryT>& getDirtyEntries() const
+    {
+        return dirtyEntries;
+    }
+
+    void clearDirty()
+    {
+        for (size_t i = 0; i < dirtyEntries.size(); ++i) dirty[dirtyEntries[i]] = false;
+        dirtyEntries.clear();
+    }
+
+    const StateT& getState(EntryT e) const
+    {
+        return states[e];
+    }
+
+    /**
+     * \return true if a q-value has been assigned for the slot of the state with entry index e
+     */
+    bool isAssigned(EntryT e, SlotT slot) const
+    {
+        return records[row(e) + slot].assigned;
+    }
+
+    /**
+     * Number of q-values assigned for the state with entry index e
+     */
+    SlotT getNumAssigned(EntryT e) const
+    {
+        return numAssigned[e];
+    }
+
+    /**
+     * Retrieves the q-value of the state with entry index e and the action with the
+     * given slot. Returns false if e is NoEntry or no value has been assigned yet,
+     * and v remains unchanged.
+     */
+    bool getQValue(EntryT e, SlotT slot, ValueT& v) const
+    {
+        if (e == static_cast<EntryT>(NoEntry)) return false;
+        const Record& r = records[row(e) + slot];
+        if (!r.assigned) return false;
+        v = r.value;
+        return true;
+    }
+
+    /**
+     * Retrieves the q-value Q[s,a] of the state with entry index e. Returns false if
+     * e is NoEntry or there is no value for the action yet, and v remains unchanged.
+     */
+    bool getQValue(EntryT e, const ActionT& a, ValueT& v) const
+    {
+        SlotT slot = getSlot(a);
+        if (slot == static_cast<SlotT>(NoSlot)) return false;
+        return getQValue(e, slot, v);
+    }
+
+    /**
+     * The q-value of the state with entry index e and the action with the given
+     * slot, or the default value if none has been assigned yet.
+     */
+    const ValueT& getValue(EntryT e, SlotT slot) const
+    {
+        return records[row(e) + slot].value;
+    }
+
+    /**
+     * Number of times the action with the given slot has been tried from the state with
+     * entry index e, or 0 if e is NoEntry.
+     */
+    CountT getCount(EntryT e, SlotT slot) const
+    {
+        if (e == static_cast<EntryT>(NoEntry)) return 0;
+        return records[row(e) + slot].count;
+    }
+
+    /**
+     * Increments the number of times the action with the given slot has been tried
+     * from the state with entry index e, which must be a valid entry. This does not
+     * assign a q-value.
+     * \return the new count
+     */
+    CountT incrementCount(EntryT e, SlotT slot)
+    {
+        if (trackDirty) markDirty(e);
+        return ++records[row(e) + slot].count;
+    }
+
+    /**
+     * Sets the number of times the action with the given slot has been tried from the
+     * state with entry index e, which must be a valid entry, e.g. when restoring a table.
+     */
+    void setCount(EntryT e, SlotT slot, const CountT& c)
+    {
+        if (trackDirty) markDirty(e);
+        records[row(e) + slot].count = c;
+    }
+
+    /**
+     * Sets the q-value of the state with entry index e, which must be a valid
+     * entry, and the action with the given slot.
+     */
+    void setQValue(EntryT e, SlotT slot, const ValueT& v)
+    {
+        if (trackDirty) markDirty(e);
+        Record& r = records[row(e) + slot];
+        ValueT old = r.value;
+        r.value = v;
+        if (!r.assigned)
+        {
+            r.assigned = true;
+            ++numAssigned[e];
+        }
+        SlotT& best = bestSlot[e];
+        if (best == static_cast<SlotT>(NoSlot))
+        {
+            best = slot;
+        }
+        else if (slot == best)
+        {
+            if (v < old) best = findBestSlot(e);  // the value dropped and may have crossed another one
+        }
+        else
+        {
+            ValueT bestValue = records[row(e) + best].value;
+            if ((v > bestValue) || (!(v < bestValue) && (slot < best))) best = slot;
+        }
+    }
+
+    /**
+     * Sets the q-value Q[s,a] of the state with entry index e, which must be a valid entry.
+     * \return false if a is not one of the actions of the table
+     */
+    bool setQValue(EntryT e, const ActionT& a, const ValueT& v)
+    {
+        SlotT slot = getSlot(a);
+        if (slot == static_cast<SlotT>(NoSlot)) return false;
+        setQValue(e, slot, v);
+        return true;
+    }
+
+    /**
+     * \return the slot with the maximum assigned q-value of the state with entry index e
+     * (the lowest slot among equal values), or NoSlot if no q-value has been assigned
+     * or e is NoEntry.
+     */
+    SlotT getBestSlot(EntryT e) const
+    {
+        if (e == static_cast<EntryT>(NoEntry)) return static_cast<SlotT>(NoSlot);
+        return bestSlot[e];
+    }
+
+    /**
+     * max_over_a(Q[s,a]) of the state with entry index e, where q-values which have not
+     * been assigned count with the default value. If e is NoEntry, this is the default value.
+     */
+    ValueT getMaxValue(EntryT e) const
+    {
+        if ((e == static_cast<EntryT>(NoEntry)) || (bestSlot[e] == static_cast<SlotT>(NoSlot)))
+            return defaultValue;
+        ValueT best = records[row(e) + bestSlot[e]].value;
+        if ((numAssigned[e] < actions.size()) && (defaultValue > best)) return defaultValue;
+        return best;
+    }
+
+private:
+    enum {MinCapacity = 64};
+
+    struct Slot
+    {
+        Slot(): hash(0), entry(static_cast<EntryT>(NoEntry)) {}
+        uint32_t hash;
+        EntryT entry;
+    };
+
+    struct Record
+    {
+        explicit Record(const ValueT& v): value(v), count(0), assigned(false) {}
+        ValueT value;
+        CountT count;
+        bool assigned;
+    };
+
+    size_t row(EntryT e) const
+    {
+        return static_cast<size_t>(e) * actions.size();
+    }
+
+    void markDirty(EntryT e)
+    {
+        if (dirty[e]) return;
+        dirty[e] = true;
+        dirtyEntries.push_back(e);
+    }
+
+    SlotT findBestSlot(EntryT e) const
+    {
+        SlotT best = static_cast<SlotT>(NoSlot);
+        const Record * r = &records[row(e)];
+        for (SlotT slot = 0; slot < actions.size(); ++slot)
+        {
+            if (!r[slot].assigned) continue;
+            if ((best == static_cast<SlotT>(NoSlot)) || (r[slot].value > r[best].value)) best = slot;
+        }
+        return best;
+    }
+
+    uint32_t hashValue(const StateT& s) const
+    {
+        // Fibonacci hashing, to spread state hashes with few significant bits
+        uint64_t h = static_cast<uint64_t>(hasher(s)) * 0x9E3779B97F4A7C15ULL;
+        return static_cast<uint32_t>(h >> 32);
+    }
+
+    void grow()
+    {
+        std::vector<Slot> newSlots(2 * slots.size());
+        uint32_t newMask = newSlots.size() - 1;
+        for (size_t k = 0; k < slots.size(); ++k)
+        {
+            if (slots[k].entry == static_cast<EntryT>(NoEntry)) continue;
+            uint32_t i = slots[k].hash & newMask;
+            while (newSlots[i].entry != static_cast<EntryT>(NoEntry)) i = (i + 1) & newMask;
+            newSlots[i] = slots[k];
+        }
+        slots.swap(newSlots);
+        mask = newMask;
+    }
+
+    std::vector<ActionT> actions;  // the action of each slot
+    ActionIndexerConstPtrT indexer;
+    ValueT defaultValue;
+
+    std::vector<Slot> slots;  // capacity is a power of two, and at most half of the slots are used
+    uint32_t mask;  // slots.size() - 1
+    std::vector<StateT> states;  // the state of each entry
+    std::vector<Record> records;  // numActions() records per entry
+    std::vector<SlotT> bestSlot;  // cached slot of the maximum assigned q-value of each entry
+    std::vector<SlotT> numAssigned;  // number of assigned q-values of each entry
+    bool trackDirty;
+    std::vector<bool> dirty;  // per entry, if trackDirty
+    std::vector<EntryT> dirtyEntries;
+    Hash hasher;
+    Equal equal;
+};
+
+}  // namespace rl
+#endif  // RL_QTABLE_H
@@ -0,0 +1,175 @@
+#ifndef RL_SAMPLEDTRANSITION_H
+#define RL_SAMPLEDTRANSITION_H
+// Copyright Jennifer Buehler
+
+#include <rl/FlatModel.h>
+#include <rl/LogBinding.h>
+
+#include <math/RandomNumber.h>
+
+#include <memory>
+#include <vector>
+#include <stdint.h>
+
+namespace rl
+{
+
+/**
+ * \brief Samples successor states of a FlatModel in constant time, with one
+ * alias table (Vose's method) per state-action pair.
+ *
+ * Picking the successor by a cumulative-probability scan over the transition list,
+ * as Domain::transferState() implementations usually do, costs time linear in the
+ * number of successors. The alias table of a row instead has one column per successor,
+ * and each column holds the successor itself, a threshold, and an alias successor.
+ * A sample picks a column uniformly and then the successor or the alias by comparing
+ * with the threshold, both from the same 64 bit random number.
+ *
+ * The columns are stored parallel to the CSR arrays of the model, so the tables take
+ * 12 bytes per transition and are built in time linear in the number of transitions.
+ * Domains can use this for their transferState(), see enableAliasSampling()
+ * in GridWorldSampling.h.
+ *
+ * \param State the state type of the FlatModel
+ * \param Action the action type of the FlatModel
+ */
+template<class State, class Action>
+class SampledTransition
+{
+public:
+    typedef State StateT;
+    typedef Action ActionT;
+    typedef FlatModel<StateT, ActionT> FlatModelT;
+    typedef typename FlatModelT::IndexT IndexT;
+    typedef typename FlatModelT::FlatModelConstPtrT FlatModelConstPtrT;
+
+    typedef SampledTransition<StateT, ActionT> SampledTransitionT;
+    typedef std::shared_ptr<SampledTransitionT> SampledTransitionPtrT;
+    typedef std::shared_ptr<const SampledTransitionT> SampledTransitionConstPtrT;
+
+    /**
+     * Builds the alias tables of all rows of the model. The probabilities of each
+     * row are normalised by their sum.
+     */
+    explicit SampledTransition(const FlatModelConstPtrT& _model): model(_model)
+    {
+        if (!model.get())
+        {
+            throw Exception("SampledTransition needs a flat model", __FILE__, __LINE__);
+        }
+        build();
+    }
+
+    /**
+     * Compiles the flat model of the domain (see FlatModel::compile(const Domain&))
+     * and builds the alias tables from it.
+     * \return NULL if the model could not be compiled
+     */
+    template<class Domain>
+    static SampledTransitionPtrT compile(const Domain& domain)
+    {
+        FlatModelConstPtrT m = FlatModelT::compile(domain);
+        if (!m.get()) return SampledTransitionPtrT();
+        return SampledTransitionPtrT(new SampledTransitionT(m));
+    }
+
+    FlatModelConstPtrT getModel() const
+    {
+        return model;
+    }
+
+    /**
+     * Samples a successor of row r of the model
+     * \param rnd uniform 64 bit random number. The upper 32 bits pick the column,
+     *      the lower 24 bits decide between the successor and its alias.
+     * \return false if the row has no successors
+     */
+    bool sample(IndexT r, uint64_t rnd, IndexT& next) const
+    {
+        IndexT begin = model->rowBegin(r);
+        IndexT n = model->rowEnd(r) - begin;
+        if (n == 0) return false;
+        IndexT col = static_cast<IndexT>(((rnd >> 32) * n) >> 32);
+        const Column& c = columns[begin + col];
+        float u = static_cast<float>(rnd & 0xffffff) * (1.0f / 16777216.0f);
+        next = (u < c.threshold) ? c.successor : c.alias;
+        return true;
+    }
+
+    /**
+     * Samples the successor of state s with action a, and stores it in next
+     * \return false if s or a are not part of the model, or the pair has no successors
+     */
+    bool transferState(const StateT& s, const ActionT& a, RandomNumberGenerator::EngineT& rng, StateT& next) const
+    {
+        IndexT sIdx, aIdx, nextIdx;
+        if (!model->getStateIndex(s, sIdx) || !model->getActionIndex(a, aIdx)) return false;
+        if (!sample(model->row(sIdx, aIdx), rng.next(), nextIdx)) return false;
+        next = model->getState(nextIdx);
+        return true;
+    }
+
+private:
+    struct Column
+    {
+        float threshold;  // the successor is picked if the uniform number is below, otherwise the alias
+        IndexT successor;
+        IndexT alias;
+    };
+
+    /**
+     * Vose's alias method for each row
+     */
+    void build()
+    {
+        const std::vector<IndexT>& successors = model->getSuccessors();
+        const std::vector<typename FlatModelT::ValueT>& probabilities = model->getProbabilities();
+        columns.resize(successors.size());
+        std::vector<double> scaled;
+        std::vector<IndexT> small, large;  // columns with scaled probability below and at least 1
+        for (IndexT r = 0; r < model->numRows(); ++r)
+        {
+            IndexT begin = model->rowBegin(r);
+            IndexT n = model->rowEnd(r) - begin;
+            if (n == 0) continue;
+            double sum = 0;
+            for (IndexT i = 0; i < n; ++i) sum += probabilities[begin + i];
+            scaled.resize(n);
+            small.clear();
+            large.clear();
+            for (IndexT i = 0; i < n; ++i)
+            {
+                Column& c = columns[begin + i];
+                c.successor = successors[begin + i];
+                c.alias = c.successor;
+                c.threshold = 1.0f;
+                scaled[i] = (sum > 0) ? probabilities[begin + i] * n / sum : 1.0;
+                if (scaled[i] < 1.0) small.push_back(i);
+                else large.push_back(i);
+            }
+            while (!small.empty() && !large.empty())
+            {
+                IndexT l = small.back();
+                small.pop_back();
+                IndexT g = large.back();
+                Column& c = columns[begin + l];
+                c.threshold = static_cast<float>(scaled[l]);
+                c.alias = successors[begin + g];
+                scaled[g] = (scaled[g] + scaled[l]) - 1.0;
+                if (scaled[g] < 1.0)
+                {
+                    large.pop_back();
+                    small.push_back(g);
+                }
+            }
+            // whatever remains has a scaled probability of 1 up to rounding errors, and
+            // keeps the threshold 1 set above.
+        }
+    }
+
+    FlatModelConstPtrT model;
+    std::vector<Column> columns;  // parallel to the successors of the model
+};
+
+}  // namespace rl
+#endif  // RL_SAMPLEDTRANSITION_H
@@ -4,6 +4,7 @@
 
 #include <iostream>
 #include <memory>
+#include <stddef.h>
 
 namespace rl
 {
@@ -75,6 +76,36 @@ private:
 };
 
 
+/**
+ * \brief Hash function for states, used by hash tables such as QTable.
+ * By default, it calls the method hash() of the state, so states which are
+ * to be used in hash tables have to implement this method (or the template
+ * has to be specialized for the state type). States which are equal
+ * (see StateEqual) must have the same hash value.
+ */
+template<class State>
+struct StateHash
+{
+    size_t operator()(const State& s) const
+    {
+        return s.hash();
+    }
+};
+
+/**
+ * \brief Equality of states, used by hash tables such as QTable.
+ * By default, it is derived from the < operator, which all states support.
+ * It can be specialized for state types which provide a faster comparison.
+ */
+template<class State>
+struct StateEqual
+{
+    bool operator()(const State& s1, const State& s2) const
+    {
+        return !(s1 < s2) && !(s2 < s1);
+    }
+};
+
 }
 #endif
 
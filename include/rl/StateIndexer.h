@@ -0,0 +1,55 @@
+#ifndef RL_STATEINDEXER_H
+#define RL_STATEINDEXER_H
+// Copyright Jennifer Buehler
+
+#include <memory>
+
+namespace rl
+{
+
+/**
+ * \brief Maps the states of an enumerable domain to dense integer ids
+ * in the range [0..size()-1], and back.
+ *
+ * A Domain can optionally provide such an indexer (see Domain::getStateIndexer()).
+ * Table-based components can then store their values in a vector indexed by the
+ * state id, instead of a std::map keyed by the state object, which turns a lookup
+ * into a single array access.
+ *
+ * Not every id in [0..size()-1] has to correspond to a state which is generated
+ * by the domain's StateGenerator (e.g. blocked cells in a grid), but every
+ * generated state must have a unique id within this range.
+ *
+ * \param State the state type
+ */
+template<class State>
+class StateIndexer
+{
+public:
+    typedef State StateT;
+    typedef unsigned int IndexT;
+    typedef StateIndexer<StateT> StateIndexerT;
+    typedef std::shared_ptr<StateIndexerT> StateIndexerPtrT;
+    typedef std::shared_ptr<const StateIndexerT> StateIndexerConstPtrT;
+
+    StateIndexer() {}
+    virtual ~StateIndexer() {}
+
+    /**
+     * Returns the id of the state s
+     */
+    virtual IndexT toIndex(const StateT& s) const = 0;
+
+    /**
+     * Returns the state with id i
+     */
+    virtual StateT fromIndex(IndexT i) const = 0;
+
+    /**
+     * Returns the number of ids, i.e. all ids are smaller than this value.
+     */
+    virtual IndexT size() const = 0;
+};
+
+}  // namespace rl
+#endif  // RL_STATEINDEXER_H
@@ -0,0 +1,278 @@
+#ifndef RL_STOPPINGCRITERION_H
+#define RL_STOPPINGCRITERION_H
+// Copyright Jennifer Buehler
+
+#include <chrono>
+#include <limits>
+#include <memory>
+#include <math.h>
+
+namespace rl
+{
+
+/**
+ * \brief Statistics of the utility changes within one iteration (sweep) of an offline
+ * solver, collected with add() for each state updated.
+ */
+struct SweepStatistics
+{
+    SweepStatistics()
+    {
+        reset();
+    }
+
+    void reset()
+    {
+        maxAbsChange = 0;
+        minChange = std::numeric_limits<float>::max();
+        maxChange = -std::numeric_limits<float>::max();
+        maxAbsUtility = 0;
+    }
+
+    /**
+     * Adds the update of one state from utility oldUt to newUt
+     */
+    void add(float oldUt, float newUt)
+    {
+        float change = newUt - oldUt;
+        if (fabs(change) > maxAbsChange) maxAbsChange = fabs(change);
+        if (change < minChange) minChange = change;
+        if (change > maxChange) maxChange = change;
+        if (fabs(newUt) > maxAbsUtility) maxAbsUtility = fabs(newUt);
+    }
+
+    /**
+     * Adds the statistics of another (part of the) sweep
+     */
+    void merge(const SweepStatistics& o)
+    {
+        if (o.maxAbsChange > maxAbsChange) maxAbsChange = o.maxAbsChange;
+        if (o.minChange < minChange) minChange = o.minChange;
+        if (o.maxChange > maxChange) maxChange = o.maxChange;
+        if (o.maxAbsUtility > maxAbsUtility) maxAbsUtility = o.maxAbsUtility;
+    }
+
+    /**
+     * The span seminorm of the utility changes, max(U'-U) - min(U'-U).
+     */
+    float span() const
+    {
+        if (maxChange < minChange) return 0;  // no states added
+        return maxChange - minChange;
+    }
+
+    /**
+     * The maximum change of utility relative to the maximum absolute utility.
+     */
+    float relativeChange() const
+    {
+        if (maxAbsChange == 0) return 0;
+        if (maxAbsUtility == 0) return std::numeric_limits<float>::max();
+        return maxAbsChange / maxAbsUtility;
+    }
+
+    float maxAbsChange;  // max |U'(s)-U(s)|
+    float minChange;  // min U'(s)-U(s)
+    float maxChange;  // max U'(s)-U(s)
+    float maxAbsUtility;  // max |U'(s)|
+};
+
+
+/**
+ * \brief Additional termination criteria for the offline solvers (value iteration
+ * and policy iteration), in addition to their own convergence test.
+ *
+ * All criteria are disabled by default, and any combination of them can be enabled.
+ * The solver calls start() before the first iteration, and update() after each
+ * iteration, which returns true as soon as one of the enabled criteria is met.
+ * Afterwards, getReason() tells which criterion stopped the solver, or Converged
+ * if the solver stopped because of its own convergence test.
+ *
+ * The solvers on a FlatModel also check the deadline within an iteration with
+ * checkDeadline(): value iteration every DeadlineChunk states of a sweep, policy
+ * iteration after each sweep of the policy evaluation, and prioritized sweeping every
+ * number-of-states backups. The other solvers only check it between iterations, so
+ * they can exceed it by the duration of one iteration.
+ */
+class StoppingCriterion
+{
+public:
+    typedef std::chrono::steady_clock ClockT;
+    typedef ClockT::time_point TimePointT;
+    typedef std::shared_ptr<StoppingCriterion> StoppingCriterionPtrT;
+    typedef std::shared_ptr<const StoppingCriterion> StoppingCriterionConstPtrT;
+
+    typedef enum Reason {NotStopped, Converged, MaxIterations, AbsoluteResidual, RelativeResidual,
+                         SpanSeminorm, Deadline} ReasonT;
+
+    // number of states a value iteration sweep updates between two checks of the deadline
+    enum {DeadlineChunk = 4096};
+
+    StoppingCriterion(): maxIterations(0), absoluteResidual(-1), relativeResidual(-1), spanSeminorm(-1),
+        useTimeBudget(false), useDeadline(false), reason(NotStopped), iterations(0) {}
+
+    /**
+     * Stop after n iterations. 0 disables the criterion.
+     */
+    void setMaxIterations(unsigned int n)
+    {
+        maxIterations = n;
+    }
+    /**
+     * Stop when max |U'(s)-U(s)| of an iteration is at most eps. A negative value disables the criterion.
+     */
+    void setAbsoluteResidual(float eps)
+    {
+        absoluteResidual = eps;
+    }
+    /**
+     * Stop when max |U'(s)-U(s)| / max |U'(s)| of an iteration is at most eps. A negative value
+     * disables the criterion.
+     */
+    void setRelativeResidual(float eps)
+    {
+        relativeResidual = eps;
+    }
+    /**
+     * Stop when the span max(U'-U) - min(U'-U) of an iteration is at most eps. As the span
+     * ignores constant offsets, this is the criterion to use for undiscounted problems in which
+     * all utilities keep changing by the same amount. A negative value disables the criterion.
+     */
+    void setSpanSeminorm(float eps)
+    {
+        spanSeminorm = eps;
+    }
+    /**
+     * Stop when the time budget, measured from start(), is used up.
+     */
+    void setTimeBudget(std::chrono::microseconds budget)
+    {
+        timeBudget = budget;
+        useTimeBudget = true;
+        useDeadline = false;
+    }
+    /**
+     * Stop when the absolute deadline has passed.
+     */
+    void setDeadline(const TimePointT& _deadline)
+    {
+        deadline = _deadline;
+        useDeadline = true;
+        useTimeBudget = false;
+    }
+    /**
+     * Disables the time budget or deadline.
+     */
+    void clearDeadline()
+    {
+        useTimeBudget = false;
+        useDeadline = false;
+    }
+
+    /**
+     * Has to be called by the solver before the first iteration.
+     */
+    void start()
+    {
+        startTime = ClockT::now();
+        if (useTimeBudget) deadline = startTime + timeBudget;
+        reason = NotStopped;
+        iterations = 0;
+        lastStatistics.reset();
+    }
+
+    /**
+     * Has to be called by the solver after each iteration.
+     * \return true if the solver has to stop
+     */
+    bool update(const SweepStatistics& stats)
+    {
+        ++iterations;
+        lastStatistics = stats;
+        if ((absoluteResidual >= 0) && (stats.maxAbsChange <= absoluteResidual)) reason = AbsoluteResidual;
+        else if ((relativeResidual >= 0) && (stats.relativeChange() <= relativeResidual)) reason = RelativeResidual;
+        else if ((spanSeminorm >= 0) && (stats.span() <= spanSeminorm)) reason = SpanSeminorm;
+        else if ((maxIterations > 0) && (iterations >= maxIterations)) reason = MaxIterations;
+        else if (deadlinePassed()) reason = Deadline;
+        return reason != NotStopped;
+    }
+
+    /**
+     * To be called by the solver if it stops because of its own convergence test.
+     */
+    void setConverged()
+    {
+        reason = Converged;
+    }
+
+    /**
+     * Used by the solver to check the deadline within an iteration. Sets the
+     * reason to Deadline if it has passed.
+     * \return true if the solver has to stop
+     */
+    bool checkDeadline()
+    {
+        if (!deadlinePassed()) return false;
+        reason = Deadline;
+        return true;
+    }
+
+    /**
+     * Like checkDeadline(), but does not change the reason, so it can be called
+     * by several threads of a solver at once.
+     */
+    bool deadlinePassed() const
+    {
+        return (useTimeBudget || useDeadline) && (ClockT::now() >= deadline);
+    }
+
+    ReasonT getReason() const
+    {
+        return reason;
+    }
+    unsigned int getIterations() const
+    {
+        return iterations;
+    }
+    const SweepStatistics& getLastStatistics() const
+    {
+        return lastStatistics;
+    }
+    std::chrono::microseconds getElapsedTime() const
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(ClockT::now() - startTime);
+    }
+
+    static const char * getReasonName(ReasonT r)
+    {
+        switch (r)
+        {
+        case NotStopped: return "not stopped";
+        case Converged: return "converged";
+        case MaxIterations: return "maximum iterations";
+        case AbsoluteResidual: return "absolute residual";
+        case RelativeResidual: return "relative residual";
+        case SpanSeminorm: return "span seminorm";
+        case Deadline: return "deadline";
+        }
+        return "unknown";
+    }
+
+private:
+    unsigned int maxIterations;
+    float absoluteResidual;
+    float relativeResidual;
+    float spanSeminorm;
+    std::chrono::microseconds timeBudget;
+    bool useTimeBudget;
+    bool useDeadline;
+
+    TimePointT startTime;
+    TimePointT deadline;
+    ReasonT reason;
+    unsigned int iterations;
+    SweepStatistics lastStatistics;
+};
+
+}  // namespace rl
+#endif  // RL_STOPPINGCRITERION_H
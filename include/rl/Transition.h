@@ -130,11 +130,6 @@ public:
     virtual bool getTransitionStates(const State& s, const Action& a, StateTransitionListPtrT& ret) const
     {
         typename TransitionMapT::const_iterator it = t.find(StateActionPairT(s, a));
-
-        if (it->second->size() > 1)
-        {
-            PRINTMSG("WE HAVE THIS CASE!!!");
-        }
         if (it == t.end()) return false;
         ret = it->second;
         return true;
@@ -253,7 +248,7 @@ public:
             {
                 throw Exception("This time, the list should not be empty!", __FILE__, __LINE__);
             }
-            setTransitionState(s1, a, s2, 0.0); //initialise new entry for probabilities table, initially 0
+            this->setTransitionState(s1, a, s2, 0.0); //initialise new entry for probabilities table, initially 0
         }
 
         /*if (cs->size()>4) {
@@ -286,7 +281,7 @@ public:
 
         //now, update all probabilities
         StateTransitionListPtrT ps;
-        getTransitionStatesNonConst(s1, a, ps);
+        this->getTransitionStatesNonConst(s1, a, ps);
         if (ps->size() != cs->size())
         {
             throw Exception("Inconsistency in maps! ", __FILE__, __LINE__);
@@ -0,0 +1,182 @@
+#ifndef RL_TRANSITIONMODEL_H
+#define RL_TRANSITIONMODEL_H
+// Copyright Jennifer Buehler
+
+#include <rl/Transition.h>
+#include <rl/LogBinding.h>
+
+#include <general/Exception.h>
+
+#include <iostream>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace rl
+{
+
+/**
+ * \brief Model-learning policy of QLearningController which learns the transition
+ * function from the experienced transitions, as needed for Dyna-Q planning.
+ *
+ * Learning can be switched on and off at runtime with setLearning(). The learned
+ * transition function is kept in a LearnableTransitionMap, and the experienced
+ * state-action pairs are additionally kept in a compact list of q-table entries and
+ * slots, from which the planning can pick pairs in constant time.
+ */
+template<class State, class Action>
+class LearnedTransitionModel
+{
+public:
+    typedef LearnableTransitionMap<State, Action> LearnableTransitionMapT;
+    typedef std::shared_ptr<const LearnableTransitionMapT> LearnableTransitionMapConstPtrT;
+    typedef std::pair<unsigned int, unsigned int> PairT;  // q-table entry and slot of a state-action pair
+
+    // whether this policy can learn a model at all
+    enum {CanLearn = 1};
+
+    LearnedTransitionModel(): learning(false) {}
+
+    /**
+     * Switches learning on or off. The learned transition function is kept when
+     * switched off, and extended when switched on again.
+     */
+    void setLearning(bool on)
+    {
+        learning = on;
+        if (on && !transition.get()) transition.reset(new LearnableTransitionMapT());
+    }
+    bool isLearning() const
+    {
+        return learning;
+    }
+
+    /**
+     * Learns the transition from s1 with action a to s2.
+     * \param e the q-table entry of s1
+     * \param slot the q-table slot of a
+     * \param numSlots the number of slots of each q-table entry
+     */
+    void experience(const State& s1, const Action& a, const State& s2,
+                    unsigned int e, unsigned int slot, unsigned int numSlots)
+    {
+        transition->experienceTransition(s1, a, s2);
+        size_t i = static_cast<size_t>(e) * numSlots + slot;
+        if (i >= inModel.size()) inModel.resize(i + 1, false);
+        if (inModel[i]) return;
+        inModel[i] = true;
+        pairs.push_back(PairT(e, slot));
+    }
+
+    /**
+     * Forgets the learned transition function and the experienced state-action pairs,
+     * e.g. when the q-table entries they refer to are replaced.
+     */
+    void clear()
+    {
+        transition.reset(learning ? new LearnableTransitionMapT() : NULL);
+        pairs.clear();
+        inModel.clear();
+    }
+
+    /**
+     * The number of state-action pairs experienced so far
+     */
+    size_t numPairs() const
+    {
+        return pairs.size();
+    }
+    const PairT& getPair(size_t i) const
+    {
+        return pairs[i];
+    }
+
+    /**
+     * Picks a successor state of the state-action pair (s, a) according to the learned probabilities.
+     * \param u uniform random number in [0..1]
+     * \return false if no transition has been learned for (s, a)
+     */
+    bool sampleSuccessor(const State& s, const Action& a, float u, State& next) const
+    {
+        typedef typename LearnableTransitionMapT::StateTransitionListT StateTransitionListT;
+        typedef typename LearnableTransitionMapT::StateTransitionListPtrT StateTransitionListPtrT;
+        StateTransitionListPtrT successors;
+        if (!transition.get() || !transition->getTransitionStates(s, a, successors) || successors->empty()) return false;
+        typename StateTransitionListT::const_iterator it = successors->begin();
+        float cumProb = it->p;
+        while ((cumProb < u) && ((it + 1) != successors->end()))
+        {
+            ++it;
+            cumProb += it->p;
+        }
+        next = it->s;
+        return true;
+    }
+
+    /**
+     * \return the learned transition function, or NULL if it has never been learned
+     */
+    LearnableTransitionMapConstPtrT getLearnedTransition() const
+    {
+        return transition;
+    }
+
+    void print(std::ostream& o) const
+    {
+        if (transition.get()) transition->print(o);
+    }
+
+private:
+    bool learning;
+    std::shared_ptr<LearnableTransitionMapT> transition;
+    std::vector<PairT> pairs;
+    std::vector<bool> inModel;  // for each entry*numSlots+slot, whether it is in pairs
+};
+
+
+/**
+ * \brief Model-learning policy of QLearningController which does not learn a model.
+ * All its functions are empty, so the controller carries no overhead for the model.
+ */
+template<class State, class Action>
+class NoTransitionModel
+{
+public:
+    typedef LearnableTransitionMap<State, Action> LearnableTransitionMapT;
+    typedef std::shared_ptr<const LearnableTransitionMapT> LearnableTransitionMapConstPtrT;
+    typedef std::pair<unsigned int, unsigned int> PairT;
+
+    enum {CanLearn = 0};
+
+    void setLearning(bool on)
+    {
+        if (on) PRINTERROR("The controller has been compiled without a transition model");
+    }
+    bool isLearning() const
+    {
+        return false;
+    }
+    void experience(const State&, const Action&, const State&,
+                    unsigned int, unsigned int, unsigned int) {}
+    void clear() {}
+    size_t numPairs() const
+    {
+        return 0;
+    }
+    const PairT& getPair(size_t) const
+    {
+        throw Exception("There are no state-action pairs without a transition model", __FILE__, __LINE__);
+    }
+    bool sampleSuccessor(const State&, const Action&, float, State&) const
+    {
+        return false;
+    }
+    LearnableTransitionMapConstPtrT getLearnedTransition() const
+    {
+        return LearnableTransitionMapConstPtrT();
+    }
+    void print(std::ostream&) const {}
+};
+
+}  // namespace rl
+#endif  // RL_TRANSITIONMODEL_H
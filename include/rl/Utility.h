@@ -5,7 +5,9 @@
 #include <sstream>
 #include <map>
 #include <memory>
+#include <vector>
 #include <rl/LogBinding.h>
+#include <rl/StateIndexer.h>
 
 namespace rl
 {
@@ -154,6 +156,79 @@ private:
     MappedUtility() {}
 };
 
+
+/**
+ * Same as MappedUtility, but for domains providing a StateIndexer: the utilities are
+ * stored in a vector indexed by the state id, so that each lookup is a single
+ * array access and cloning is a plain copy of contiguous memory.
+ */
+template<class State, typename Value = float>
+class IndexedUtility: public Utility<State, Value>
+{
+public:
+    typedef Value ValueT;
+    typedef State StateT;
+    typedef Utility<StateT, ValueT> UtilityT;
+    typedef typename UtilityT::UtilityPtrT UtilityPtrT;
+    typedef StateIndexer<StateT> StateIndexerT;
+    typedef typename StateIndexerT::StateIndexerConstPtrT StateIndexerConstPtrT;
+    typedef typename StateIndexerT::IndexT IndexT;
+
+    typedef IndexedUtility<StateT, ValueT> IndexedUtilityT;
+
+    /**
+     * \param _indexer the state indexer of the domain
+     * \param _defaultValue the default utility to be returned if there is no other utility assigned
+     */
+    explicit IndexedUtility(const StateIndexerConstPtrT& _indexer, const ValueT& _defaultValue = 0):
+        UtilityT(), indexer(_indexer), values(_indexer->size(), _defaultValue),
+        assigned(_indexer->size(), false), defaultValue(_defaultValue) {}
+    explicit IndexedUtility(const IndexedUtility& o): UtilityT(o), indexer(o.indexer), values(o.values),
+        assigned(o.assigned), defaultValue(o.defaultValue) {}
+    virtual ~IndexedUtility() {}
+
+    virtual ValueT getUtility(const StateT& s, float&, float&)const
+    {
+        IndexT i = indexer->toIndex(s);
+        if (i >= values.size()) return defaultValue;
+        return values[i];
+    }
+
+    virtual void experienceUtility(const StateT& s, const ValueT& v)
+    {
+        IndexT i = indexer->toIndex(s);
+        if (i >= values.size())
+        {
+            PRINTERROR("State " << s << " has an id out of range of the indexer");
+            return;
+        }
+        values[i] = v;
+        assigned[i] = true;
+    }
+
+    virtual void print(std::stringstream& strng)const
+    {
+        for (IndexT i = 0; i < values.size(); ++i)
+        {
+            if (assigned[i]) strng << indexer->fromIndex(i) << " -> " << values[i] << std::endl;
+        }
+    }
+    virtual UtilityPtrT clone()const
+    {
+        return UtilityPtrT(new IndexedUtilityT(*this));
+    }
+
+protected:
+    StateIndexerConstPtrT indexer;
+    std::vector<ValueT> values;
+    std::vector<bool> assigned;  // states for which a utility was experienced, only used for printing
+
+    ValueT defaultValue;
+
+private:
+    IndexedUtility() {}
+};
+
 } //namespace
 #endif
 
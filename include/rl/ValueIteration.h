@@ -12,17 +12,37 @@
 #include <rl/Policy.h>
 #include <rl/LogBinding.h>
 #include <rl/Controller.h>
+#include <rl/FlatModel.h>
+#include <rl/ParallelValueIteration.h>
+#include <rl/PrioritizedSweeping.h>
+#include <rl/StoppingCriterion.h>
+#include <rl/Checkpoint.h>
 
 #include <math/FloatComparison.h>
 
+#include <algorithm>
+#include <chrono>
 #include <assert.h>
 #include <math.h>
-
-#define ZERO_EPSILON 1e-07
+#include <string>
+#include <vector>
 
 namespace rl
 {
 
+/**
+ * The update scheme used within the iterations of value iteration.
+ * Jacobi: all states are updated based on the utilities of the previous iteration,
+ * which needs a second copy of the utilities.
+ * GaussSeidel: utilities are updated in place, so updates within the same
+ * iteration already use the new utilities of states updated before. This needs no
+ * additional copy of the utilities and usually converges in fewer iterations.
+ * PrioritizedSweeping: instead of full sweeps, the states with the largest
+ * Bellman residual are updated first (see prioritizedSweeping()). Only
+ * supported on a compiled FlatModel.
+ */
+typedef enum ValueIterationMode {Jacobi, GaussSeidel, PrioritizedSweeping} ValueIterationModeT;
+
 /**
  * \brief Generates a policy out of a utility and transition function
  * \author Jennifer Buehler
@@ -83,6 +103,38 @@ private:
 };
 
 
+/**
+ * Generates a policy out of the utilities of a compiled model, the same way as
+ * PolicyGenerationAlgorithm does. States for which no action exceeds utility 0
+ * are assigned the default action, as in MaxUtilityActionAlgorithm.
+ * \param model the compiled model
+ * \param u utility of each state in the model, indexed by state index
+ */
+template<class State, class Action>
+std::shared_ptr<Policy<State, Action> > flatPolicyGeneration(const FlatModel<State, Action>& model,
+                                                            const std::vector<float>& u)
+{
+    typedef FlatModel<State, Action> FlatModelT;
+    typedef typename FlatModelT::IndexT IndexT;
+    typedef Policy<State, Action> PolicyT;
+    typedef LookupPolicy<State, Action> LookupPolicyT;
+    typedef IndexedPolicy<State, Action> IndexedPolicyT;
+    typedef typename PolicyT::PolicyPtrT PolicyPtrT;
+
+    PolicyPtrT resultPolicy;
+    if (model.getStateIndexer().get()) resultPolicy = PolicyPtrT(new IndexedPolicyT(model.getStateIndexer()));
+    else resultPolicy = PolicyPtrT(new LookupPolicyT());
+    for (IndexT s = 0; s < model.numStates(); ++s)
+    {
+        IndexT bestAction;
+        model.maxExpectedUtility(s, &u[0], bestAction);
+        if (bestAction < model.numActions()) resultPolicy->bestAction(model.getState(s), model.getAction(bestAction));
+        else resultPolicy->bestAction(model.getState(s), Action());
+    }
+    return resultPolicy;
+}
+
+
 
 
 
@@ -132,11 +184,16 @@ public:
      * \param _delta starting value for maximum change in the utility of any state. If utility change for a state exceeds
      * this value, it is updated to the new utility change. The changed delta value after applying all states can
      * be retrieved with getNewDelta().
+     * \param _mode the update scheme. With GaussSeidel, a copy of u is made once and then updated
+     * in place, no copies are made between iterations. PrioritizedSweeping is not supported
+     * here, Jacobi is used instead.
      */
     ValueIterationUpdate(UtilityPtrT& u, const RewardConstPtrT& r, const TransitionConstPtrT& t,
                          const ActionGeneratorConstPtrT& ag,
-                         const PolicyConstPtrT& p, float _discount, float _delta):
-        utility(u), tempUtility(u->clone()), reward(r), transition(t), actionGenerator(ag), policy(p), discount(_discount), delta(_delta)
+                         const PolicyConstPtrT& p, float _discount, float _delta,
+                         ValueIterationModeT _mode = Jacobi):
+        utility(_mode == GaussSeidel ? u->clone() : u), tempUtility(_mode == GaussSeidel ? utility : u->clone()),
+        reward(r), transition(t), actionGenerator(ag), policy(p), discount(_discount), delta(_delta), mode(_mode)
     {
 
         assert(utility.get());
@@ -154,6 +211,7 @@ public:
     void preApplication()
     {
         delta = 0;
+        statistics.reset();
     }
 
     /**
@@ -161,6 +219,7 @@ public:
      */
     void postApplication()
     {
+        if (mode == GaussSeidel) return; //utility was updated in place
         //replace utility by copy of newer tempUtility
         utility = UtilityPtrT(tempUtility->clone());
         //and update tempUtility to the newest utility function
@@ -199,9 +258,10 @@ public:
         //PRINTMSG("State "<<s<<": Found utility "<<ut);
         tempUtility->experienceUtility(s, ut); //update utility
 
-        if (policy.get()) return true; //the rest of the operations are not needed for a fixed policy
-
         FloatT newUt = tempUtility->getUtility(s, mean, variance); //a new lookup has to be done, as we don't know how utility values are updated.
+        statistics.add(oldUt, newUt);
+
+        if (policy.get()) return true; //the rest of the operations are not needed for a fixed policy
 
         FloatT utChange = fabs(newUt - oldUt);
         if ((utChange > delta) && !equalFloats(utChange, delta, static_cast<float>(ZERO_EPSILON)))
@@ -213,6 +273,14 @@ public:
         return delta;
     }
 
+    /**
+     * Statistics of the utility changes since the last call of preApplication()
+     */
+    const SweepStatistics& getStatistics() const
+    {
+        return statistics;
+    }
+
     UtilityPtrT getUtility()
     {
         if (!utility.get()) throw Exception("Utility assigned was NULL", __FILE__, __LINE__);
@@ -231,6 +299,8 @@ private:
     PolicyConstPtrT policy;
     float discount;
     float delta;
+    ValueIterationModeT mode;
+    SweepStatistics statistics;
 };
 
 
@@ -271,6 +341,7 @@ public:
     typedef typename PolicyT::PolicyConstPtrT PolicyConstPtrT;
 
     typedef typename StateGeneratorT::StateGeneratorConstPtrT StateGeneratorConstPtrT;
+    typedef typename DomainT::StateIndexerConstPtrT StateIndexerConstPtrT;
 
 
     typedef MaxUtilityActionAlgorithm<StateT, ActionT> MaxUtilityActionAlgorithmT;
@@ -278,11 +349,18 @@ public:
     typedef class PolicyGenerationAlgorithm<StateT, ActionT, UtilityDataTypeT> PolicyGenerationAlgorithmT;
     typedef typename PolicyGenerationAlgorithmT::PolicyGenerationAlgorithmPtrT PolicyGenerationAlgorithmPtrT;
 
+    typedef FlatModel<StateT, ActionT> FlatModelT;
+    typedef typename FlatModelT::FlatModelConstPtrT FlatModelConstPtrT;
+    typedef typename FlatModelT::IndexT IndexT;
+    typedef StoppingCriterion::StoppingCriterionPtrT StoppingCriterionPtrT;
+
     explicit ValueIterationController(DomainConstPtrT _domain, float _defaultUtility,
                                       float _discount, float _maxErr, bool _train = true):
         LearningControllerT(_domain, _train),
-        utility(UtilityT::makePtr(new MappedUtilityT(_defaultUtility))),
-        discount(_discount), maxErr(_maxErr), initialised(false)
+        utility(makeUtility(_domain, _defaultUtility)), defaultUtility(_defaultUtility),
+        discount(_discount), maxErr(_maxErr), mode(Jacobi), useFlatModel(false), numThreads(1),
+        sliceBackups(0), sliceTime(0), anytimeRunning(false), cursor(0), sweepDelta(0), numIterations(0),
+        initialised(false)
     {
     }
     virtual ~ValueIterationController() {}
@@ -291,6 +369,139 @@ public:
     {
         return false;
     }
+
+    /**
+     * If set to true, the domain is compiled into a FlatModel before learning, and
+     * all value iteration updates, the policy generation and the best action lookups
+     * are done on the compiled model. This requires a finite domain, and is only
+     * considered in the next call of initialize().
+     */
+    void setUseFlatModel(bool on)
+    {
+        useFlatModel = on;
+    }
+
+    /**
+     * Sets the update scheme used for value iteration, see ValueIterationModeT.
+     * GaussSeidel and PrioritizedSweeping can't be split across threads, so they ignore
+     * setNumThreads(). PrioritizedSweeping implies setUseFlatModel(true).
+     */
+    void setMode(ValueIterationModeT m)
+    {
+        mode = m;
+        if (mode == PrioritizedSweeping) useFlatModel = true;
+    }
+
+    /**
+     * Sets the number of threads to use for value iteration. If 0, the number
+     * of hardware threads is used. More than one thread is only supported on the
+     * compiled model, so any value other than 1 implies setUseFlatModel(true).
+     */
+    void setNumThreads(unsigned int n)
+    {
+        numThreads = n;
+        if (numThreads != 1) useFlatModel = true;
+    }
+
+    /**
+     * Sets additional termination criteria for value iteration, e.g. a maximum
+     * number of iterations or a deadline. After learning, the criterion
+     * tells which criterion stopped the iterations. NULL to use only the
+     * convergence test determined by maxErr.
+     */
+    void setStoppingCriterion(const StoppingCriterionPtrT& c)
+    {
+        criterion = c;
+    }
+    StoppingCriterionPtrT getStoppingCriterion() const
+    {
+        return criterion;
+    }
+
+    /**
+     * Makes value iteration resumable (anytime): instead of learning until convergence
+     * in initialize(), the domain is only compiled there, and each call of updateAndGetAction()
+     * (while training) performs at most maxBackups state updates, or updates states for at most
+     * maxTime, whichever comes first. In between, getBestAction(), getPolicy() and getUtility()
+     * use the utilities learned so far. finishedLearning() returns -1 until value iteration has
+     * converged (or the stopping criterion has fired).
+     *
+     * Implies setUseFlatModel(true). Supports the Jacobi and GaussSeidel modes on one thread;
+     * PrioritizedSweeping falls back to GaussSeidel. With Jacobi, the published utilities are
+     * the ones of the last complete sweep.
+     *
+     * \param maxBackups maximum number of state updates per call, 0 for no limit
+     * \param maxTime maximum time per call, 0 for no limit. The time is checked every
+     * AnytimeCheckInterval state updates.
+     * If both are 0, value iteration is not resumable (default).
+     */
+    void setAnytime(unsigned long maxBackups, std::chrono::microseconds maxTime = std::chrono::microseconds(0))
+    {
+        sliceBackups = maxBackups;
+        sliceTime = maxTime;
+        if (isAnytime()) useFlatModel = true;
+    }
+
+    bool isAnytime() const
+    {
+        return (sliceBackups > 0) || (sliceTime.count() > 0);
+    }
+
+    /**
+     * Continues resumable value iteration (see setAnytime()) for at most maxBackups state
+     * updates or maxTime (0 for no limit each). Is called from updateAndGetAction() with the
+     * limits passed to setAnytime(), but can also be called directly, e.g. when there is
+     * time left within a control cycle.
+     * \return true if value iteration has converged (also if it is not running)
+     */
+    bool resumeLearning(unsigned long maxBackups, std::chrono::microseconds maxTime)
+    {
+        if (!anytimeRunning) return true;
+        typedef std::chrono::steady_clock ClockT;
+        ClockT::time_point sliceEnd = ClockT::now() + maxTime;
+        IndexT nStates = flatModel->numStates();
+        float discountRatio = static_cast<float>(1.0 - discount) / static_cast<float>(discount);
+        float minDelta = maxErr * discountRatio;
+        bool converged = (nStates == 0);
+        unsigned long done = 0;
+        while (!converged)
+        {
+            IndexT end = nStates;
+            if (maxBackups > 0) end = std::min<unsigned long>(end, cursor + (maxBackups - done));
+            if (maxTime.count() > 0) end = std::min<unsigned long>(end, cursor + AnytimeCheckInterval);
+            float * target = (mode == Jacobi) ? &anytimeTempU[0] : &flatUtility[0];
+            float d = flatModel->sweep(cursor, end, discount, &flatUtility[0], target, sweepStats);
+            if ((d > sweepDelta) && !equalFloats(d, sweepDelta, static_cast<float>(ZERO_EPSILON)))
+                sweepDelta = d;
+            done += end - cursor;
+            cursor = end;
+            if (cursor == nStates)
+            {
+                if (mode == Jacobi) flatUtility.swap(anytimeTempU);
+                PRINTMSG("Finished iteration, delta=" << sweepDelta << ", iteration number=" << numIterations);
+                ++numIterations;
+                converged = !(sweepDelta > minDelta);
+                if (criterion.get() && criterion->update(sweepStats)) converged = true;
+                cursor = 0;
+                sweepDelta = 0;
+                sweepStats.reset();
+            }
+            if ((maxBackups > 0) && (done >= maxBackups)) break;
+            if ((maxTime.count() > 0) && (ClockT::now() >= sliceEnd)) break;
+        }
+        if (!converged) return false;
+
+        anytimeRunning = false;
+        anytimeTempU.clear();
+        if (criterion.get() && (criterion->getReason() == StoppingCriterion::NotStopped)) criterion->setConverged();
+        PRINTMSG("Number of iterations: " << numIterations);
+        if (criterion.get()) PRINTMSG("Stopped because of: " << StoppingCriterion::getReasonName(criterion->getReason()));
+        UtilityPtrT newUt = utility->clone();
+        flatModel->writeUtility(flatUtility, *newUt);
+        utility = newUt;
+        return true;
+    }
+
     virtual PolicyConstPtrT getPolicy()const
     {
         if (!initialised)
@@ -298,6 +509,10 @@ public:
             PRINTERROR("Can't get policy, because learning has not been successful.");
             return NULL;
         }
+        if (flatModel.get())
+        {
+            return flatPolicyGeneration(*flatModel, flatUtility);
+        }
         TransitionConstPtrT trans = this->domain->getTransition(); //XXX this can be optimised to keep globally
         if (!trans.get())
         {
@@ -323,6 +538,13 @@ public:
     }
     virtual UtilityConstPtrT getUtility()const
     {
+        if (anytimeRunning)
+        {
+            // publish the utilities learned so far
+            UtilityPtrT currUt = utility->clone();
+            flatModel->writeUtility(flatUtility, *currUt);
+            return currUt;
+        }
         return utility;
     }
 
@@ -332,7 +554,8 @@ public:
 
     virtual int finishedLearning()const
     {
-        return initialised ? 2 : -2;
+        if (!initialised) return -2;
+        return anytimeRunning ? -1 : 2;
     }
 
     virtual void printValues(std::ostream& o) const
@@ -349,8 +572,137 @@ public:
         o << strng.str();
     }
 
+    /**
+     * Saves the utilities of all states of the state generator to a binary checkpoint
+     * (see CheckpointHeader), with one row per state, identified by the StateIndexer of
+     * the domain. Value iteration changes the utilities of all states in each sweep,
+     * so each save writes the whole checkpoint.
+     * \return false if the domain has no state indexer or state generator, or the file
+     *      could not be written
+     */
+    bool saveCheckpoint(const std::string& path) const
+    {
+        StateIndexerConstPtrT indexer = this->domain->getStateIndexer();
+        StateGeneratorConstPtrT stateGenerator = this->domain->getStateGenerator();
+        if (!indexer.get() || !stateGenerator.get())
+        {
+            PRINTERROR("Checkpoints need a state indexer and a state generator of the domain");
+            return false;
+        }
+        std::vector<StateT> states;
+        StateCollector collector(states);
+        if (!stateGenerator->foreachState(collector) || states.empty())
+        {
+            PRINTERROR("Could not generate the states to save");
+            return false;
+        }
+        UtilityConstPtrT u = getUtility();
+        size_t n = states.size();
+        std::vector<uint32_t> ids(n);
+        std::vector<UtilityDataTypeT> values(n);
+        std::vector<uint8_t> flags(n, 1);
+        std::vector<uint32_t> index(indexer->size(), static_cast<uint32_t>(CheckpointHeader::NoRow));
+        float mean, variance;
+        for (size_t i = 0; i < n; ++i)
+        {
+            ids[i] = indexer->toIndex(states[i]);
+            if (ids[i] >= index.size())
+            {
+                PRINTERROR("The state indexer maps " << states[i] << " to " << ids[i] << ", which is out of its range");
+                return false;
+            }
+            index[ids[i]] = i;
+            values[i] = u->getUtility(states[i], mean, variance);
+        }
+        CheckpointWriter writer;
+        CheckpointHeader header = CheckpointHeader::make(CheckpointHeader::Utilities, sizeof(UtilityDataTypeT), 0,
+                                  1, indexer->size(), n, defaultUtility);
+        return writer.create(path, header) && writer.writeRows(0, n, &ids[0], &values[0], NULL, &flags[0])
+               && writer.writeIndex(&index[0]) && writer.commit(n);
+    }
+
+    /**
+     * Replaces the utilities by the ones in a checkpoint saved with saveCheckpoint(), for
+     * a domain with the same state indexer. To use them without solving the domain again,
+     * call setTraining(false) before initialize(). To answer queries directly from a mapped
+     * checkpoint instead, see CheckpointUtility.
+     * \return false if the checkpoint could not be opened or does not fit, in which case
+     *      the utilities are unchanged
+     */
+    bool loadCheckpoint(const std::string& path)
+    {
+        StateIndexerConstPtrT indexer = this->domain->getStateIndexer();
+        if (!indexer.get())
+        {
+            PRINTERROR("Checkpoints need a state indexer of the domain");
+            return false;
+        }
+        CheckpointFile file;
+        if (!file.open(path)) return false;
+        if (!file.check(CheckpointHeader::Utilities, sizeof(UtilityDataTypeT), 0, 1, indexer->size())) return false;
+        // read again if a writer has committed in the meantime
+        UtilityPtrT newUt;
+        uint64_t g;
+        do
+        {
+            g = file.getGeneration();
+            uint64_t numRows = file.numRows(g);
+            const uint32_t * ids = file.getRowIds(g);
+            const UtilityDataTypeT * values = file.getValues<UtilityDataTypeT>(g);
+            newUt = makeUtility(this->domain, defaultUtility);
+            for (uint64_t r = 0; r < numRows; ++r)
+            {
+                if (ids[r] >= indexer->size())
+                {
+                    PRINTERROR("The checkpoint " << path << " has the state id " << ids[r] << " out of range");
+                    return false;
+                }
+                newUt->experienceUtility(indexer->fromIndex(ids[r]), values[r]);
+            }
+        }
+        while (!file.isCurrent(g));
+        utility = newUt;
+        // the utilities of a compiled model are the ones of the last learning
+        flatModel.reset();
+        flatUtility.clear();
+        anytimeRunning = false;
+        return true;
+    }
+
 protected:
     typedef MappedUtility<StateT> MappedUtilityT;
+    typedef IndexedUtility<StateT> IndexedUtilityT;
+
+    /**
+     * Creates an IndexedUtility if the domain provides a state indexer, and
+     * a MappedUtility otherwise.
+     */
+    static UtilityPtrT makeUtility(const DomainConstPtrT& domain, float defaultUtility)
+    {
+        if (domain.get() && domain->getStateIndexer().get())
+        {
+            return UtilityT::makePtr(new IndexedUtilityT(domain->getStateIndexer(), defaultUtility));
+        }
+        return UtilityT::makePtr(new MappedUtilityT(defaultUtility));
+    }
+
+    /**
+     * Collects the states generated by a StateGenerator
+     */
+    class StateCollector: public StateAlgorithm<StateT>
+    {
+    public:
+        explicit StateCollector(std::vector<StateT>& _states): states(_states) {}
+        virtual ~StateCollector() {}
+        virtual bool apply(const StateT& s)
+        {
+            states.push_back(s);
+            return true;
+        }
+    private:
+        std::vector<StateT>& states;
+    };
+
     /**
      */
     virtual bool learnOffline(const StateT& currState)
@@ -366,8 +718,53 @@ protected:
             return false;
         }
 
+        if (useFlatModel)
+        {
+            flatModel = FlatModelT::compile(*(this->domain));
+            if (!flatModel.get())
+            {
+                PRINTERROR("Could not compile the domain into a flat model");
+                return false;
+            }
+            flatModel->readUtility(*utility, flatUtility);
+            if (isAnytime())
+            {
+                if (numThreads != 1) PRINTMSG("WARNING: Resumable value iteration runs on one thread only");
+                if (mode == PrioritizedSweeping)
+                {
+                    PRINTMSG("WARNING: Resumable value iteration does not support prioritized sweeping, using Gauss-Seidel");
+                    mode = GaussSeidel;
+                }
+                PRINTMSG("Starting resumable value iteration with discount=" << discount << ", maxErr=" << maxErr
+                         << (mode == GaussSeidel ? " (Gauss-Seidel)" : ""));
+                if (mode == Jacobi) anytimeTempU = flatUtility;
+                cursor = 0;
+                sweepDelta = 0;
+                numIterations = 0;
+                sweepStats.reset();
+                if (criterion.get()) criterion->start();
+                anytimeRunning = true;
+                return true;
+            }
+            if ((numThreads != 1) && (mode == Jacobi))
+            {
+                parallelValueIteration(*flatModel, flatUtility, discount, maxErr, numThreads, criterion);
+            }
+            else
+            {
+                if (numThreads != 1) PRINTMSG("WARNING: This value iteration mode runs on one thread only");
+                valueIteration(*flatModel, flatUtility, discount, maxErr, mode, criterion);
+            }
+            UtilityPtrT newUt = utility->clone();
+            flatModel->writeUtility(flatUtility, *newUt);
+            utility = newUt;
+            return true;
+        }
+        flatModel = FlatModelConstPtrT();
+
         UtilityPtrT newUt = valueIteration(utility, this->domain->getReward(), this->domain->getTransition(),
-                                           this->domain->getActionGenerator(), this->domain->getStateGenerator(), discount, maxErr);
+                                           this->domain->getActionGenerator(), this->domain->getStateGenerator(),
+                                           discount, maxErr, mode, criterion);
 
         if (!newUt.get())
         {
@@ -385,6 +782,14 @@ protected:
             PRINTERROR("Can't get best action, because learning has not been successful.");
             return ActionT(); //return default action
         }
+        IndexT stateIdx;
+        if (flatModel.get() && flatModel->getStateIndex(currentState, stateIdx))
+        {
+            IndexT bestAction;
+            flatModel->maxExpectedUtility(stateIdx, &flatUtility[0], bestAction);
+            if (bestAction < flatModel->numActions()) return flatModel->getAction(bestAction);
+            return ActionT(); //no action exceeded utility 0
+        }
         TransitionConstPtrT trans = this->domain->getTransition(); //XXX this can be optimised to keep globally
 
         //choose the action which leads to be state with the best utility:
@@ -398,6 +803,15 @@ protected:
         return maxUt.getBestAction();
     }
 
+    /**
+     * Continues resumable value iteration, see setAnytime()
+     */
+    virtual bool learnOnline(const StateT&)
+    {
+        resumeLearning(sliceBackups, sliceTime);
+        return true;
+    }
+
     virtual bool initializeImpl(const StateT& startState)
     {
         initialised = true;
@@ -408,8 +822,26 @@ protected:
     ValueIterationController() {}
 private:
     UtilityPtrT utility;
+    float defaultUtility;
     float discount;
     float maxErr;
+    ValueIterationModeT mode;
+    bool useFlatModel;
+    unsigned int numThreads;
+    StoppingCriterionPtrT criterion;
+    FlatModelConstPtrT flatModel;  // compiled model, if useFlatModel was set at the time of learning
+    std::vector<UtilityDataTypeT> flatUtility;  // utilities indexed by state index of flatModel
+
+    // state of resumable value iteration, see setAnytime()
+    enum {AnytimeCheckInterval = 256};
+    unsigned long sliceBackups;
+    std::chrono::microseconds sliceTime;
+    bool anytimeRunning;
+    std::vector<UtilityDataTypeT> anytimeTempU;  // target of the current sweep in Jacobi mode
+    IndexT cursor;  // the next state to update in the current sweep
+    float sweepDelta;  // maximum utility change in the current sweep so far
+    SweepStatistics sweepStats;
+    unsigned int numIterations;
     bool initialised;
 };
 
@@ -431,6 +863,10 @@ private:
  * \param sg state generator to use.
  * \param discount discount factor
  * \param maxErr maximum error allowed in the utility of any state (determines termination criterion).
+ * \param mode the update scheme, see ValueIterationModeT. PrioritizedSweeping is only
+ * supported by the valueIteration() working on a FlatModel.
+ * \param criterion optional additional termination criteria (e.g. maximum number of iterations
+ * or a deadline). After return, it tells which criterion stopped the iterations.
  * \author Jennifer Buehler
  * \date May 2011
  */
@@ -441,7 +877,8 @@ std::shared_ptr<Utility<State> > valueIteration(
     const std::shared_ptr<const Transition<State, Action> > t,
     const std::shared_ptr<const ActionGenerator<Action> > ag,
     const std::shared_ptr<const StateGenerator<State> > sg,
-    float discount, float maxErr)
+    float discount, float maxErr, ValueIterationModeT mode = Jacobi,
+    StoppingCriterion::StoppingCriterionPtrT criterion = StoppingCriterion::StoppingCriterionPtrT())
 {
     /*template<class State, class Action>
     std::shared_ptr<Utility<State> > valueIteration(
@@ -482,14 +919,22 @@ std::shared_ptr<Utility<State> > valueIteration(
 
 
 
+    if (mode == PrioritizedSweeping)
+    {
+        PRINTERROR("Prioritized sweeping requires a compiled FlatModel");
+        return NULL;
+    }
+
     float delta = 0;
     float discountRatio = static_cast<float>(1.0 - discount) / static_cast<float>(discount);
     float minDelta = maxErr * discountRatio;
     PRINTMSG("Starting value iteration with discount=" << discount << ", discountRatio=" 
-        << discountRatio << ", maxErr=" << maxErr << ", minDelta=" << minDelta);
+        << discountRatio << ", maxErr=" << maxErr << ", minDelta=" << minDelta
+        << (mode == GaussSeidel ? " (Gauss-Seidel)" : ""));
     unsigned int cnt = 0;
     ValueIterationUpdate<State, Action> valueIterationUpdate(utility, reward, transition,
-                                                             actionGen, nullPolicy, discount, delta);
+                                                             actionGen, nullPolicy, discount, delta, mode);
+    if (criterion.get()) criterion->start();
     do
     {
         valueIterationUpdate.preApplication();
@@ -503,12 +948,92 @@ std::shared_ptr<Utility<State> > valueIteration(
         PRINTMSG("Finished iteration, delta=" << delta << ", iteration number=" << cnt);
         ++cnt;
         //if (cnt==19) {PRINTMSG("WARN: Break here"); break;}
+        if (criterion.get() && criterion->update(valueIterationUpdate.getStatistics())) break;
     }
     while ((delta > minDelta) || ((delta > minDelta) && (!equalFloats(delta, minDelta, static_cast<float>(ZERO_EPSILON)))));
 
+    if (criterion.get() && (criterion->getReason() == StoppingCriterion::NotStopped)) criterion->setConverged();
     PRINTMSG("Number of iterations: " << cnt);
+    if (criterion.get()) PRINTMSG("Stopped because of: " << StoppingCriterion::getReasonName(criterion->getReason()));
     return valueIterationUpdate.getUtility();
 }
 
+
+/**
+ * Fast path of the value iteration algorithm working on a compiled model.
+ * Performs the same updates and uses the same termination criterion as the
+ * valueIteration() function working on the Utility, Reward and Transition interfaces,
+ * so the resulting utilities are identical, but no virtual calls, map lookups and
+ * allocations are needed within the iterations.
+ * \param model the compiled model
+ * \param u initial utility of each state in the model, indexed by state index. Will
+ * contain the resulting utilities.
+ * \param discount discount factor
+ * \param maxErr maximum error allowed in the utility of any state (determines termination criterion).
+ * \param mode the update scheme, see ValueIterationModeT. With GaussSeidel, u is updated
+ * in place and no memory is allocated. With PrioritizedSweeping, prioritizedSweeping() is used.
+ * \param criterion optional additional termination criteria (e.g. maximum number of iterations
+ * or a deadline). After return, it tells which criterion stopped the iterations.
+ * \return the number of iterations performed. For PrioritizedSweeping, this is the
+ * number of state updates divided by the number of states (rounded up).
+ */
+template<class State, class Action>
+unsigned int valueIteration(const FlatModel<State, Action>& model, std::vector<float>& u,
+                            float discount, float maxErr, ValueIterationModeT mode = Jacobi,
+                            StoppingCriterion::StoppingCriterionPtrT criterion = StoppingCriterion::StoppingCriterionPtrT())
+{
+    if (mode == PrioritizedSweeping)
+    {
+        unsigned long backups = prioritizedSweeping(model, u, discount, maxErr, 0, criterion);
+        if (model.numStates() == 0) return 0;
+        return (backups + model.numStates() - 1) / model.numStates();
+    }
+
+    u.resize(model.numStates());
+    if (model.numStates() == 0) return 0;  // nothing to update
+    std::vector<float> tempU;
+    if (mode == Jacobi) tempU = u;
+    float * target = (mode == Jacobi) ? &tempU[0] : &u[0];
+
+    float delta = 0;
+    float discountRatio = static_cast<float>(1.0 - discount) / static_cast<float>(discount);
+    float minDelta = maxErr * discountRatio;
+    PRINTMSG("Starting flat value iteration with discount=" << discount << ", discountRatio="
+        << discountRatio << ", maxErr=" << maxErr << ", minDelta=" << minDelta
+        << (mode == GaussSeidel ? " (Gauss-Seidel)" : ""));
+    unsigned int cnt = 0;
+    SweepStatistics stats;
+    if (criterion.get()) criterion->start();
+    do
+    {
+        if (criterion.get())
+        {
+            stats.reset();
+            bool expired;
+            delta = model.sweep(0, model.numStates(), discount, &u[0], target, stats, *criterion, expired);
+            // an incomplete Jacobi sweep is dropped, so u keeps the last complete one
+            if (expired && criterion->checkDeadline()) break;
+        }
+        else
+        {
+            delta = model.sweep(0, model.numStates(), discount, &u[0], target);
+        }
+        if (mode == Jacobi)
+        {
+            u.swap(tempU);
+            target = &tempU[0];
+        }
+        PRINTMSG("Finished iteration, delta=" << delta << ", iteration number=" << cnt);
+        ++cnt;
+        if (criterion.get() && criterion->update(stats)) break;
+    }
+    while (delta > minDelta);
+
+    if (criterion.get() && (criterion->getReason() == StoppingCriterion::NotStopped)) criterion->setConverged();
+    PRINTMSG("Number of iterations: " << cnt);
+    if (criterion.get()) PRINTMSG("Stopped because of: " << StoppingCriterion::getReasonName(criterion->getReason()));
+    return cnt;
+}
+
 }
 #endif
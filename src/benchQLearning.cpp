@@ -0,0 +1,491 @@
+/*
+ * Benchmark of the q-learning step on the grid world: measures the number of
+ * steps per second and the number of heap allocations done by
+ * QLearningController::updateAndGetAction() once the q-table has been filled.
+ * With --hogwild, measures the steps per second of HogwildQLearning instead,
+ * for 1, 2, 4, ... worker threads, and with --actor-learner, the throughput of
+ * each stage of ActorLearner. With --batch, the grid world is run in lanes by
+ * GridDomainBatch, and the transitions per second are measured for the batched
+ * environment alone and together with QLearningController::updateAndGetActions().
+ * The single-threaded step is measured for the default controller and for a lean
+ * one, which is compiled without the statistics of the q-value changes and without
+ * the transition model. With --rng, measures the random numbers per second of rand()
+ * and of the engines of RandomNumberGenerator. --alias lets the grid world sample
+ * the successor states from alias tables (enableAliasSampling()).
+ * With --checkpoint, measures the full and the incremental QLearningController::saveCheckpoint(),
+ * loadCheckpoint(), and the greedy action lookups of a CheckpointPolicy on the mapped file.
+ *
+ * \author Jennifer Buehler
+ * \copyright Jennifer Buehler, GPL
+ */
+
+#include <rl/ValueIteration.h>
+#include <rl/PolicyIteration.h>
+#include <rl/LogBinding.h>
+#include <rl/GridWorld.h>
+#include <rl/GridWorldSampling.h>
+#include <rl/Utility.h>
+#include <rl/QLearning.h>
+#include <rl/HogwildQLearning.h>
+#include <rl/ActorLearner.h>
+#include <rl/GridWorldBatch.h>
+
+#include <chrono>
+#include <algorithm>
+#include <new>
+#include <string>
+#include <vector>
+#include <stdlib.h>
+
+using rl::QLearningController;
+using rl::NoChangeStatistics;
+using rl::NoTransitionModel;
+using rl::HogwildQLearning;
+using rl::ActorLearner;
+using rl::GridDomain;
+using rl::GridDomainBatch;
+using rl::enableAliasSampling;
+using rl::CheckpointFile;
+using rl::CheckpointPolicy;
+using rl::Exploration;
+using rl::SimpleExploration;
+using rl::LearningRate;
+using rl::DecayLearningRate;
+
+// counts the allocations while countAllocations is set
+static bool countAllocations = false;
+static unsigned long numAllocations = 0;
+
+// The replacements are not inlined: the compiler would otherwise see the free() of operator
+// delete called on the result of a new expression, and warn with -Wmismatched-new-delete.
+__attribute__((noinline)) void * operator new(size_t size)
+{
+    if (countAllocations) ++numAllocations;
+    void * p = malloc(size == 0 ? 1 : size);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+__attribute__((noinline)) void operator delete(void * p) noexcept
+{
+    free(p);
+}
+
+__attribute__((noinline)) void operator delete(void * p, size_t) noexcept
+{
+    free(p);
+}
+
+/**
+ * Runs q-learning on the grid world for the given number of steps, and returns the number
+ * of steps per second. The allocations done within updateAndGetAction() are added to numAllocations.
+ * \param countSteps if true, the allocations of the steps are counted
+ */
+template<class QLearningControllerT>
+double runSteps(QLearningControllerT& q, GridDomain& gridWorld, GridDomain::StateT& currState,
+                unsigned long steps, bool countSteps)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (unsigned long i = 0; i < steps; ++i)
+    {
+        countAllocations = countSteps;
+        GridDomain::ActionT currAction = q.updateAndGetAction(currState);
+        countAllocations = false;
+        if (gridWorld.isTerminalState(currState))
+        {
+            while (gridWorld.isTerminalState(currState))
+            {
+                currState = gridWorld.getStateGenerator()->randomState();
+            }
+            q.resetStartState(currState);
+        }
+        currState = gridWorld.transferState(currState, currAction);
+    }
+    double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return steps / sec;
+}
+
+/**
+ * Trains HogwildQLearning on the grid world with 1, 2, 4, ... and maxThreads threads,
+ * with the given number of steps altogether, and prints the steps per second for each.
+ */
+void benchHogwild(const GridDomain::GridDomainPtrT& gridWorld, unsigned int maxThreads, unsigned long steps)
+{
+    typedef Exploration<float, unsigned int> ExplorationT;
+    typedef SimpleExploration<float, unsigned int> SimpleExplorationT;
+    typedef HogwildQLearning<GridDomain> HogwildQLearningT;
+    if (maxThreads == 0) maxThreads = std::thread::hardware_concurrency();
+    if (maxThreads == 0) maxThreads = 1;
+    for (unsigned int numThreads = 1; numThreads <= maxThreads; numThreads = (numThreads == maxThreads) ? numThreads + 1 :
+            std::min(2 * numThreads, maxThreads))
+    {
+        LearningRate::LearningRatePtrT learnRate(new DecayLearningRate(0.1));
+        ExplorationT::ExplorationPtrT explore(new SimpleExplorationT(20, gridWorld->getReward()->getOptimisticReward()));
+        HogwildQLearningT hogwild(gridWorld, learnRate, 1.0, 0.0, explore, 0.1);
+        if (!hogwild.train(numThreads, steps / numThreads)) return;
+        const rl::HogwildStatistics& stats = hogwild.getLastStatistics();
+        PRINTMSG("Hogwild with " << numThreads << " threads: " << stats.steps << " steps, " << stats.episodes
+                 << " episodes in " << stats.seconds << " s, " << stats.stepsPerSecond() << " steps/sec ("
+                 << stats.stepsPerSecondPerThread() << " per thread)");
+    }
+}
+
+/**
+ * Runs ActorLearner on the grid world with numActors actors and the given number of steps
+ * altogether, and prints the counters of the pipeline stages.
+ */
+void benchActorLearner(const GridDomain::GridDomainPtrT& gridWorld, unsigned int numActors, unsigned long steps)
+{
+    typedef Exploration<float, unsigned int> ExplorationT;
+    typedef SimpleExploration<float, unsigned int> SimpleExplorationT;
+    typedef QLearningController<GridDomain> QLearningControllerT;
+    typedef ActorLearner<QLearningControllerT> ActorLearnerT;
+    if (numActors == 0) numActors = 1;
+    LearningRate::LearningRatePtrT learnRate(new DecayLearningRate(0.1));
+    ExplorationT::ExplorationPtrT explore(new SimpleExplorationT(20, gridWorld->getReward()->getOptimisticReward()));
+    ActorLearnerT::ControllerPtrT q(new QLearningControllerT(gridWorld, learnRate, 1.0, 0.0, explore, 0.1));
+    ActorLearnerT actorLearner(gridWorld, q, 0.1);
+    if (!actorLearner.run(numActors, steps / numActors)) return;
+    const rl::ActorLearnerStatistics& stats = actorLearner.getLastStatistics();
+    PRINTMSG("Actor-learner with " << numActors << " actors in " << stats.seconds << " s: actors "
+             << stats.actorSteps << " steps, " << stats.episodes << " episodes, " << stats.actorStepsPerSecond()
+             << " steps/sec, " << stats.fullWaits << " waits for a full queue; learner " << stats.updates
+             << " updates in " << stats.batches << " batches, " << stats.updatesPerSecond() << " updates/sec ("
+             << stats.learnerCapacity() << " when busy), " << stats.emptyPolls << " polls of an empty queue, "
+             << stats.snapshots << " policy snapshots");
+}
+
+/**
+ * Runs the grid world in numLanes lanes with GridDomainBatch, first with a fixed
+ * pattern of actions and then learning with the batched q-learning step, and
+ * prints the transitions per second of both.
+ */
+void benchBatch(const GridDomain::GridDomainPtrT& gridWorld, GridDomainBatch& batch, unsigned long steps)
+{
+    typedef Exploration<float, unsigned int> ExplorationT;
+    typedef SimpleExploration<float, unsigned int> SimpleExplorationT;
+    typedef QLearningController<GridDomain> QLearningControllerT;
+    const unsigned int numLanes = batch.numLanes();
+    unsigned long numSteps = steps / numLanes;
+    if (numSteps == 0) numSteps = 1;
+
+    // the environment alone
+    std::vector<GridDomainBatch::CoordT> moves(numLanes);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (unsigned long k = 0; k < numSteps; ++k)
+    {
+        for (unsigned int i = 0; i < numLanes; ++i)
+        {
+            moves[i] = (i + k) % 4;
+        }
+        batch.step(&moves[0]);
+    }
+    double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    PRINTMSG("Batch of " << numLanes << " lanes, environment only: " << (numSteps * numLanes) << " transitions, "
+             << batch.getEpisodes() << " episodes, " << ((numSteps * numLanes) / sec) << " transitions/sec");
+
+    // the environment with the batched q-learning step, after a warm-up of the same length
+    LearningRate::LearningRatePtrT learnRate(new DecayLearningRate(0.1));
+    ExplorationT::ExplorationPtrT explore(new SimpleExplorationT(20, gridWorld->getReward()->getOptimisticReward()));
+    QLearningControllerT q(gridWorld, learnRate, 1.0, 0.0, explore, 0.1);
+    q.initialize(gridWorld->getStartState());
+    std::vector<GridDomain::ActionT> actions(numLanes);
+    for (int run = 0; run < 2; ++run)
+    {
+        unsigned long episodes = batch.getEpisodes();
+        start = std::chrono::steady_clock::now();
+        for (unsigned long k = 0; k < numSteps; ++k)
+        {
+            q.updateAndGetActions(batch.getStates(), batch.getRewards(), &actions[0], numLanes);
+            batch.step(&actions[0]);
+        }
+        sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (run == 0) continue;
+        PRINTMSG("Batch of " << numLanes << " lanes with q-learning: " << (numSteps * numLanes) << " transitions, "
+                 << (batch.getEpisodes() - episodes) << " episodes, " << ((numSteps * numLanes) / sec)
+                 << " transitions/sec");
+    }
+}
+
+/**
+ * Measures the steps per second and the allocations of updateAndGetAction() of the
+ * controller type QLearningControllerT, after a warm-up of the same number of steps.
+ * \return false if the step allocated memory
+ */
+template<class QLearningControllerT>
+bool benchStep(const std::string& name, const GridDomain::GridDomainPtrT& gridWorld,
+               unsigned int gridX, unsigned int gridY, unsigned long steps)
+{
+    typedef Exploration<float, unsigned int> ExplorationT;
+    typedef SimpleExploration<float, unsigned int> SimpleExplorationT;
+    LearningRate::LearningRatePtrT learnRate(new DecayLearningRate(0.1));
+    ExplorationT::ExplorationPtrT explore(new SimpleExplorationT(20, gridWorld->getReward()->getOptimisticReward()));
+    QLearningControllerT q(gridWorld, learnRate, 1.0, 0.0, explore, 0.1);
+
+    GridDomain::StateT currState = gridWorld->getStartState();
+    q.initialize(currState);
+
+    // warm up until all states have been visited and the q-table does not grow any more
+    runSteps(q, *gridWorld, currState, steps, false);
+
+    numAllocations = 0;
+    double stepsPerSec = runSteps(q, *gridWorld, currState, steps, true);
+    PRINTMSG(name << " controller, grid " << gridX << "x" << gridY << ", "
+             << steps << " steps: " << stepsPerSec << " steps/sec, "
+             << numAllocations << " allocations in updateAndGetAction() ("
+             << (static_cast<double>(numAllocations) / steps) << " per step)");
+    if (numAllocations > 0)
+    {
+        PRINTERROR("The q-learning step is expected not to allocate memory once the q-table is filled");
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Draws n uniform floats with draw and returns the number per second. The sum is
+ * passed to sink so that the compiler can't remove the loop.
+ */
+template<class Draw>
+double drawRandom(Draw draw, unsigned long n, float& sink)
+{
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    float sum = 0;
+    for (unsigned long i = 0; i < n; ++i) sum += draw();
+    double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    sink += sum;
+    return n / sec;
+}
+
+struct RandDraw
+{
+    float operator()()
+    {
+        return static_cast<float>(rand()) / static_cast<float>(RAND_MAX);
+    }
+};
+
+struct ThreadStreamDraw
+{
+    float operator()()
+    {
+        return RandomNumberGenerator::uniform();
+    }
+};
+
+template<class EngineT>
+struct EngineDraw
+{
+    explicit EngineDraw(EngineT& _e): e(_e) {}
+    float operator()()
+    {
+        return e.uniform();
+    }
+    EngineT& e;
+};
+
+/**
+ * Prints the uniform floats per second of rand(), the thread stream of RandomNumberGenerator,
+ * the engines themselves, and of filling a buffer with Xoshiro256StarStar::fill().
+ */
+void benchRandom(unsigned long n)
+{
+    float sink = 0;
+    Xoshiro256StarStar xoshiro(RandomNumberGenerator::newStream());
+    Pcg32 pcg(RandomNumberGenerator::random(), 1);
+    PRINTMSG("rand(): " << drawRandom(RandDraw(), n, sink) << " numbers/sec");
+    PRINTMSG("RandomNumberGenerator::uniform(): " << drawRandom(ThreadStreamDraw(), n, sink) << " numbers/sec");
+    PRINTMSG("Xoshiro256StarStar::uniform(): "
+             << drawRandom(EngineDraw<Xoshiro256StarStar>(xoshiro), n, sink) << " numbers/sec");
+    PRINTMSG("Pcg32::uniform(): " << drawRandom(EngineDraw<Pcg32>(pcg), n, sink) << " numbers/sec");
+
+    std::vector<float> buf(4096);
+    unsigned long blocks = n / buf.size() + 1;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (unsigned long k = 0; k < blocks; ++k)
+    {
+        xoshiro.fill(&buf[0], buf.size());
+        sink += buf[k % buf.size()];
+    }
+    double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    PRINTMSG("Xoshiro256StarStar::fill(): " << (blocks * buf.size() / sec) << " numbers/sec (checksum " << sink << ")");
+}
+
+static double msSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+/**
+ * Learns for the given number of steps and saves a checkpoint at path, then learns
+ * for a tenth of the steps and saves again, which only writes the changed q-table entries.
+ * Then loads the checkpoint into a new controller, and compares the greedy action
+ * lookups of the controller with the ones of a CheckpointPolicy on the mapped file.
+ */
+bool benchCheckpoint(const GridDomain::GridDomainPtrT& gridWorld, const std::string& path, unsigned long steps)
+{
+    typedef Exploration<float, unsigned int> ExplorationT;
+    typedef SimpleExploration<float, unsigned int> SimpleExplorationT;
+    typedef QLearningController<GridDomain> QLearningControllerT;
+    typedef CheckpointPolicy<GridDomain::StateT, GridDomain::ActionT> CheckpointPolicyT;
+    LearningRate::LearningRatePtrT learnRate(new DecayLearningRate(0.1));
+    ExplorationT::ExplorationPtrT explore(new SimpleExplorationT(20, gridWorld->getReward()->getOptimisticReward()));
+    QLearningControllerT q(gridWorld, learnRate, 1.0, 0.0, explore, 0.1);
+    GridDomain::StateT currState = gridWorld->getStartState();
+    q.initialize(currState);
+
+    runSteps(q, *gridWorld, currState, steps, false);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    if (!q.saveCheckpoint(path)) return false;
+    PRINTMSG("Full save: " << msSince(start) << " ms");
+    runSteps(q, *gridWorld, currState, steps / 10, false);
+    start = std::chrono::steady_clock::now();
+    if (!q.saveCheckpoint(path)) return false;
+    PRINTMSG("Incremental save after " << (steps / 10) << " steps: " << msSince(start) << " ms");
+
+    QLearningControllerT loaded(gridWorld, learnRate, 1.0, 0.0, explore, 0.1);
+    start = std::chrono::steady_clock::now();
+    if (!loaded.loadCheckpoint(path)) return false;
+    PRINTMSG("Load into the q-table: " << msSince(start) << " ms");
+
+    CheckpointFile::CheckpointFilePtrT file(new CheckpointFile());
+    start = std::chrono::steady_clock::now();
+    if (!file->open(path)) return false;
+    CheckpointPolicyT policy(file, gridWorld->getStateIndexer(), gridWorld->getActionIndexer());
+    PRINTMSG("Map of " << file->numRows(file->getGeneration()) << " states: " << msSince(start) << " ms");
+
+    // look up the greedy action of random states with both
+    std::vector<GridDomain::StateT> states(steps);
+    for (unsigned long i = 0; i < steps; ++i) states[i] = gridWorld->getStateGenerator()->randomState();
+    unsigned long found = 0;
+    GridDomain::ActionT a1, a2;
+    start = std::chrono::steady_clock::now();
+    for (unsigned long i = 0; i < steps; ++i) found += loaded.getGreedyAction(states[i], a1) ? 1 : 0;
+    double qTime = msSince(start);
+    start = std::chrono::steady_clock::now();
+    for (unsigned long i = 0; i < steps; ++i) found += policy.getAction(states[i], a2) ? 1 : 0;
+    double mappedTime = msSince(start);
+    unsigned long mismatches = 0;
+    for (unsigned long i = 0; i < steps; ++i)
+    {
+        bool h1 = q.getGreedyAction(states[i], a1);
+        bool h2 = policy.getAction(states[i], a2);
+        if ((h1 != h2) || (h1 && ((a1 < a2) || (a2 < a1)))) ++mismatches;
+    }
+    PRINTMSG("Greedy lookups/sec: q-table " << (steps / qTime * 1000) << ", mapped checkpoint "
+             << (steps / mappedTime * 1000) << " (" << found << " found, " << mismatches
+             << " differ from the learning controller)");
+    if (mismatches > 0)
+    {
+        PRINTERROR("The mapped checkpoint does not match the q-table it was saved from");
+        return false;
+    }
+    return true;
+}
+
+void printHelp(const char*argv0)
+{
+    PRINTMSG("Usage: " << argv0 << " [--grid <x> <y>] [--steps <n>] [--alias] [--hogwild <max threads> | --actor-learner <actors> | --batch <lanes> | --rng | --checkpoint <path>]");
+}
+
+int main(int argc, char **argv)
+{
+    PRINT_INIT();
+    unsigned int gridX = 4;
+    unsigned int gridY = 3;
+    unsigned long steps = 1000000;
+    bool hogwild = false;
+    unsigned int maxThreads = 0;
+    bool actorLearner = false;
+    unsigned int numActors = 1;
+    unsigned int numLanes = 0;
+    bool rng = false;
+    bool alias = false;
+    std::string checkpointPath;
+    for (int i = 1; i < argc; ++i)
+    {
+        if ((std::string(argv[i]) == "--grid") && (i + 2 < argc))
+        {
+            gridX = atoi(argv[++i]);
+            gridY = atoi(argv[++i]);
+        }
+        else if ((std::string(argv[i]) == "--steps") && (i + 1 < argc))
+        {
+            steps = atol(argv[++i]);
+        }
+        else if ((std::string(argv[i]) == "--hogwild") && (i + 1 < argc))
+        {
+            hogwild = true;
+            maxThreads = atoi(argv[++i]);
+        }
+        else if ((std::string(argv[i]) == "--actor-learner") && (i + 1 < argc))
+        {
+            actorLearner = true;
+            numActors = atoi(argv[++i]);
+        }
+        else if ((std::string(argv[i]) == "--batch") && (i + 1 < argc))
+        {
+            numLanes = atoi(argv[++i]);
+        }
+        else if (std::string(argv[i]) == "--rng")
+        {
+            rng = true;
+        }
+        else if (std::string(argv[i]) == "--alias")
+        {
+            alias = true;
+        }
+        else if ((std::string(argv[i]) == "--checkpoint") && (i + 1 < argc))
+        {
+            checkpointPath = argv[++i];
+        }
+        else
+        {
+            printHelp(argv[0]);
+            return 1;
+        }
+    }
+    if ((gridX < 4) || (gridY < 3))
+    {
+        PRINTERROR("The grid has to be at least 4x3");
+        return 1;
+    }
+
+    // same layout as the demo: goal in the top right corner, the pit below it, one block
+    GridDomain::GridDomainPtrT gridWorld(new GridDomain(gridX, gridY, gridX - 1, gridY - 1, 1, 1,
+                                         gridX - 1, gridY - 2, -0.04, 1, -1, 0.1));
+    if (alias && !enableAliasSampling(*gridWorld)) return 1;
+    if (rng)
+    {
+        benchRandom(steps);
+        return 0;
+    }
+    if (!checkpointPath.empty())
+    {
+        return benchCheckpoint(gridWorld, checkpointPath, steps) ? 0 : 1;
+    }
+    if (hogwild)
+    {
+        benchHogwild(gridWorld, maxThreads, steps);
+        return 0;
+    }
+    if (actorLearner)
+    {
+        benchActorLearner(gridWorld, numActors, steps);
+        return 0;
+    }
+    if (numLanes > 0)
+    {
+        GridDomainBatch batch(numLanes, gridX, gridY, gridX - 1, gridY - 1, 1, 1,
+                              gridX - 1, gridY - 2, -0.04, 1, -1, 0.1);
+        benchBatch(gridWorld, batch, steps);
+        return 0;
+    }
+
+    // the default controller, and a lean one without the statistics and the transition model
+    typedef QLearningController<GridDomain> QLearningControllerT;
+    typedef QLearningController<GridDomain, float, NoChangeStatistics, NoTransitionModel> LeanQLearningControllerT;
+    bool ok = benchStep<QLearningControllerT>("Default", gridWorld, gridX, gridY, steps);
+    ok = benchStep<LeanQLearningControllerT>("Lean", gridWorld, gridX, gridY, steps) && ok;
+    return ok ? 0 : 1;
+}
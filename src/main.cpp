@@ -9,8 +9,11 @@
 #include <rl/GridWorld.h>
 #include <rl/Utility.h>
 #include <rl/QLearning.h>
+#include <rl/StoppingCriterion.h>
 
+#include <chrono>
 #include <string>
+#include <stdlib.h>
 
 using rl::ValueIterationController;
 using rl::PolicyIterationController;
@@ -25,8 +28,22 @@ using rl::DecayLearningRate;
 
 /**
  * \param useAlgorithm 0 for value iteration, 1 for policy iteration, 2 for q-learning
+ * \param useFlatModel compile the domain into a flat model for value and policy iteration
+ * \param numThreads number of threads for value iteration (implies useFlatModel if not 1)
+ * \param viMode update scheme for value iteration
+ * \param evalMethod policy evaluation method for policy iteration
+ * \param omega relaxation factor of SOR policy evaluation
+ * \param criterion additional termination criteria for value and policy iteration, may be NULL
+ * \param anytimeBackups if not 0, value iteration is resumable and performs this many
+ * state updates per step in the world
+ * \param traceMethod backups of q-learning: 0 for one-step, 1 for Watkins's Q(lambda), 2 for SARSA(lambda)
+ * \param lambda trace decay parameter for traceMethod 1 and 2
+ * \param planningSteps if not 0, q-learning does this many Dyna-Q planning backups after each step
  */
-int testGridWorldLearning(unsigned int useAlgorithm)
+int testGridWorldLearning(unsigned int useAlgorithm, bool useFlatModel, unsigned int numThreads,
+                          rl::ValueIterationModeT viMode, rl::PolicyEvaluationMethodT evalMethod,
+                          float omega, rl::StoppingCriterion::StoppingCriterionPtrT criterion, unsigned long anytimeBackups,
+                          unsigned int traceMethod, float lambda, unsigned int planningSteps)
 {
 
     //### 1. Initialise grid world
@@ -70,7 +87,13 @@ int testGridWorldLearning(unsigned int useAlgorithm)
         float discount = 1.0;
         float maxErr = 0.01;
         typedef ValueIterationController<GridDomain> ValueIterationControllerT;
-        learningController = LearningControllerPtrT(new ValueIterationControllerT(gridWorld, defaultUtility, discount, maxErr));
+        ValueIterationControllerT * vi = new ValueIterationControllerT(gridWorld, defaultUtility, discount, maxErr);
+        vi->setUseFlatModel(useFlatModel);
+        if (numThreads != 1) vi->setNumThreads(numThreads);
+        vi->setMode(viMode);
+        vi->setStoppingCriterion(criterion);
+        vi->setAnytime(anytimeBackups);
+        learningController = LearningControllerPtrT(vi);
         break;
     }
     case 1:   //policy iteration
@@ -79,7 +102,11 @@ int testGridWorldLearning(unsigned int useAlgorithm)
         float defaultUtility = 0;
         float discount = 1.0;
         typedef PolicyIterationController<GridDomain> PolicyIterationControllerT;
-        learningController =  LearningControllerPtrT(new PolicyIterationControllerT(gridWorld, defaultUtility, discount));
+        PolicyIterationControllerT * pi = new PolicyIterationControllerT(gridWorld, defaultUtility, discount);
+        pi->setUseFlatModel(useFlatModel);
+        pi->setPolicyEvaluation(evalMethod, 1e-06, 1000, omega);
+        pi->setStoppingCriterion(criterion);
+        learningController =  LearningControllerPtrT(pi);
         break;
     }
     case 2:   //q-learning
@@ -105,7 +132,11 @@ int testGridWorldLearning(unsigned int useAlgorithm)
         ExplorationPtrT explore(new SimpleExplorationT(freqThreshold, gridWorld->getReward()->getOptimisticReward()));
         //ExplorationPtrT explore(new NoExplorationT());
 
-        learningController = LearningControllerPtrT(new QLearningControllerT(gridWorld, learnRate, discount, defaultQ, explore, epsilonGreedy));
+        QLearningControllerT * q = new QLearningControllerT(gridWorld, learnRate, discount, defaultQ, explore, epsilonGreedy);
+        if (traceMethod == 1) q->setEligibilityTraces(QLearningControllerT::WatkinsQLambda, lambda);
+        else if (traceMethod == 2) q->setEligibilityTraces(QLearningControllerT::SarsaLambda, lambda);
+        q->setPlanning(planningSteps);
+        learningController = LearningControllerPtrT(q);
         break;
     }
     }
@@ -130,7 +161,9 @@ int testGridWorldLearning(unsigned int useAlgorithm)
     //one state to the next! This loop also serves as simulation, simultaneously to the learning!
     //We only use the fixed number of iterations for online learners (see LearningController documentation!)
     //because we don't want a simulation in this simple example.
-    while (((learned = learningController->finishedLearning()) == 1) || ((learned == 0) && (doneTrials < numTrials)))
+    //Resumable (anytime) value iteration learns while acting, until it has converged (learned == -1 until then).
+    while (((learned = learningController->finishedLearning()) == 1) || (learned == -1) ||
+            ((learned == 0) && (doneTrials < numTrials)))
     {
         ++i;
         //PRINTMSG("--- At state "<<currState);
@@ -166,7 +199,7 @@ int testGridWorldLearning(unsigned int useAlgorithm)
 
 void printHelp(const char*argv0)
 {
-    PRINTMSG("Usage: " << argv0 << " --value-iteration | --policy-iteration | --q-learning");
+    PRINTMSG("Usage: " << argv0 << " --value-iteration | --policy-iteration | --q-learning [--flat-model] [--threads <n>] [--gauss-seidel | --prioritized] [--sor | --bicgstab] [--omega <w>] [--max-iterations <n>] [--time-budget <ms>] [--anytime <backups>] [--q-lambda <lambda> | --sarsa-lambda <lambda>] [--dyna <n>] [--seed <n>]");
 }
 
 
@@ -201,6 +234,81 @@ int main(int argc, char **argv)
         type = 2;
     }
 
+    bool useFlatModel = false;
+    unsigned int numThreads = 1;
+    rl::ValueIterationModeT viMode = rl::Jacobi;
+    rl::PolicyEvaluationMethodT evalMethod = rl::ModifiedPolicyIteration;
+    float omega = 1.0f;
+    rl::StoppingCriterion::StoppingCriterionPtrT criterion;
+    unsigned long anytimeBackups = 0;
+    unsigned int traceMethod = 0;
+    float lambda = 0;
+    unsigned int planningSteps = 0;
+    for (int i = 2; i < argc; ++i)
+    {
+        if (std::string(argv[i]) == "--flat-model")
+        {
+            useFlatModel = true;
+        }
+        else if ((std::string(argv[i]) == "--threads") && (i + 1 < argc))
+        {
+            numThreads = atoi(argv[++i]);
+        }
+        else if (std::string(argv[i]) == "--gauss-seidel")
+        {
+            viMode = rl::GaussSeidel;
+        }
+        else if (std::string(argv[i]) == "--prioritized")
+        {
+            viMode = rl::PrioritizedSweeping;
+        }
+        else if (std::string(argv[i]) == "--sor")
+        {
+            evalMethod = rl::SOR;
+        }
+        else if (std::string(argv[i]) == "--bicgstab")
+        {
+            evalMethod = rl::BiCGSTAB;
+        }
+        else if ((std::string(argv[i]) == "--omega") && (i + 1 < argc))
+        {
+            omega = atof(argv[++i]);
+        }
+        else if ((std::string(argv[i]) == "--max-iterations") && (i + 1 < argc))
+        {
+            if (!criterion.get()) criterion.reset(new rl::StoppingCriterion());
+            criterion->setMaxIterations(atoi(argv[++i]));
+        }
+        else if ((std::string(argv[i]) == "--time-budget") && (i + 1 < argc))
+        {
+            if (!criterion.get()) criterion.reset(new rl::StoppingCriterion());
+            criterion->setTimeBudget(std::chrono::microseconds(1000 * atol(argv[++i])));
+        }
+        else if ((std::string(argv[i]) == "--anytime") && (i + 1 < argc))
+        {
+            anytimeBackups = atol(argv[++i]);
+        }
+        else if ((std::string(argv[i]) == "--q-lambda") && (i + 1 < argc))
+        {
+            traceMethod = 1;
+            lambda = atof(argv[++i]);
+        }
+        else if ((std::string(argv[i]) == "--sarsa-lambda") && (i + 1 < argc))
+        {
+            traceMethod = 2;
+            lambda = atof(argv[++i]);
+        }
+        else if ((std::string(argv[i]) == "--dyna") && (i + 1 < argc))
+        {
+            planningSteps = atoi(argv[++i]);
+        }
+        else if ((std::string(argv[i]) == "--seed") && (i + 1 < argc))
+        {
+            RandomNumberGenerator::seed(strtoull(argv[++i], NULL, 10));
+        }
+    }
+
     PRINTMSG("Running test on learning type=" << type);
-    return testGridWorldLearning(type);
+    return testGridWorldLearning(type, useFlatModel, numThreads, viMode, evalMethod, omega, criterion, anytimeBackups,
+                                 traceMethod, lambda, planningSteps);
 }